@@ -8,10 +8,16 @@ uniform int fill_mode = FILL_SOLID;
 uniform mat4 the_matrix;
 uniform vec4 the_color;
 uniform float coordinate_scale; /* converts coordinates to EM units, which are in range [0,1] */
+uniform float vertex_scale = 0.5; /* converts packed int16 vertex coordinates to font units */
+uniform vec2 glyph_offset = vec2( 0.0 ); /* font units. Nonzero when the glyph borrows the outline of another glyph */
+uniform int instance_styles = 0; /* nonzero: color and matrix come from attr_instance_color and attr_instance_transform */
+uniform mat4 instance_matrices[16]; /* MAX_INSTANCE_TRANSFORMS in gpufont_draw.h. Applied after the_matrix */
 
-layout(location=0) in vec2 attr_pos;
-layout(location=1) in uint attr_flag;
+layout(location=0) in vec2 attr_pos; /* int16, not normalized */
+layout(location=1) in uint attr_flag; /* uint8 */
 layout(location=2) in vec2 attr_instance_offset; /* one attribute per instance */
+layout(location=3) in vec4 attr_instance_color; /* per instance. Only used if instance_styles is set */
+layout(location=4) in float attr_instance_transform; /* per instance. Index to instance_matrices */
 
 flat out vec4 color_above;
 flat out vec4 color_below;
@@ -37,13 +43,20 @@ const vec4 flag_colors[4] = vec4[4](
 
 void main()
 {
-	gl_Position = the_matrix * vec4( coordinate_scale * ( attr_pos + attr_instance_offset ), 0.0, 1.0 );
+	vec4 color = the_color;
+	
+	gl_Position = the_matrix * vec4( coordinate_scale * ( attr_pos * vertex_scale + glyph_offset + attr_instance_offset ), 0.0, 1.0 );
+	if ( instance_styles != 0 ) {
+		gl_Position = instance_matrices[ int( attr_instance_transform ) ] * gl_Position;
+		color = attr_instance_color;
+	}
+	
 	tex_coord = texc_table[ attr_flag & 3u ];
 	switch( fill_mode )
 	{
 		case FILL_CURVE:
-			vec4 opaque = the_color;
-			vec4 transp = vec4( the_color.rgb, 0.0 );
+			vec4 opaque = color;
+			vec4 transp = vec4( color.rgb, 0.0 );
 			if ( attr_flag >> 2 == 0u ) {
 				// Curve is concave. Paint below the curve
 				color_above = transp;
@@ -59,7 +72,7 @@ void main()
 			break;
 		default:
 		case FILL_SOLID:
-			color_above = color_below = the_color;
+			color_above = color_below = color;
 			break;
 	}
 }
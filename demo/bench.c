@@ -0,0 +1,1658 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "opengl.h"
+#include "types.h"
+#include "microsec.h"
+#include "bench.h"
+#include "matrix.h"
+
+#include "gpufont_data.h"
+#include "gpufont_ttf_file.h"
+#include "gpufont_layout.h"
+#include "gpufont_draw.h"
+#include "gpufont_edit.h"
+#include "gpufont_run_cache.h"
+#include "gpufont_font_stack.h"
+#include "gpufont_coverage.h"
+#include "gpufont_font_cache.h"
+#include "gpufont_doc_view.h"
+#include "gpufont_label_scene.h"
+
+/* Minimum time to spend on each measurement */
+#define MIN_BENCH_MICROS 200000
+
+/* Copies points and flags into 2 separate arrays (the way the vertex data was laid out before interleaving)
+The arrays begin at 'out'. The coordinate array has total_points elements and the flag array comes after it */
+static size_t copy_split( void *out, PointCoord const points[], PointFlag const flags[], size_t first, size_t num_points, size_t total_points )
+{
+	PointCoord *p = out;
+	PointFlag *f = (PointFlag*)( p + 2 * total_points );
+	memcpy( p + 2 * first, points, sizeof( p[0] ) * 2 * num_points );
+	memcpy( f + first, flags, sizeof( f[0] ) * num_points );
+	return num_points * ( sizeof( p[0] ) * 2 + sizeof( f[0] ) );
+}
+
+/* Measures how fast merge_glyph_data converts triangulated glyphs into each vertex layout */
+static int bench_merge( const char *font_filename, const char *text_filename )
+{
+	static const char *names[] = { "split float+uint32 (2 VBOs)", "interleaved FloatVertex", "interleaved PackedVertex" };
+	Font font;
+	PointCoord *points;
+	PointFlag *flags;
+	char *out;
+	FloatVertex const *v;
+	size_t n, total;
+	int mode;
+	
+	(void) text_filename;
+	printf( "Loading %s\n", font_filename );
+	if ( load_ttf_file_ex( &font, font_filename, LOAD_FLOAT_VERTICES ) != F_SUCCESS ) {
+		printf( "Failed to load the font\n" );
+		return 1;
+	}
+	
+	/* Recover the float points & flags that merge_glyph_data receives from the triangulator */
+	total = font.total_points;
+	v = font.all_vertices;
+	points = malloc( sizeof( points[0] ) * 2 * total + 1 );
+	flags = malloc( sizeof( flags[0] ) * total + 1 );
+	out = malloc( sizeof( FloatVertex ) * total + 1 );
+	
+	if ( !points || !flags || !out ) {
+		printf( "Out of memory\n" );
+		return 1;
+	}
+	
+	for( n=0; n<total; n++ ) {
+		points[2*n] = v[n].pos[0];
+		points[2*n+1] = v[n].pos[1];
+		flags[n] = v[n].flag;
+	}
+	
+	printf( "Glyphs: %u\nVertices: %u\n", (uint) font.num_glyphs, (uint) total );
+	
+	for( mode=0; mode<3; mode++ )
+	{
+		uint64 start = get_microsec(), elapsed;
+		unsigned long reps = 0;
+		size_t bytes = 0;
+		
+		do {
+			/* Glyph by glyph, like merge_glyph_data does */
+			bytes = 0;
+			for( n=0; n<font.num_glyphs; n++ )
+			{
+				GlyphDesc const *d = font.glyph_desc + n;
+				size_t first = d->first_vertex;
+				
+				if ( !d->num_points )
+					continue;
+				
+				if ( mode == 0 ) {
+					bytes += copy_split( out, points + 2 * first, flags + first, first, d->num_points, total );
+				} else {
+					VertexLayout layout = ( mode == 1 ) ? VERTEX_FLOAT : VERTEX_PACKED;
+					bytes += pack_vertices( out + first * VERTEX_SIZE( layout ), layout, points + 2 * first, flags + first, d->num_points, 1 );
+				}
+			}
+			reps++;
+			elapsed = get_microsec() - start;
+		} while( elapsed < MIN_BENCH_MICROS );
+		
+		printf( "%-28s %8u bytes %7.2f ns/vertex %8.1f MB/s\n",
+			names[mode], (uint) bytes,
+			1000.0 * elapsed / ( (double) reps * total ),
+			(double) bytes * reps / elapsed );
+	}
+	
+	free( points );
+	free( flags );
+	free( out );
+	destroy_font( &font );
+	return 0;
+}
+
+/* Reports post-transform vertex cache efficiency with and without the load-time optimization pass */
+static int bench_vcache( const char *font_filename, const char *text_filename )
+{
+	static const int load_flags[] = { 0, LOAD_OPTIMIZE_INDICES, LOAD_OPTIMIZE_INDICES | LOAD_RENUMBER_VERTICES };
+	static const char *names[] = { "original order", "tipsify", "tipsify+renumber" };
+	static const unsigned cache_sizes[] = { 8, 16, 32 };
+	int mode;
+	
+	(void) text_filename;
+	printf( "Font: %s\n", font_filename );
+	printf( "%-18s %9s", "", "load ms" );
+	for( mode=0; mode<3; mode++ )
+		printf( "  ACMR/ATVR@%-2u", cache_sizes[mode] );
+	printf( "\n" );
+	
+	for( mode=0; mode<3; mode++ )
+	{
+		Font font;
+		uint64 t = get_microsec();
+		int c;
+		
+		if ( load_ttf_file_ex( &font, font_filename, load_flags[mode] ) != F_SUCCESS ) {
+			printf( "Failed to load the font\n" );
+			return 1;
+		}
+		t = get_microsec() - t;
+		
+		printf( "%-18s %9.1f", names[mode], t / 1000.0 );
+		for( c=0; c<3; c++ )
+		{
+			double acmr, atvr;
+			simulate_vertex_cache( &font, cache_sizes[c], &acmr, &atvr );
+			printf( "  %5.3f/%5.3f ", acmr, atvr );
+		}
+		printf( "\n" );
+		destroy_font( &font );
+	}
+	
+	return 0;
+}
+
+/* Compares loading with and without sharing the geometry of glyphs that have identical outlines */
+static int bench_dedup( const char *font_filename, const char *text_filename )
+{
+	static const int load_flags[] = { LOAD_NO_DEDUP, 0 };
+	static const char *names[] = { "no dedup", "dedup" };
+	size_t bytes[2];
+	uint64 times[2];
+	int mode;
+	
+	(void) text_filename;
+	printf( "Font: %s\n", font_filename );
+	printf( "%-10s %9s %13s %10s %10s %12s\n", "", "load ms", "shared glyphs", "vertices", "indices", "bytes" );
+	
+	for( mode=0; mode<2; mode++ )
+	{
+		Font font;
+		char *seen;
+		size_t n, shared = 0;
+		uint64 t = get_microsec();
+		
+		if ( load_ttf_file_ex( &font, font_filename, load_flags[mode] ) != F_SUCCESS ) {
+			printf( "Failed to load the font\n" );
+			return 1;
+		}
+		times[mode] = t = get_microsec() - t;
+		
+		/* Glyphs whose geometry starts at the same vertex as an earlier glyph are shared */
+		seen = calloc( font.total_points + 1, 1 );
+		if ( !seen ) {
+			destroy_font( &font );
+			return 1;
+		}
+		for( n=0; n<font.num_glyphs; n++ )
+		{
+			GlyphDesc const *d = font.glyph_desc + n;
+			if ( !d->num_points )
+				continue;
+			shared += seen[ d->first_vertex ];
+			seen[ d->first_vertex ] = 1;
+		}
+		free( seen );
+		
+		bytes[mode] = font.total_points * VERTEX_SIZE( font.vertex_layout ) + font.total_indices * sizeof( PointIndex );
+		printf( "%-10s %9.1f %13u %10u %10u %12u\n", names[mode], t / 1000.0, (uint) shared,
+			(uint) font.total_points, (uint) font.total_indices, (uint) bytes[mode] );
+		destroy_font( &font );
+	}
+	
+	printf( "Saved %u bytes of vertex+index data (%.1f%%) and %.1f ms of loading\n",
+		(uint)( bytes[0] - bytes[1] ),
+		bytes[0] ? 100.0 * ( bytes[0] - bytes[1] ) / bytes[0] : 0.0,
+		( (double) times[0] - (double) times[1] ) / 1000.0 );
+	
+	return 0;
+}
+
+/* Reads a whole UTF-32 file. Returns NULL if failure */
+static uint32 *read_utf32_file( const char *filename, size_t *len )
+{
+	FILE *fp = fopen( filename, "rb" );
+	uint32 *text = NULL;
+	long size;
+	
+	if ( !fp )
+		return NULL;
+	
+	if ( !fseek( fp, 0, SEEK_END ) && ( size = ftell( fp ) ) >= 4 && !fseek( fp, 0, SEEK_SET ) )
+	{
+		*len = size >> 2;
+		text = malloc( *len * 4 );
+		if ( text && fread( text, 4, *len, fp ) != *len ) {
+			free( text );
+			text = NULL;
+		}
+	}
+	
+	fclose( fp );
+	return text;
+}
+
+/* Measures do_simple_layout throughput (including the upload of glyph positions) on the bundled texts */
+static int bench_layout( Font *font, const char *text_filename )
+{
+	static const char *texts[] = {
+		"data/artofwar_utf32.txt",
+		"data/artofwar_utf32_english.txt",
+		"data/孙子兵法_utf32.txt"
+	};
+	size_t t;
+	
+	(void) text_filename;
+	
+	for( t=0; t<sizeof( texts ) / sizeof( texts[0] ); t++ )
+	{
+		uint64 start, elapsed;
+		unsigned long reps = 0;
+		size_t len;
+		uint32 *text = read_utf32_file( texts[t], &len );
+		
+		if ( !text ) {
+			printf( "Failed to read %s\n", texts[t] );
+			return 1;
+		}
+		
+		start = get_microsec();
+		do {
+			GlyphBuffer *b = do_simple_layout( font, text, len, 80, -1 );
+			if ( !b ) {
+				free( text );
+				return 1;
+			}
+			delete_glyph_buffer( b );
+			reps++;
+			elapsed = get_microsec() - start;
+		} while( elapsed < MIN_BENCH_MICROS );
+		
+		printf( "%-40s %8u chars %9.1f us/layout %8.2f Mchars/s\n", texts[t], (uint) len,
+			(double) elapsed / reps, (double) len * reps / elapsed );
+		free( text );
+	}
+	
+	return 0;
+}
+
+/* Reads a whole file. Returns NULL if failure */
+static char *read_whole_file( const char *filename, size_t *len )
+{
+	FILE *fp = fopen( filename, "rb" );
+	char *data = NULL;
+	long size;
+	
+	if ( !fp )
+		return NULL;
+	
+	if ( !fseek( fp, 0, SEEK_END ) && ( size = ftell( fp ) ) > 0 && !fseek( fp, 0, SEEK_SET ) )
+	{
+		*len = size;
+		data = malloc( size );
+		if ( data && fread( data, 1, size, fp ) != *len ) {
+			free( data );
+			data = NULL;
+		}
+	}
+	
+	fclose( fp );
+	return data;
+}
+
+/* Measures layout straight from UTF-8 and compares it to laying out the same text from UTF-32 */
+static int bench_utf8( Font *font, const char *text_filename )
+{
+	static const char *texts[][2] = {
+		{ "data/artofwar_utf8.txt", "data/artofwar_utf32.txt" },
+		{ "data/孙子兵法_utf8.txt", "data/孙子兵法_utf32.txt" },
+		{ "data/artofwar_ascii_english.txt", "data/artofwar_utf32_english.txt" },
+		{ "data/artofwar_mixed.txt", NULL }
+	};
+	size_t t;
+	
+	(void) text_filename;
+	
+	for( t=0; t<sizeof( texts ) / sizeof( texts[0] ); t++ )
+	{
+		int utf32;
+		for( utf32=0; utf32<2; utf32++ )
+		{
+			uint64 start, elapsed;
+			unsigned long reps = 0;
+			size_t len, num_errors = 0;
+			char *text;
+			
+			if ( !texts[t][utf32] )
+				continue;
+			
+			text = read_whole_file( texts[t][utf32], &len );
+			if ( !text ) {
+				printf( "Failed to read %s\n", texts[t][utf32] );
+				return 1;
+			}
+			
+			start = get_microsec();
+			do {
+				GlyphBuffer *b;
+				if ( utf32 )
+					b = do_simple_layout( font, (uint32*) text, len / 4, 80, -1 );
+				else
+					b = do_simple_layout_utf8( font, text, len, 80, -1, &num_errors );
+				if ( !b ) {
+					free( text );
+					return 1;
+				}
+				delete_glyph_buffer( b );
+				reps++;
+				elapsed = get_microsec() - start;
+			} while( elapsed < MIN_BENCH_MICROS );
+			
+			printf( "%-34s %8u bytes %9.1f us/layout %8.1f MB/s", texts[t][utf32], (uint) len,
+				(double) elapsed / reps, (double) len * reps / elapsed );
+			if ( !utf32 )
+				printf( " %u malformed", (uint)( num_errors / reps ) );
+			printf( "\n" );
+			free( text );
+		}
+	}
+	
+	return 0;
+}
+
+static void count_and_free_page( GlyphBuffer *page, void *num_pages )
+{
+	*(size_t*) num_pages += 1;
+	delete_glyph_buffer( page );
+}
+
+/* Lays out a large document (the English text repeated many times) at once and through a layout stream */
+static int bench_stream( Font *font, const char *text_filename )
+{
+	const size_t copies = 64, chunk_size = 4096, page_size = 16384;
+	const size_t scratch_per_char = 20; /* TempChar + 2 floats */
+	size_t len, doc_len, n;
+	char *text, *doc;
+	int mode;
+	
+	(void) text_filename;
+	text = read_whole_file( "data/artofwar_ascii_english.txt", &len );
+	if ( !text )
+		return 1;
+	
+	doc_len = len * copies;
+	doc = malloc( doc_len );
+	if ( !doc ) {
+		free( text );
+		return 1;
+	}
+	for( n=0; n<copies; n++ )
+		memcpy( doc + n * len, text, len );
+	free( text );
+	
+	printf( "Document: %u bytes\n", (uint) doc_len );
+	
+	for( mode=0; mode<2; mode++ )
+	{
+		uint64 start = get_microsec(), elapsed;
+		size_t num_pages = 0;
+		
+		if ( mode == 0 )
+		{
+			GlyphBuffer *b = do_simple_layout_utf8( font, doc, doc_len, 80, -1, NULL );
+			if ( !b )
+				break;
+			delete_glyph_buffer( b );
+			num_pages = 1;
+		}
+		else
+		{
+			LayoutStream *s = begin_layout_stream( font, 80, -1, page_size, count_and_free_page, &num_pages );
+			if ( !s )
+				break;
+			for( n=0; n<doc_len; n+=chunk_size )
+				feed_layout_stream_utf8( s, doc + n, n + chunk_size < doc_len ? chunk_size : doc_len - n );
+			if ( !end_layout_stream( s, NULL ) )
+				break;
+		}
+		
+		elapsed = get_microsec() - start;
+		printf( "%-8s %8.1f ms %8.1f MB/s %6u pages %10u bytes of scratch memory\n",
+			mode ? "stream" : "at once",
+			elapsed / 1000.0, (double) doc_len / elapsed, (uint) num_pages,
+			(uint)( mode ? page_size * scratch_per_char : doc_len * scratch_per_char ) );
+	}
+	
+	free( doc );
+	return mode < 2;
+}
+
+/* Measures how parallel layout scales with the number of threads */
+static int bench_parallel( Font *font, const char *text_filename )
+{
+	extern unsigned omp_get_num_procs( void );
+	const size_t copies = 64;
+	int max_threads = omp_get_num_procs();
+	int threads;
+	size_t len, doc_len, n;
+	char *text, *doc;
+	double single = 0;
+	
+	(void) text_filename;
+	text = read_whole_file( "data/artofwar_ascii_english.txt", &len );
+	if ( !text )
+		return 1;
+	
+	doc_len = len * copies;
+	doc = malloc( doc_len );
+	if ( !doc ) {
+		free( text );
+		return 1;
+	}
+	for( n=0; n<copies; n++ )
+		memcpy( doc + n * len, text, len );
+	free( text );
+	
+	printf( "Document: %u bytes. Processors: %d\n", (uint) doc_len, max_threads );
+	
+	/* 1, 2, 4, ... and finally all processors */
+	for( threads=1; ; threads = ( threads * 2 < max_threads ) ? threads * 2 : max_threads )
+	{
+		uint64 start = get_microsec(), elapsed;
+		unsigned long reps = 0;
+		double us;
+		
+		do {
+			GlyphBuffer *b = do_simple_layout_parallel_utf8( font, doc, doc_len, 80, -1, threads, NULL );
+			if ( !b ) {
+				free( doc );
+				return 1;
+			}
+			delete_glyph_buffer( b );
+			reps++;
+			elapsed = get_microsec() - start;
+		} while( elapsed < MIN_BENCH_MICROS );
+		
+		us = (double) elapsed / reps;
+		if ( threads == 1 )
+			single = us;
+		
+		printf( "%3d threads %9.1f ms/layout %8.1f MB/s  speedup %5.2fx\n", threads, us / 1000.0, doc_len / us, single / us );
+		
+		if ( threads >= max_threads )
+			break;
+	}
+	
+	free( doc );
+	return 0;
+}
+
+/* Compares small edits in a TextEdit to laying out the whole document again after every edit */
+static int bench_edit( Font *font, const char *text_filename )
+{
+	const unsigned num_edits = 1000;
+	size_t len;
+	uint32 *text = read_utf32_file( "data/artofwar_utf32_english.txt", &len );
+	TextEdit *te;
+	TextEditStats before, after;
+	uint64 start, elapsed;
+	unsigned n;
+	
+	(void) text_filename;
+	if ( !text )
+		return 1;
+	
+	te = create_text_edit( font, 80, -1 );
+	if ( !te || !text_edit_insert( te, 0, 0, text, len ) ) {
+		free( text );
+		return 1;
+	}
+	
+	printf( "Document: %u characters, %u lines\n", (uint) len, (uint) text_edit_num_lines( te ) );
+	get_text_edit_stats( te, &before );
+	srand( 1 );
+	
+	/* Type and erase single characters at random places */
+	start = get_microsec();
+	for( n=0; n<num_edits; n++ )
+	{
+		size_t line = rand() % text_edit_num_lines( te );
+		size_t col = rand() % ( text_edit_line_len( te, line ) + 1 );
+		if ( n & 1 ) {
+			text_edit_delete( te, line, col, 1 );
+		} else {
+			uint32 c = 'a' + rand() % 26;
+			text_edit_insert( te, line, col, &c, 1 );
+		}
+	}
+	elapsed = get_microsec() - start;
+	get_text_edit_stats( te, &after );
+	
+	printf( "TextEdit:        %8.2f us/edit %8.1f glyphs uploaded/edit %4u VBO reallocations\n",
+		(double) elapsed / num_edits,
+		(double)( after.glyphs_uploaded - before.glyphs_uploaded ) / num_edits,
+		(uint)( after.buffer_reallocs - before.buffer_reallocs ) );
+	
+	/* The old way: lay out everything again */
+	start = get_microsec();
+	n = 0;
+	do {
+		GlyphBuffer *b = do_simple_layout( font, text, len, 80, -1 );
+		if ( b )
+			delete_glyph_buffer( b );
+		n++;
+		elapsed = get_microsec() - start;
+	} while( elapsed < MIN_BENCH_MICROS );
+	
+	printf( "Full relayout:   %8.2f us/edit %8.1f glyphs uploaded/edit\n", (double) elapsed / n, (double) len );
+	
+	delete_text_edit( te );
+	free( text );
+	return 0;
+}
+
+/* Draws frames of num_strings strings with draw_text_live_utf8. Each string is about str_len characters long and changes every frame */
+static void bench_live_frames( Font *font, unsigned num_strings, size_t str_len )
+{
+	char *str = malloc( str_len + 64 );
+	float matrix[16] = {0};
+	uint64 start, elapsed;
+	unsigned frames = 0, cols = 25;
+	size_t total_chars = 0;
+	
+	if ( !str )
+		return;
+	
+	matrix[0] = matrix[5] = 0.002f;
+	matrix[10] = matrix[15] = 1;
+	
+	begin_text( font );
+	start = get_microsec();
+	do {
+		unsigned n;
+		for( n=0; n<num_strings; n++ )
+		{
+			size_t len = sprintf( str, "Unit %4u frame %6u x=%7.2f ", n, frames, ( n * 7 + frames ) * 0.01 );
+			while( len < str_len ) {
+				str[len] = 'a' + ( len + n + frames ) % 26;
+				len++;
+			}
+			matrix[12] = -1.0f + 2.0f * ( n % cols ) / cols;
+			matrix[13] = -1.0f + 2.0f * ( n / cols % 40 ) / 40;
+			draw_text_live_utf8( font, str, len, -1, 1, matrix, F_DRAW_TRIS, NULL );
+			total_chars += len;
+		}
+		glFinish();
+		frames++;
+		elapsed = get_microsec() - start;
+	} while( elapsed < MIN_BENCH_MICROS );
+	end_text();
+	
+	printf( "%5u strings x %5u chars: %9.2f ms/frame %8.2f us/string %7.2f Mchars/s\n", num_strings, (uint) str_len,
+		(double) elapsed / frames / 1000, (double) elapsed / frames / num_strings, (double) total_chars / elapsed );
+	free( str );
+}
+
+static int bench_live( Font *font, const char *text_filename )
+{
+	(void) text_filename;
+	bench_live_frames( font, 1000, 32 );
+	bench_live_frames( font, 100, 32 );
+	bench_live_frames( font, 10, 2000 );
+	release_live_text_buffers();
+	return 0;
+}
+
+/* Frames of 1000 HUD-like strings. Every 20th string changes every frame, the rest never change
+Uses cache if it is not NULL, otherwise draw_text_live. Nothing is rasterized (draw_flags = 0) so that only the CPU side is measured */
+static void bench_hud_frames( Font *font, RunCache *cache )
+{
+	const unsigned num_strings = 1000;
+	float matrix[16] = {0};
+	uint64 start, elapsed;
+	unsigned frames = 0;
+	char str[64];
+	
+	matrix[0] = matrix[5] = 0.002f;
+	matrix[10] = matrix[15] = 1;
+	
+	begin_text( font );
+	start = get_microsec();
+	do {
+		unsigned n;
+		for( n=0; n<num_strings; n++ )
+		{
+			size_t len;
+			if ( n % 20 == 0 )
+				len = sprintf( str, "Pos (%.2f, %.2f) Frame %u", n * 0.5, frames * 0.25, frames );
+			else
+				len = sprintf( str, "Label %u: Yaw %d Pitch %d", n, (int) n % 360, (int) n % 90 );
+			matrix[12] = -1.0f + 2.0f * ( n % 25 ) / 25;
+			matrix[13] = -1.0f + 2.0f * ( n / 25 ) / 40;
+			if ( cache )
+				draw_text_cached_utf8( cache, font, str, len, -1, 1, matrix, 0, NULL );
+			else
+				draw_text_live_utf8( font, str, len, -1, 1, matrix, 0, NULL );
+		}
+		frames++;
+		elapsed = get_microsec() - start;
+	} while( elapsed < MIN_BENCH_MICROS );
+	end_text();
+	
+	printf( "%-16s %9.2f us/frame %7.2f us/string\n", cache ? "draw_text_cached" : "draw_text_live",
+		(double) elapsed / frames, (double) elapsed / frames / num_strings );
+}
+
+static int bench_runcache( Font *font, const char *text_filename )
+{
+	RunCache *cache = create_run_cache( 1 << 20 );
+	RunCacheStats stats;
+	
+	(void) text_filename;
+	if ( !cache )
+		return 1;
+	
+	bench_hud_frames( font, NULL );
+	bench_hud_frames( font, cache );
+	
+	get_run_cache_stats( cache, &stats );
+	printf( "%u hits %u misses (%.1f%% hit rate) %u evictions, %u runs in %u bytes\n", (uint) stats.hits, (uint) stats.misses,
+		100.0 * stats.hits / ( stats.hits + stats.misses ), (uint) stats.evictions, (uint) stats.num_runs, (uint) stats.bytes_used );
+	
+	delete_run_cache( cache );
+	release_live_text_buffers();
+	return 0;
+}
+
+/* Measures whole texts and then every line of a text as a separate string */
+static int bench_measure( const char *font_filename, const char *text_filename )
+{
+	static const char *texts[] = {
+		"data/artofwar_utf32.txt",
+		"data/artofwar_utf32_english.txt",
+		"data/孙子兵法_utf32.txt"
+	};
+	Font font;
+	size_t t;
+	
+	(void) text_filename;
+	if ( load_ttf_file( &font, font_filename ) != F_SUCCESS ) {
+		printf( "Failed to load the font\n" );
+		return 1;
+	}
+	
+	for( t=0; t<sizeof( texts ) / sizeof( texts[0] ); t++ )
+	{
+		uint32 const **lines;
+		size_t *line_lens;
+		TextExtents ext, *line_ext;
+		uint64 start, elapsed;
+		unsigned long reps = 0;
+		size_t len, n, num_lines = 0;
+		uint32 *text = read_utf32_file( texts[t], &len );
+		
+		if ( !text ) {
+			printf( "Failed to read %s\n", texts[t] );
+			destroy_font( &font );
+			return 1;
+		}
+		
+		start = get_microsec();
+		do {
+			measure_text( &font, text, len, 80, -1, &ext, NULL, 0 );
+			reps++;
+			elapsed = get_microsec() - start;
+		} while( elapsed < MIN_BENCH_MICROS );
+		
+		printf( "%-40s %6u lines %9.1f us/text %8.2f Mchars/s\n", texts[t], (uint) ext.num_lines,
+			(double) elapsed / reps, (double) len * reps / elapsed );
+		
+		/* Every line as its own string, like a list of UI labels */
+		lines = malloc( len * sizeof( lines[0] ) );
+		line_lens = malloc( len * sizeof( line_lens[0] ) );
+		line_ext = malloc( len * sizeof( line_ext[0] ) );
+		if ( lines && line_lens && line_ext )
+		{
+			size_t begin = 0;
+			for( n=0; n<=len; n++ ) {
+				if ( n == len || text[n] == '\n' ) {
+					lines[num_lines] = text + begin;
+					line_lens[num_lines++] = n - begin;
+					begin = n + 1;
+				}
+			}
+			
+			reps = 0;
+			start = get_microsec();
+			do {
+				measure_texts( &font, lines, line_lens, num_lines, -1, -1, line_ext );
+				reps++;
+				elapsed = get_microsec() - start;
+			} while( elapsed < MIN_BENCH_MICROS );
+			
+			printf( "%-40s %6u strings %7.1f us/batch %8.3f us/string\n", "  as separate strings", (uint) num_lines,
+				(double) elapsed / reps, (double) elapsed / reps / num_lines );
+		}
+		
+		free( lines );
+		free( line_lens );
+		free( line_ext );
+		free( text );
+	}
+	
+	destroy_font( &font );
+	return 0;
+}
+
+/* Positions the bundled texts through measure_text with a layout feature (font.use_kerning or font.use_subst) off and on */
+static int bench_feature( const char *font_filename, int use_subst )
+{
+	static const char *texts[] = {
+		"data/artofwar_utf32.txt",
+		"data/artofwar_utf32_english.txt",
+		"data/孙子兵法_utf32.txt"
+	};
+	Font font;
+	int *flag;
+	size_t t;
+	
+	if ( load_ttf_file( &font, font_filename ) != F_SUCCESS ) {
+		printf( "Failed to load the font\n" );
+		return 1;
+	}
+	
+	if ( use_subst ) {
+		flag = &font.use_subst;
+		printf( "Ligatures: %u\n", (uint) font.subst.num_ligatures );
+	} else {
+		flag = &font.use_kerning;
+		printf( "Kerning pairs: %u\n", (uint) font.kerning.num_pairs );
+	}
+	
+	for( t=0; t<sizeof( texts ) / sizeof( texts[0] ); t++ )
+	{
+		TextExtents ext[2];
+		uint64 start, elapsed[2];
+		unsigned long reps[2] = {0,0};
+		size_t len;
+		int k;
+		uint32 *text = read_utf32_file( texts[t], &len );
+		
+		if ( !text ) {
+			printf( "Failed to read %s\n", texts[t] );
+			destroy_font( &font );
+			return 1;
+		}
+		
+		for( k=0; k<2; k++ )
+		{
+			*flag = k;
+			start = get_microsec();
+			do {
+				measure_text( &font, text, len, 80, -1, ext + k, NULL, 0 );
+				reps[k]++;
+				elapsed[k] = get_microsec() - start;
+			} while( elapsed[k] < MIN_BENCH_MICROS );
+		}
+		
+		printf( "%-40s off %8.2f Mchars/s on %8.2f Mchars/s (%+.2f ns/char) widest line %d -> %d\n", texts[t],
+			(double) len * reps[0] / elapsed[0], (double) len * reps[1] / elapsed[1],
+			1000.0 * ( (double) elapsed[1] / reps[1] - (double) elapsed[0] / reps[0] ) / len,
+			(int) ext[0].max_width, (int) ext[1].max_width );
+		
+		free( text );
+	}
+	
+	destroy_font( &font );
+	return 0;
+}
+
+/* Cost of pair kerning per character */
+static int bench_kern( const char *font_filename, const char *text_filename )
+{
+	(void) text_filename;
+	return bench_feature( font_filename, 0 );
+}
+
+/* Cost of glyph substitution (ligatures) per character */
+static int bench_subst( const char *font_filename, const char *text_filename )
+{
+	(void) text_filename;
+	return bench_feature( font_filename, 1 );
+}
+
+/* Checks whether the font has every character of a text: one cmap lookup per character compared to the coverage bitmaps */
+static int bench_coverage( const char *font_filename, const char *text_filename )
+{
+	static const char *texts[][2] = {
+		{ "data/artofwar_utf32.txt", "data/artofwar_utf8.txt" },
+		{ "data/artofwar_utf32_english.txt", "data/artofwar_ascii_english.txt" },
+		{ "data/孙子兵法_utf32.txt", "data/孙子兵法_utf8.txt" }
+	};
+	Font font;
+	size_t t;
+	
+	(void) text_filename;
+	
+	if ( load_ttf_file( &font, font_filename ) != F_SUCCESS ) {
+		printf( "Failed to load the font\n" );
+		return 1;
+	}
+	
+	printf( "Code points: %u\n", (uint) font.coverage.num_codes );
+	
+	for( t=0; t<sizeof( texts ) / sizeof( texts[0] ); t++ )
+	{
+		uint64 start, elapsed[3];
+		unsigned long reps[3] = {0,0,0};
+		size_t len, num_bytes, n, found[3];
+		uint32 *text = read_utf32_file( texts[t][0], &len );
+		char *text8 = read_whole_file( texts[t][1], &num_bytes );
+		
+		if ( !text || !text8 ) {
+			printf( "Failed to read %s\n", texts[t][ text != NULL ] );
+			free( text );
+			free( text8 );
+			destroy_font( &font );
+			return 1;
+		}
+		
+		/* The UTF-32 files begin with a byte order mark */
+		if ( len && text[0] == 0xFEFF ) {
+			memmove( text, text + 1, --len * sizeof( text[0] ) );
+		}
+		
+		/* Looks up every character. The other two stop at the first uncovered one */
+		start = get_microsec();
+		do {
+			found[0] = len;
+			for( n=len; n-- > 0; ) {
+				GlyphIndex g = get_cmap_entry( &font, text[n] );
+				if ( text[n] != '\n' && ( !g || g >= font.num_glyphs ) )
+					found[0] = n;
+			}
+			reps[0]++;
+			elapsed[0] = get_microsec() - start;
+		} while( elapsed[0] < MIN_BENCH_MICROS );
+		
+		start = get_microsec();
+		do {
+			found[1] = find_uncovered_char( &font, text, len );
+			reps[1]++;
+			elapsed[1] = get_microsec() - start;
+		} while( elapsed[1] < MIN_BENCH_MICROS );
+		
+		start = get_microsec();
+		do {
+			found[2] = find_uncovered_char_utf8( &font, text8, num_bytes );
+			reps[2]++;
+			elapsed[2] = get_microsec() - start;
+		} while( elapsed[2] < MIN_BENCH_MICROS );
+		
+		printf( "%-40s first uncovered %7u / %7u (UTF-8 byte %7u / %7u)  cmap %8.1f us   bitmaps %8.1f us   UTF-8 %8.1f us\n", texts[t][0], (uint) found[1], (uint) len, (uint) found[2], (uint) num_bytes,
+			(double) elapsed[0] / reps[0], (double) elapsed[1] / reps[1], (double) elapsed[2] / reps[2] );
+		
+		if ( found[0] != found[1] )
+			printf( "Mismatch: cmap says %u\n", (uint) found[0] );
+		
+		free( text );
+		free( text8 );
+	}
+	
+	destroy_font( &font );
+	return 0;
+}
+
+/* Compares loading the whole font to loading the subset that a text needs, and to loading that subset from a cache file */
+static int bench_subset( const char *font_filename, const char *text_filename )
+{
+	static const char *texts[] = { "data/artofwar_ascii_english.txt", "data/artofwar_utf8.txt" };
+	static const char *cache_filename = "bench_subset.cache";
+	Font font;
+	uint64 t;
+	size_t k;
+	
+	(void) text_filename;
+	printf( "Font: %s\n", font_filename );
+	printf( "%-34s %9s %8s %10s %10s\n", "", "load ms", "glyphs", "vertices", "indices" );
+	
+	t = get_microsec();
+	if ( load_ttf_file( &font, font_filename ) != F_SUCCESS ) {
+		printf( "Failed to load the font\n" );
+		return 1;
+	}
+	t = get_microsec() - t;
+	printf( "%-34s %9.1f %8u %10u %10u\n", "whole font", t / 1000.0, (uint) font.num_glyphs, (uint) font.total_points, (uint) font.total_indices );
+	destroy_font( &font );
+	
+	for( k=0; k<sizeof( texts ) / sizeof( texts[0] ); k++ )
+	{
+		size_t num_bytes;
+		char *text = read_whole_file( texts[k], &num_bytes );
+		FontStatus status;
+		
+		if ( !text ) {
+			printf( "Failed to read %s\n", texts[k] );
+			return 1;
+		}
+		
+		t = get_microsec();
+		status = load_ttf_subset_utf8( &font, font_filename, 0, text, num_bytes );
+		t = get_microsec() - t;
+		free( text );
+		
+		if ( status != F_SUCCESS ) {
+			printf( "Failed to load the subset\n" );
+			destroy_font( &font );
+			return 1;
+		}
+		printf( "%-34s %9.1f %8u %10u %10u\n", texts[k], t / 1000.0, (uint) font.num_glyphs, (uint) font.total_points, (uint) font.total_indices );
+		
+		status = save_font_cache( &font, cache_filename );
+		destroy_font( &font );
+		if ( status != F_SUCCESS ) {
+			printf( "Failed to write %s\n", cache_filename );
+			return 1;
+		}
+		
+		t = get_microsec();
+		status = load_font_cache( &font, cache_filename );
+		t = get_microsec() - t;
+		remove( cache_filename );
+		
+		if ( status != F_SUCCESS ) {
+			printf( "Failed to read %s\n", cache_filename );
+			destroy_font( &font );
+			return 1;
+		}
+		printf( "%-34s %9.1f %8u %10u %10u\n", "  same subset from a cache file", t / 1000.0, (uint) font.num_glyphs, (uint) font.total_points, (uint) font.total_indices );
+		destroy_font( &font );
+	}
+	
+	return 0;
+}
+
+/* Compares do_simple_layout with the two-phase layout into memory that is reused from one layout to the next */
+static int bench_twophase( Font *font, const char *text_filename )
+{
+	static const char *texts[] = {
+		"data/artofwar_utf32.txt",
+		"data/artofwar_utf32_english.txt",
+		"data/孙子兵法_utf32.txt"
+	};
+	size_t t;
+	
+	(void) text_filename;
+	
+	for( t=0; t<sizeof( texts ) / sizeof( texts[0] ); t++ )
+	{
+		uint64 start, elapsed[3];
+		unsigned long reps[3] = {0,0,0};
+		size_t len;
+		uint32 *text = read_utf32_file( texts[t], &len );
+		LayoutSize size;
+		LayoutOutput out;
+		
+		if ( !text ) {
+			printf( "Failed to read %s\n", texts[t] );
+			return 1;
+		}
+		
+		start = get_microsec();
+		do {
+			GlyphBuffer *b = do_simple_layout( font, text, len, 80, -1 );
+			if ( b )
+				delete_glyph_buffer( b );
+			reps[0]++;
+			elapsed[0] = get_microsec() - start;
+		} while( elapsed[0] < MIN_BENCH_MICROS );
+		
+		get_layout_size( font, text, len, &size );
+		out.glyph_indices = malloc( size.num_batches * sizeof( out.glyph_indices[0] ) );
+		out.batch_len = malloc( size.num_batches * sizeof( out.batch_len[0] ) );
+		out.positions = malloc( size.num_glyphs * 2 * sizeof( out.positions[0] ) );
+		out.scratch = malloc( size.scratch_bytes );
+		
+		if ( out.glyph_indices && out.batch_len && out.positions && out.scratch )
+		{
+			start = get_microsec();
+			do {
+				get_layout_size( font, text, len, &size );
+				reps[1]++;
+				elapsed[1] = get_microsec() - start;
+			} while( elapsed[1] < MIN_BENCH_MICROS );
+			
+			start = get_microsec();
+			do {
+				layout_into( font, text, len, 80, -1, &size, &out );
+				reps[2]++;
+				elapsed[2] = get_microsec() - start;
+			} while( elapsed[2] < MIN_BENCH_MICROS );
+			
+			printf( "%-40s do_simple_layout %8.1f us   get_layout_size %8.1f us   layout_into %8.1f us\n", texts[t],
+				(double) elapsed[0] / reps[0], (double) elapsed[1] / reps[1], (double) elapsed[2] / reps[2] );
+		}
+		
+		free( out.glyph_indices );
+		free( out.batch_len );
+		free( out.positions );
+		free( out.scratch );
+		free( text );
+	}
+	
+	
+	/* A text with the same number of glyphs in the same range but more distinct glyphs than were measured must be rejected without writing past the arrays */
+	{
+		static const uint32 measured[] = { 'a', 'a', 'c' }, other[] = { 'a', 'b', 'c' };
+		const uint32 canary = 0xDEADBEEF;
+		uint32 glyph_indices[4];
+		size_t batch_len[4];
+		float positions[8];
+		size_t scratch[64];
+		LayoutSize size;
+		LayoutOutput out;
+		int ok;
+		
+		get_layout_size( font, measured, 3, &size );
+		if ( size.num_batches >= 4 || size.scratch_bytes > sizeof( scratch ) ) {
+			printf( "Mismatched text: skipped\n" );
+			return 0;
+		}
+		
+		glyph_indices[ size.num_batches ] = canary;
+		batch_len[ size.num_batches ] = canary;
+		out.glyph_indices = glyph_indices;
+		out.batch_len = batch_len;
+		out.positions = positions;
+		out.scratch = scratch;
+		
+		ok = layout_into( font, other, 3, 80, -1, &size, &out );
+		if ( ok || glyph_indices[ size.num_batches ] != canary || batch_len[ size.num_batches ] != canary ) {
+			printf( "Mismatched text: FAILED (returned %d, arrays %s)\n", ok, glyph_indices[ size.num_batches ] != canary || batch_len[ size.num_batches ] != canary ? "overwritten" : "intact" );
+			return 1;
+		}
+		printf( "Mismatched text: rejected\n" );
+	}
+	return 0;
+}
+
+/* Compares wrapping every 80 characters with wrapping to the width of 80 average characters */
+static int bench_wrap( Font *font, const char *text_filename )
+{
+	static const char *texts[] = {
+		"data/artofwar_utf32.txt",
+		"data/artofwar_utf32_english.txt",
+		"data/孙子兵法_utf32.txt"
+	};
+	size_t t;
+	
+	(void) text_filename;
+	
+	for( t=0; t<sizeof( texts ) / sizeof( texts[0] ); t++ )
+	{
+		uint64 start, elapsed[2];
+		unsigned long reps[2] = {0,0};
+		double total_adv = 0;
+		int32_t width;
+		size_t len, n;
+		uint32 *text = read_utf32_file( texts[t], &len );
+		
+		if ( !text ) {
+			printf( "Failed to read %s\n", texts[t] );
+			return 1;
+		}
+		
+		for( n=0; n<len; n++ )
+			total_adv += font->metrics.adv_width[ get_cmap_entry( font, text[n] ) ];
+		width = 80 * total_adv / len;
+		
+		start = get_microsec();
+		do {
+			GlyphBuffer *b = do_simple_layout( font, text, len, 80, -1 );
+			if ( b )
+				delete_glyph_buffer( b );
+			reps[0]++;
+			elapsed[0] = get_microsec() - start;
+		} while( elapsed[0] < MIN_BENCH_MICROS );
+		
+		start = get_microsec();
+		do {
+			GlyphBuffer *b = do_wrapped_layout( font, text, len, width, -1 );
+			if ( b )
+				delete_glyph_buffer( b );
+			reps[1]++;
+			elapsed[1] = get_microsec() - start;
+		} while( elapsed[1] < MIN_BENCH_MICROS );
+		
+		printf( "%-40s 80 columns %8.1f us   %6d units wide %8.1f us\n", texts[t],
+			(double) elapsed[0] / reps[0], (int) width, (double) elapsed[1] / reps[1] );
+		free( text );
+	}
+	
+	return 0;
+}
+
+/* Fonts that bench_fallback tries as the second font of the stack, in this order. The first one is the Latin + CJK case */
+static const char *fallback_fonts[] = {
+	"ttf/wqy-microhei.ttc",
+	"ttf/Times_New_Roman.ttf"
+};
+
+/* Copies the text and puts two characters that only the fallback font has before every space, so that the font changes at the end of every word
+Returns NULL if out of memory */
+static uint32 *make_mixed_text( Font *primary, Font *fallback, uint32 const *text, size_t len, size_t *mixed_len )
+{
+	uint32 only_fallback[64], c, *mixed;
+	size_t num_only = 0, n, k = 0, out = 0;
+	
+	for( c=0x80; c<0x10000 && num_only<64; c++ ) {
+		if ( get_cmap_entry( fallback, c ) && !get_cmap_entry( primary, c ) )
+			only_fallback[num_only++] = c;
+	}
+	
+	mixed = malloc( ( 3 * len + 1 ) * sizeof( mixed[0] ) );
+	if ( !mixed )
+		return NULL;
+	
+	for( n=0; n<len; n++ ) {
+		if ( num_only && text[n] == ' ' ) {
+			mixed[out++] = only_fallback[ k++ % num_only ];
+			mixed[out++] = only_fallback[ k++ % num_only ];
+		}
+		mixed[out++] = text[n];
+	}
+	
+	*mixed_len = out;
+	return mixed;
+}
+
+/* Compares do_simple_layout with the font stack layout. The second font of the stack is a different font that draws the characters the first one doesn't have */
+static int bench_fallback( Font *font, const char *text_filename )
+{
+	static const char *texts[] = {
+		"data/artofwar_utf32.txt",
+		"data/artofwar_utf32_english.txt",
+		"data/孙子兵法_utf32.txt",
+		"data/artofwar_utf32_english.txt"
+	};
+	Font fallback, *fonts[2];
+	FontStack *stacks[2] = {NULL,NULL};
+	size_t t, total_fallback = 0;
+	int k, status = 1;
+	
+	(void) text_filename;
+	
+	for( t=0; t<sizeof( fallback_fonts ) / sizeof( fallback_fonts[0] ); t++ ) {
+		if ( load_ttf_file( &fallback, fallback_fonts[t] ) == F_SUCCESS )
+			break;
+		printf( "Failed to load %s\n", fallback_fonts[t] );
+	}
+	if ( t == sizeof( fallback_fonts ) / sizeof( fallback_fonts[0] ) )
+		return 1;
+	printf( "Second font: %s\n", fallback_fonts[t] );
+	
+	fonts[0] = font;
+	fonts[1] = &fallback;
+	stacks[0] = create_font_stack( fonts, 1 );
+	stacks[1] = create_font_stack( fonts, 2 );
+	if ( !stacks[0] || !stacks[1] )
+		goto done;
+	
+	for( t=0; t<sizeof( texts ) / sizeof( texts[0] ); t++ )
+	{
+		uint64 start, elapsed[3];
+		unsigned long reps[3] = {0,0,0};
+		size_t len, n, missing = 0, from_fallback = 0;
+		uint32 *text = read_utf32_file( texts[t], &len );
+		int mixed = t == 3;
+		
+		if ( !text ) {
+			printf( "Failed to read %s\n", texts[t] );
+			break;
+		}
+		
+		if ( mixed ) {
+			uint32 *m = make_mixed_text( font, &fallback, text, len, &len );
+			free( text );
+			if ( !( text = m ) )
+				break;
+		}
+		
+		for( n=0; n<len; n++ ) {
+			uint32_t glyph;
+			missing += text[n] != '\n' && !get_cmap_entry( font, text[n] );
+			from_fallback += text[n] != '\n' && font_stack_lookup( stacks[1], text[n], &glyph ) == 1;
+		}
+		total_fallback += from_fallback;
+		
+		for( k=0; k<3; k++ )
+		{
+			start = get_microsec();
+			do {
+				GlyphBuffer *b = k ? do_font_stack_layout( stacks[k-1], text, len, 80, -1 ) : do_simple_layout( font, text, len, 80, -1 );
+				if ( b )
+					delete_glyph_buffer( b );
+				reps[k]++;
+				elapsed[k] = get_microsec() - start;
+			} while( elapsed[k] < MIN_BENCH_MICROS );
+		}
+		
+		printf( "%-40s %6.2f%% missing %6.2f%% from second font  single font %8.1f us   stack of 1 %8.1f us   stack of 2 %8.1f us\n",
+			mixed ? "mixed (second font after every word)" : texts[t], 100.0 * missing / len, 100.0 * from_fallback / len,
+			(double) elapsed[0] / reps[0], (double) elapsed[1] / reps[1], (double) elapsed[2] / reps[2] );
+		free( text );
+	}
+	
+	/* Otherwise the stack of 2 runs the same code as the stack of 1 */
+	if ( !total_fallback )
+		printf( "The second font didn't supply any glyphs\n" );
+	else
+		status = 0;
+	
+done:;
+	delete_font_stack( stacks[0] );
+	delete_font_stack( stacks[1] );
+	destroy_font( &fallback );
+	return status;
+}
+
+/* Scrolls through a long document. Draws the whole document every frame and then only the rows around the view with a DocView */
+static int bench_docview( Font *font, const char *text_filename )
+{
+	const unsigned copies = 20, view_rows = 60, scroll_rows = 3;
+	int32_t row_height = -( font->horz_ascender - font->horz_descender + font->horz_linegap );
+	float matrix[16] = {0};
+	size_t len, n;
+	uint32 *part = read_utf32_file( "data/artofwar_utf32_english.txt", &len ), *text;
+	uint64 start, elapsed[2];
+	unsigned frames[2] = {0,0};
+	GlyphBuffer *whole;
+	DocView *v;
+	DocViewStats stats;
+	size_t num_rows;
+	
+	(void) text_filename;
+	if ( !part )
+		return 1;
+	
+	text = malloc( copies * len * sizeof( text[0] ) );
+	if ( !text ) {
+		free( part );
+		return 1;
+	}
+	for( n=0; n<copies; n++ )
+		memcpy( text + n * len, part, len * sizeof( text[0] ) );
+	free( part );
+	len *= copies;
+	
+	start = get_microsec();
+	whole = do_simple_layout( font, text, len, 80, -1 );
+	elapsed[0] = get_microsec() - start;
+	
+	start = get_microsec();
+	v = create_doc_view( font, text, len, 80, -1, view_rows );
+	elapsed[1] = get_microsec() - start;
+	
+	if ( !whole || !v ) {
+		if ( whole ) delete_glyph_buffer( whole );
+		if ( v ) delete_doc_view( v );
+		free( text );
+		return 1;
+	}
+	
+	num_rows = doc_view_num_rows( v );
+	printf( "Document: %u characters, %u lines, %u rows. Viewport of %u rows scrolls %u rows per frame\n",
+		(uint) len, (uint) doc_view_num_lines( v ), (uint) num_rows, view_rows, scroll_rows );
+	printf( "Setup:     do_simple_layout %8.2f ms   create_doc_view %8.2f ms\n", elapsed[0] / 1000.0, elapsed[1] / 1000.0 );
+	
+	/* Rows of the view fill the clip space from top to bottom */
+	matrix[0] = 0.0001f;
+	matrix[5] = 2.0f / ( view_rows * -row_height );
+	matrix[10] = matrix[15] = 1;
+	
+	begin_text( font );
+	for( n=0; n<2; n++ )
+	{
+		size_t row = 0;
+		start = get_microsec();
+		do {
+			int32_t y0 = row * row_height, y1 = ( row + view_rows ) * row_height;
+			matrix[12] = -1;
+			matrix[13] = 1 - matrix[5] * y0;
+			if ( n ) {
+				set_doc_view_range( v, y0, y1 );
+				draw_doc_view( v, matrix, F_DRAW_TRIS );
+			} else {
+				draw_glyph_buffer( font, whole, matrix, F_DRAW_TRIS );
+			}
+			glFinish();
+			row = ( row + scroll_rows ) % num_rows;
+			frames[n]++;
+			elapsed[n] = get_microsec() - start;
+		} while( elapsed[n] < MIN_BENCH_MICROS );
+	}
+	end_text();
+	
+	get_doc_view_stats( v, &stats );
+	printf( "Whole document: %8.2f ms/frame\n", elapsed[0] / 1000.0 / frames[0] );
+	printf( "DocView:        %8.2f ms/frame %8.1f glyphs uploaded/frame %6.2f%% frames relaid %u VBO reallocations\n",
+		elapsed[1] / 1000.0 / frames[1], (double) stats.glyphs_uploaded / frames[1], 100.0 * stats.relayouts / frames[1], (uint) stats.buffer_reallocs );
+	
+	delete_glyph_buffer( whole );
+	delete_doc_view( v );
+	free( text );
+	return 0;
+}
+
+/* Flies a perspective camera low over a long text. The text is drawn as one plain buffer and as one tiled buffer */
+static int bench_tiles( Font *font, const char *text_filename )
+{
+	static const char *names[] = { "do_simple_layout", "do_tiled_layout" };
+	const unsigned num_frames = 200;
+	float projection[16], rot[16], move[16], view[16], mvp[16];
+	size_t len;
+	uint32 *text = read_utf32_file( "data/artofwar_utf32_english.txt", &len );
+	GlyphBuffer *buf[2];
+	TileCullStats stats;
+	int k;
+	
+	(void) text_filename;
+	if ( !text )
+		return 1;
+	
+	buf[0] = do_simple_layout( font, text, len, 80, -1 );
+	buf[1] = do_tiled_layout( font, text, len, 80, -1, 0 );
+	free( text );
+	
+	if ( !buf[0] || !buf[1] ) {
+		if ( buf[0] ) delete_glyph_buffer( buf[0] );
+		if ( buf[1] ) delete_glyph_buffer( buf[1] );
+		return 1;
+	}
+	
+	/* Text coordinates are in EMs. Lines go towards -y. The camera looks along -y, 3 EMs above the text */
+	mat4_persp( projection, 65.0f * 3.14159265f / 180.0f, 4.0f / 3.0f, 0.1f, 1000.0f );
+	mat4_rotation_x( rot, -1.1f );
+	
+	begin_text( font );
+	for( k=0; k<2; k++ )
+	{
+		uint64 start, elapsed;
+		unsigned frames = 0;
+		
+		start = get_microsec();
+		do {
+			mat4_translation( move, -20.0f, (float)( frames % num_frames ) * 10.0f, -3.0f );
+			mat4_mult( view, rot, move );
+			mat4_mult( mvp, projection, view );
+			draw_glyph_buffer( font, buf[k], mvp, F_DRAW_TRIS );
+			glFinish();
+			frames++;
+			elapsed = get_microsec() - start;
+		} while( elapsed < MIN_BENCH_MICROS );
+		
+		printf( "%-18s %8.2f ms/frame\n", names[k], elapsed / 1000.0 / frames );
+	}
+	end_text();
+	
+	get_tile_cull_stats( buf[1], &stats );
+	printf( "Per frame: %.0f of %.0f tiles culled, %.0f instances drawn, %.0f culled, %.1f draw calls\n",
+		(double) stats.tiles_culled / stats.draws, (double) stats.tiles_tested / stats.draws,
+		(double) stats.instances_drawn / stats.draws, (double) stats.instances_culled / stats.draws, (double) stats.draw_calls / stats.draws );
+	
+	delete_glyph_buffer( buf[0] );
+	delete_glyph_buffer( buf[1] );
+	return 0;
+}
+
+/* Cost of keeping a hit test index and of the queries */
+static int bench_hittest( Font *font, const char *text_filename )
+{
+	const unsigned num_queries = 1000000;
+	size_t len, caret_sum = 0;
+	uint32 *text = read_utf32_file( "data/artofwar_utf32_english.txt", &len );
+	uint64 start, elapsed[2];
+	unsigned long reps[2] = {0,0};
+	GlyphBuffer *b;
+	GlyphHit hit;
+	TextExtents ext;
+	unsigned n, found = 0;
+	int k;
+	
+	(void) text_filename;
+	if ( !text )
+		return 1;
+	
+	for( k=0; k<2; k++ )
+	{
+		start = get_microsec();
+		do {
+			b = k ? do_indexed_layout( font, text, len, 80, -1, 0, 0 ) : do_simple_layout( font, text, len, 80, -1 );
+			if ( b )
+				delete_glyph_buffer( b );
+			reps[k]++;
+			elapsed[k] = get_microsec() - start;
+		} while( elapsed[k] < MIN_BENCH_MICROS );
+	}
+	
+	printf( "do_simple_layout  %8.2f ms\ndo_indexed_layout %8.2f ms\n", elapsed[0] / 1000.0 / reps[0], elapsed[1] / 1000.0 / reps[1] );
+	
+	b = do_indexed_layout( font, text, len, 80, -1, 0, 0 );
+	measure_text( font, text, len, 80, -1, &ext, NULL, 0 );
+	if ( !b ) {
+		free( text );
+		return 1;
+	}
+	
+	srand( 1 );
+	start = get_microsec();
+	for( n=0; n<num_queries; n++ ) {
+		float x = ext.xmin + ( ext.xmax - ext.xmin ) * ( rand() / (float) RAND_MAX );
+		float y = ext.ymin + ( ext.ymax - ext.ymin ) * ( rand() / (float) RAND_MAX );
+		caret_sum += caret_at_point( b, x, y );
+	}
+	elapsed[0] = get_microsec() - start;
+	
+	start = get_microsec();
+	for( n=0; n<num_queries; n++ )
+		found += hit_test_char( b, rand() % len, &hit );
+	elapsed[1] = get_microsec() - start;
+	
+	printf( "caret_at_point    %8.3f us/query (checksum %u)\nhit_test_char     %8.3f us/query (%u of %u characters have a glyph)\n",
+		(double) elapsed[0] / num_queries, (uint) caret_sum, (double) elapsed[1] / num_queries, found, num_queries );
+	
+	delete_glyph_buffer( b );
+	free( text );
+	return 0;
+}
+
+/* Many short labels with their own positions and colors, as on a map */
+static int bench_labels( Font *font, const char *text_filename )
+{
+	static const char *names[] = { "one GlyphBuffer each", "label scene, rebuilt", "label scene, unchanged" };
+	static float colors[4][4] = { {1,1,1,1}, {1,0.8f,0.2f,1}, {0.5f,1,0.5f,1}, {0.6f,0.7f,1,1} };
+	const size_t max_labels = 5000;
+	size_t len, n, num_labels = 0, pos = 0;
+	uint32 *text = read_utf32_file( "data/artofwar_utf32_english.txt", &len );
+	size_t *word_start = malloc( max_labels * 2 * sizeof( size_t ) ), *word_len = word_start + max_labels;
+	GlyphBuffer **bufs = calloc( max_labels, sizeof( GlyphBuffer* ) );
+	float transforms[2][16], scale[16], rot[16], move[16];
+	float upem = font->units_per_em;
+	LabelScene *scene = create_label_scene( font, -1 );
+	LabelSceneStats stats;
+	int k, status = 1;
+	
+	(void) text_filename;
+	if ( !text || !word_start || !bufs || !scene )
+		goto done;
+	
+	/* Every word of the text is a label */
+	while( num_labels < max_labels && pos < len ) {
+		while( pos < len && ( text[pos] == ' ' || text[pos] == '\n' ) )
+			pos++;
+		word_start[num_labels] = pos;
+		while( pos < len && text[pos] != ' ' && text[pos] != '\n' )
+			pos++;
+		word_len[num_labels] = pos - word_start[num_labels];
+		num_labels += word_len[num_labels] > 0;
+	}
+	
+	for( n=0; n<num_labels; n++ ) {
+		if ( !( bufs[n] = do_simple_layout( font, text + word_start[n], word_len[n], -1, -1 ) ) )
+			goto done;
+	}
+	
+	/* Labels are on a grid of 100 columns. Half of them are seen through a rotated transform */
+	mat4_scaling( scale, 1.0f / 300, 1.0f / 120, 1 );
+	mat4_translation( move, -1, -0.9f, 0 );
+	mat4_mult( transforms[0], move, scale );
+	mat4_rotation_z( rot, 0.2f );
+	mat4_mult( transforms[1], rot, transforms[0] );
+	
+	begin_text( font );
+	for( k=0; k<3; k++ )
+	{
+		uint64 start, elapsed;
+		unsigned frames = 0;
+		
+		start = get_microsec();
+		do {
+			for( n=0; n<num_labels; n++ )
+			{
+				float x = ( n % 100 ) * 6.0f, y = ( n / 100 ) * 2.0f;
+				
+				if ( k == 0 ) {
+					float m[16];
+					mat4_translation( move, x, y, 0 );
+					mat4_mult( m, transforms[n & 1], move );
+					set_text_color( colors[n % 4] );
+					draw_glyph_buffer( font, bufs[n], m, F_DRAW_TRIS );
+				} else if ( k == 1 || !frames ) {
+					if ( !n )
+						clear_label_scene( scene );
+					add_label( scene, text + word_start[n], word_len[n], x * upem, y * upem, colors[n % 4], n & 1 );
+				}
+			}
+			if ( k )
+				draw_label_scene( scene, transforms, F_DRAW_TRIS );
+			glFinish();
+			frames++;
+			elapsed = get_microsec() - start;
+		} while( elapsed < MIN_BENCH_MICROS );
+		
+		printf( "%-24s %8.2f ms/frame\n", names[k], elapsed / 1000.0 / frames );
+	}
+	end_text();
+	
+	get_label_scene_stats( scene, &stats );
+	printf( "%u labels, %u glyphs, %u transforms: %u draw calls per frame\n",
+		(uint) stats.labels, (uint) stats.glyphs, (uint) stats.transforms, (uint) stats.draw_calls );
+	status = 0;
+
+done:;
+	if ( bufs ) {
+		for( n=0; n<num_labels; n++ ) {
+			if ( bufs[n] )
+				delete_glyph_buffer( bufs[n] );
+		}
+		free( bufs );
+	}
+	if ( scene ) delete_label_scene( scene );
+	if ( word_start ) free( word_start );
+	if ( text ) free( text );
+	return status;
+}
+
+typedef struct {
+	const char *name;
+	int (*func)( const char *font_filename, const char *text_filename );
+	const char *description;
+} Benchmark;
+
+static const Benchmark cpu_benchmarks[] = {
+	{ "merge", bench_merge, "Vertex merging into each vertex layout" },
+	{ "vcache", bench_vcache, "Vertex cache efficiency (ACMR/ATVR) of glyph triangles" },
+	{ "dedup", bench_dedup, "Sharing geometry between glyphs with identical outlines" },
+	{ "measure", bench_measure, "Text measurement without layout or GL" },
+	{ "kern", bench_kern, "Per character cost of pair kerning" },
+	{ "subst", bench_subst, "Per character cost of glyph substitution" },
+	{ "coverage", bench_coverage, "Checking that a font has every character of a text" },
+	{ "subset", bench_subset, "Loading only the glyphs that a text needs" }
+};
+
+typedef struct {
+	const char *name;
+	int (*func)( Font *font, const char *text_filename );
+	const char *description;
+} GLBenchmark;
+
+static const GLBenchmark gl_benchmarks[] = {
+	{ "layout", bench_layout, "Text layout throughput on the bundled texts" },
+	{ "utf8", bench_utf8, "Layout from UTF-8 compared to UTF-32" },
+	{ "stream", bench_stream, "Streaming layout of a large document" },
+	{ "parallel", bench_parallel, "Multi-threaded layout scaling" },
+	{ "edit", bench_edit, "Incremental relayout of an edited document" },
+	{ "live", bench_live, "Drawing dynamic strings with draw_text_live" },
+	{ "runcache", bench_runcache, "Drawing mostly unchanged strings through a run cache" },
+	{ "twophase", bench_twophase, "Layout into caller-owned memory compared to do_simple_layout" },
+	{ "wrap", bench_wrap, "Wrapping to a width compared to wrapping to a number of characters" },
+	{ "fallback", bench_fallback, "Layout through a font stack compared to a single font" },
+	{ "docview", bench_docview, "Scrolling a long document with a viewport layout" },
+	{ "tiles", bench_tiles, "Culling tiles of a long text seen through a perspective camera" },
+	{ "hittest", bench_hittest, "Building a hit test index and querying it" },
+	{ "labels", bench_labels, "Drawing thousands of labels through a label scene" }
+};
+
+#define NUM_CPU_BENCHMARKS (( sizeof( cpu_benchmarks ) / sizeof( cpu_benchmarks[0] ) ))
+#define NUM_GL_BENCHMARKS (( sizeof( gl_benchmarks ) / sizeof( gl_benchmarks[0] ) ))
+
+int run_cpu_benchmark( const char *name, const char *font_filename, const char *text_filename )
+{
+	size_t n;
+	for( n=0; n<NUM_CPU_BENCHMARKS; n++ )
+	{
+		if ( !strcmp( name, cpu_benchmarks[n].name ) ) {
+			printf( "** Benchmark: %s\n", cpu_benchmarks[n].description );
+			if ( cpu_benchmarks[n].func( font_filename, text_filename ) )
+				printf( "Benchmark failed\n" );
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int is_gl_benchmark( const char *name )
+{
+	size_t n;
+	for( n=0; n<NUM_GL_BENCHMARKS; n++ ) {
+		if ( !strcmp( name, gl_benchmarks[n].name ) )
+			return 1;
+	}
+	return 0;
+}
+
+int run_gl_benchmark( const char *name, struct Font *font, const char *text_filename )
+{
+	size_t n;
+	for( n=0; n<NUM_GL_BENCHMARKS; n++ )
+	{
+		if ( !strcmp( name, gl_benchmarks[n].name ) ) {
+			printf( "** Benchmark: %s\n", gl_benchmarks[n].description );
+			if ( gl_benchmarks[n].func( font, text_filename ) )
+				printf( "Benchmark failed\n" );
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void list_benchmarks( void )
+{
+	size_t n;
+	for( n=0; n<NUM_CPU_BENCHMARKS; n++ )
+		printf( "%-14s %s (no GL)\n", cpu_benchmarks[n].name, cpu_benchmarks[n].description );
+	for( n=0; n<NUM_GL_BENCHMARKS; n++ )
+		printf( "%-14s %s\n", gl_benchmarks[n].name, gl_benchmarks[n].description );
+}
@@ -0,0 +1,17 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+/* Benchmarks that don't need a window or a GL context. Run with: fontdemo -b NAME
+Returns 0 if there is no such benchmark */
+int run_cpu_benchmark( const char *name, const char *font_filename, const char *text_filename );
+
+struct Font;
+
+/* Benchmarks that need a GL context and a font that has been loaded with prepare_font */
+int is_gl_benchmark( const char *name );
+int run_gl_benchmark( const char *name, struct Font *font, const char *text_filename );
+
+/* Prints the names of all benchmarks */
+void list_benchmarks( void );
+
+#endif
@@ -9,6 +9,7 @@
 #include "matrix.h"
 #include "types.h"
 #include "microsec.h"
+#include "bench.h"
 
 #include "gpufont_data.h"
 #include "gpufont_ttf_file.h"
@@ -40,9 +41,16 @@ static Mat4 mvp;
 static GLint mvp_loc;
 
 static char *the_font_filename = "/usr/share/fonts/truetype/droid/DroidSans.ttf";
-static char *the_novel_filename = "data/artofwar.txt";
+static char *the_novel_filename = "data/artofwar_utf8.txt";
+static char *the_benchmark = NULL;
+static int the_load_flags = 0;
 static Font the_font;
 
+/* GPU timing mode measures how long the text draw calls take on the GPU */
+static int gpu_timing = 0;
+static GLuint gpu_queries[2] = {0,0};
+static unsigned long gpu_frame = 0;
+
 static int32 the_char_code = 0;
 static uint32 the_glyph_index = 0;
 
@@ -53,7 +61,7 @@ static GlyphBuffer *my_layout = NULL;
 
 static int lookup_test_char( Font *font, int32 cc )
 {
-	SimpleGlyph *gh;
+	GlyphDesc *gh;
 	
 	the_char_code = cc;
 	the_glyph_index = get_cmap_entry( font, cc );
@@ -61,41 +69,47 @@ static int lookup_test_char( Font *font, int32 cc )
 	if ( !the_glyph_index )
 		return 0;
 	
-	gh = font->glyphs[ the_glyph_index ];
+	gh = font->glyph_desc + the_glyph_index;
 	
 	printf( "U+%04x glyph index %u\n", (uint) cc, (uint) the_glyph_index );
-	
-	if ( gh ) {
-		if ( IS_SIMPLE_GLYPH( gh ) ) {
-			printf(
-			"- is a simple glyph\n"
-			"- total points: %hu\n"
-			"- indices/curve: %hu\n"
-			"- indices/solid: %hu\n"
-			"- indices/total: %hu\n"
-			,
-			gh->tris.num_points_total,
-			gh->tris.num_indices_curve,
-			gh->tris.num_indices_solid,
-			gh->tris.num_indices_total );
-		} else {
-			printf( "- is a composite glyph\n- subglyphs: %u\n", (uint) gh->num_parts );
+	printf( "- advance: %u\n- bounding box: (%d, %d) (%d, %d)\n",
+		(uint) font->metrics.adv_width[ the_glyph_index ],
+		font->metrics.xmin[ the_glyph_index ], font->metrics.ymin[ the_glyph_index ],
+		font->metrics.xmax[ the_glyph_index ], font->metrics.ymax[ the_glyph_index ] );
+	
+	if ( IS_SIMPLE_GLYPH( gh ) ) {
+		if ( !gh->num_points ) {
+			printf( "- no glyph found\n" );
+			return 0;
 		}
-		return 1;
+		printf(
+		"- is a simple glyph\n"
+		"- total points: %hu\n"
+		"- indices/curve: %hu\n"
+		"- indices/solid: %hu\n"
+		"- indices/total: %u\n"
+		,
+		gh->num_points,
+		gh->num_indices_curve,
+		gh->num_indices_solid,
+		(uint) gh->num_indices_curve + gh->num_indices_solid );
 	} else {
-		printf( "- no glyph found\n" );
-		return 0;
+		printf( "- is a composite glyph\n- subglyphs: %u\n", (uint) gh->num_parts );
 	}
+	return 1;
 }
 
+/* The file is read as UTF-32 if its name contains "_utf32" and as UTF-8 otherwise */
 static GlyphBuffer *load_text_file( Font *font, const char *filename )
 {
 	GlyphBuffer *layout = NULL;
 	FILE *fp;
-	uint32 *text;
+	char *text;
 	long len;
+	int is_utf32 = ( strstr( filename, "_utf32" ) != NULL );
+	size_t num_chars, num_errors = 0;
 	
-	printf( "Loading text file %s\n", filename );
+	printf( "Loading text file %s (%s)\n", filename, is_utf32 ? "UTF-32" : "UTF-8" );
 	fp = fopen( filename, "rb" );
 	
 	if ( !fp ) {
@@ -107,13 +121,21 @@ static GlyphBuffer *load_text_file( Font *font, const char *filename )
 	&& ( len = ftell( fp ) ) >= 4
 	&& !fseek( fp, 0, SEEK_SET ) ) {
 		/* Length of the file has been succesfully determined and the file is not empty. */
-		text = malloc( len & ~3 );
-		len >>= 2;
+		if ( is_utf32 )
+			len &= ~3;
+		text = malloc( len );
 		if ( text ) {
 			/* There was enough system memory available to hold the contents of the file. Yippee! */
-			if ( fread( text, 4, len, fp ) == (size_t) len )
+			if ( fread( text, 1, len, fp ) == (size_t) len )
 			{
-				layout = do_simple_layout( font, text, len, 80, -1 );
+				if ( is_utf32 ) {
+					num_chars = len >> 2;
+					layout = do_tiled_layout( font, (uint32*) text, num_chars, 80, -1, 0 );
+				} else {
+					num_chars = len;
+					layout = do_tiled_layout_utf8( font, text, len, 80, -1, 0, &num_errors );
+				}
+				
 				if ( !layout )
 				{
 					printf( "Failed to lay out text\n" );
@@ -122,8 +144,9 @@ static GlyphBuffer *load_text_file( Font *font, const char *filename )
 				{
 					printf(
 					"Success!\n"
-					"Characters in file: %ld\n"
-					"do_simple_layout gave us %u batches\n", len, (uint)*(size_t*)layout );
+					"%s in file: %u\n"
+					"Malformed sequences: %u\n"
+					"do_tiled_layout gave us %u batches\n", is_utf32 ? "Characters" : "Bytes", (uint) num_chars, (uint) num_errors, (uint)*(size_t*)layout );
 				}
 			}
 			free( text );
@@ -154,7 +177,7 @@ static int load_resources( void )
 	
 	printf( "Font: '%s'\n", the_font_filename );
 	millis = SDL_GetTicks();
-	status = load_ttf_file( &the_font, the_font_filename );
+	status = load_ttf_file_ex( &the_font, the_font_filename, the_load_flags );
 	
 	if ( status )
 	{
@@ -179,6 +202,7 @@ static int load_resources( void )
 	"sizeof(PointIndex) %d\n"
 	"sizeof(PointCoord) %d\n"
 	"sizeof(PointFlag) %d\n"
+	"sizeof(PackedVertex) %d\n"
 	"sizeof(GlyphIndex) %d\n"
 	"sizeof(GlyphCoord) %d\n"
 	,
@@ -191,6 +215,7 @@ static int load_resources( void )
 	(int) sizeof(PointIndex),
 	(int) sizeof(PointCoord),
 	(int) sizeof(PointFlag),
+	(int) sizeof(PackedVertex),
 	(int) sizeof(GlyphIndex),
 	(int) sizeof(GlyphCoord) );
 	
@@ -290,19 +315,51 @@ static float cam_yaw=PI, cam_pitch=PI;
 static int win_w = 800;
 static int win_h = 600;
 
-static void get_micros_per_frame( unsigned long avg_time[1], unsigned long delta_time )
+typedef struct {
+	unsigned long frames, time;
+} TimeAccum;
+
+/* Returns 1 when avg_time has been updated */
+static int get_micros_per_frame( TimeAccum acc[1], unsigned long avg_time[1], unsigned long delta_time )
 {
 	/* how many frames to average */
 	enum { SAMPLES = 20 };
-	static unsigned long accum_frames=0, accum_time=0;
 	
-	accum_time += delta_time;
-	accum_frames++;
+	acc->time += delta_time;
+	acc->frames++;
+	
+	if ( acc->frames == SAMPLES ) {
+		avg_time[0] = acc->time / acc->frames;
+		acc->frames = 0;
+		acc->time = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static void begin_gpu_timer( void )
+{
+	if ( !gpu_queries[0] )
+		glGenQueries( 2, gpu_queries );
+	glBeginQuery( GL_TIME_ELAPSED, gpu_queries[ gpu_frame & 1 ] );
+}
+
+static void end_gpu_timer( unsigned long avg_gpu_micros[1] )
+{
+	static TimeAccum acc = {0,0};
+	GLuint64 nanos = 0;
+	
+	glEndQuery( GL_TIME_ELAPSED );
+	gpu_frame++;
 	
-	if ( accum_frames == SAMPLES ) {
-		avg_time[0] = accum_time / accum_frames;
-		accum_frames = 0;
-		accum_time = 0;
+	if ( gpu_frame > 1 )
+	{
+		/* Query of the previous frame has most likely finished already so this shouldn't stall */
+		glGetQueryObjectui64v( gpu_queries[ gpu_frame & 1 ], GL_QUERY_RESULT, &nanos );
+		if ( get_micros_per_frame( &acc, avg_gpu_micros, nanos / 1000 ) ) {
+			printf( "GPU text time: %lu µs (%s vertices)\n", avg_gpu_micros[0],
+				the_font.vertex_layout == VERTEX_FLOAT ? "FloatVertex" : "PackedVertex" );
+		}
 	}
 }
 
@@ -312,7 +369,9 @@ static void repaint( void )
 	static float c_green[4] = {0,1,0,1};
 	int glyph_draw_flags = 0;
 	
-	static uint64_t avg_frame_micros = 0;
+	static unsigned long avg_frame_micros = 0;
+	static unsigned long avg_gpu_micros = 0;
+	static TimeAccum frame_acc = {0,0};
 	unsigned long frame_start_time = get_microsec();
 	
 	switch( wire_mode )
@@ -368,6 +427,9 @@ static void repaint( void )
 	glEnable( GL_ALPHA_TEST );
 	glAlphaFunc( GL_GREATER, 0.00001 );
 	
+	if ( gpu_timing )
+		begin_gpu_timer();
+	
 	begin_text( &the_font );
 	
 	if ( the_char_code )
@@ -424,6 +486,12 @@ static void repaint( void )
 			L"  Pos (%.3f, %.3f, %.3f) Yaw %.3f Pitch %.3f\nAverage frame time: %lu µs (%.1lf fps)",
 			cam_x, cam_y, cam_z, cam_yaw, cam_pitch, avg_frame_micros, 1000000.0 / avg_frame_micros );
 		
+		if ( len > 0 && gpu_timing ) {
+			int len2 = swprintf( s + len, sizeof( s ) / sizeof( s[0] ) - len, L"\nGPU text time: %lu µs", avg_gpu_micros );
+			if ( len2 > 0 )
+				len += len2;
+		}
+		
 		if ( len > 0 )
 		{
 			float scale = 50;
@@ -444,6 +512,9 @@ static void repaint( void )
 	
 	end_text();
 	
+	if ( gpu_timing )
+		end_gpu_timer( &avg_gpu_micros );
+	
 	glPointSize( 1 );
 	glDisable( GL_POLYGON_OFFSET_FILL );
 	glDisable( GL_POLYGON_OFFSET_LINE );
@@ -457,7 +528,7 @@ static void repaint( void )
 		glDisable( GL_CULL_FACE );
 	
 	glFinish();
-	get_micros_per_frame( &avg_frame_micros, get_microsec() - frame_start_time );
+	get_micros_per_frame( &frame_acc, &avg_frame_micros, get_microsec() - frame_start_time );
 }
 
 static void update_viewport( int w, int h )
@@ -501,10 +572,15 @@ static void help_screen_exit( void )
 	printf(
 	"---- Valid command line arguments ----\n"
 	"-f FILENAME    Load font from given TTF file\n"
-	"-t FILENAME    Load text from given file. The file must be in UTF-32 encoding\n"
+	"-t FILENAME    Load text from given file. UTF-32 if the name contains \"_utf32\", otherwise UTF-8\n"
 	"-c NUMBER      This character code will be displayed in a grid pattern\n"
+	"-v LAYOUT      Vertex layout: packed (default) or float\n"
+	"-g             GPU timing mode. Measures the time spent drawing text on the GPU\n"
+	"-b NAME        Run a benchmark and exit\n"
 	"-h             Print this information and exit\n"
 	);
+	printf( "\n---- Benchmarks ----\n" );
+	list_benchmarks();
 	printf(
 	"\n---- Camera controls ----\n"
 	"Arrow keys rotate the camera\n"
@@ -524,14 +600,23 @@ static void parse_args( int argc, char **argv )
 	int end = argc - 1;
 	int n;
 	
-	if ( argc == 2 )
-		help_screen_exit();
-	
-	for( n=1; n<end; n++ )
+	for( n=1; n<argc; n++ )
 	{
 		printf( "%s\n", argv[n] );
 		
-		if ( !strcmp( argv[n], "-f" ) )
+		if ( !strcmp( argv[n], "-g" ) )
+			gpu_timing = 1;
+		else if ( n == end )
+			help_screen_exit(); /* the rest of the options need an argument */
+		else if ( !strcmp( argv[n], "-v" ) ) {
+			if ( !strcmp( argv[++n], "float" ) )
+				the_load_flags |= LOAD_FLOAT_VERTICES;
+			else if ( strcmp( argv[n], "packed" ) )
+				help_screen_exit();
+		}
+		else if ( !strcmp( argv[n], "-b" ) )
+			the_benchmark = argv[++n];
+		else if ( !strcmp( argv[n], "-f" ) )
 			the_font_filename = argv[++n];
 		else if ( !strcmp( argv[n], "-t" ) )
 			the_novel_filename = argv[++n];
@@ -552,6 +637,16 @@ int main( int argc, char *argv[] )
 	
 	parse_args( argc, argv );
 	
+	if ( the_benchmark && !is_gl_benchmark( the_benchmark ) )
+	{
+		if ( !run_cpu_benchmark( the_benchmark, the_font_filename, the_novel_filename ) ) {
+			printf( "No such benchmark: %s\n", the_benchmark );
+			list_benchmarks();
+			return 1;
+		}
+		return 0;
+	}
+	
 	printf( "** Initializing SDL\n" );
 	if ( SDL_Init( SDL_INIT_VIDEO ) < 0 ) {
 		printf( "Failed to init SDL: %s\n", SDL_GetError() );
@@ -626,6 +721,12 @@ int main( int argc, char *argv[] )
 		return 1;
 	}
 	
+	if ( the_benchmark ) {
+		run_gl_benchmark( the_benchmark, &the_font, the_novel_filename );
+		SDL_Quit();
+		return 0;
+	}
+	
 	printf( "** Entering main loop\n" );
 	prev_ticks = SDL_GetTicks();
 	
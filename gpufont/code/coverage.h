@@ -0,0 +1,12 @@
+#ifndef _COVERAGE_H
+#define _COVERAGE_H
+#include "gpufont_data.h"
+
+/* Builds font->coverage from font->cmap (used by ttf_file.c). Needs font->num_glyphs. Returns 0 if out of memory */
+int build_cmap_coverage( Font font[1] );
+
+/* Nonzero if the code point is in the coverage bitmaps */
+#define COVERAGE_HAS( cov, code ) ( (code) < ( NUM_UNICODE_PLANES << 16 ) && (cov)->plane[ (code) >> 16 ] \
+	&& (cov)->plane[ (code) >> 16 ][ ( (code) & 0xFFFF ) >> 5 ] >> ( (code) & 31 ) & 1 )
+
+#endif
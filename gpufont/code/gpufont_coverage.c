@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gpufont_data.h"
+#include "gpufont_coverage.h"
+#include "utf_decode.h"
+#include "coverage.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* UTF-8 that isn't plain covered ASCII is decoded this many code points at a time */
+#define CHECK_CHUNK 64
+
+typedef struct {
+	CmapCoverage *cov;
+	size_t num_glyphs;
+	unsigned plane_mask; /* planes that have code points */
+	size_t num_codes;
+	int pass;
+} CoverageBuilder;
+
+/* Called for each cmap entry three times: to find the planes, to set the bits and count the code points of each glyph and to fill the reverse index */
+static void add_code( void *p, NibValue code, NibValue glyph )
+{
+	CoverageBuilder *b = p;
+	CmapCoverage *cov = b->cov;
+	
+	if ( glyph >= b->num_glyphs || code >= NUM_UNICODE_PLANES << 16 )
+		return;
+	
+	if ( b->pass == 0 ) {
+		b->plane_mask |= 1u << ( code >> 16 );
+		b->num_codes++;
+	} else if ( b->pass == 1 ) {
+		cov->plane[ code >> 16 ][ ( code & 0xFFFF ) >> 5 ] |= (uint32_t) 1 << ( code & 31 );
+		cov->glyph_first[ glyph + 1 ]++;
+	} else {
+		cov->glyph_code[ cov->glyph_first[ glyph ]++ ] = code;
+	}
+}
+
+/* Finds the completely covered range of the BMP that contains 'a' and the longest other one */
+static void find_full_runs( CmapCoverage *cov )
+{
+	uint32_t const *bits = cov->plane[0];
+	uint32_t c, start = 0;
+	int in_run = 0;
+	
+	cov->full_run[0][0] = cov->full_run[1][0] = 1;
+	cov->full_run[0][1] = cov->full_run[1][1] = 0;
+	if ( !bits )
+		return;
+	
+	for( c=0; c<=0x10000; c++ )
+	{
+		int has = c < 0x10000 && ( bits[ c >> 5 ] >> ( c & 31 ) & 1 );
+		
+		if ( has && !in_run ) {
+			start = c;
+			in_run = 1;
+		} else if ( !has && in_run ) {
+			in_run = 0;
+			if ( start <= 'a' && 'a' < c ) {
+				cov->full_run[0][0] = start;
+				cov->full_run[0][1] = c - 1;
+			} else if ( c - start > cov->full_run[1][1] + 1 - cov->full_run[1][0] ) {
+				cov->full_run[1][0] = start;
+				cov->full_run[1][1] = c - 1;
+			}
+		}
+	}
+}
+
+int build_cmap_coverage( Font font[1] )
+{
+	CmapCoverage *cov = &font->coverage;
+	CoverageBuilder b;
+	size_t n, num_planes = 0;
+	
+	memset( cov, 0, sizeof( *cov ) );
+	memset( &b, 0, sizeof( b ) );
+	b.cov = cov;
+	b.num_glyphs = font->num_glyphs;
+	
+	nibtree_walk( &font->cmap, add_code, &b );
+	
+	for( n=0; n<NUM_UNICODE_PLANES; n++ )
+		num_planes += b.plane_mask >> n & 1;
+	
+	if ( num_planes )
+	{
+		cov->bits = calloc( num_planes * PLANE_WORDS, sizeof( cov->bits[0] ) );
+		if ( !cov->bits )
+			return 0;
+		
+		num_planes = 0;
+		for( n=0; n<NUM_UNICODE_PLANES; n++ ) {
+			if ( b.plane_mask >> n & 1 )
+				cov->plane[n] = cov->bits + PLANE_WORDS * num_planes++;
+		}
+	}
+	
+	cov->glyph_first = calloc( font->num_glyphs + 1 + b.num_codes, sizeof( cov->glyph_first[0] ) );
+	if ( !cov->glyph_first ) {
+		free( cov->bits );
+		memset( cov, 0, sizeof( *cov ) );
+		return 0;
+	}
+	cov->glyph_code = cov->glyph_first + font->num_glyphs + 1;
+	cov->num_codes = b.num_codes;
+	
+	/* Count the code points of each glyph. The prefix sum gives where they begin */
+	b.pass = 1;
+	nibtree_walk( &font->cmap, add_code, &b );
+	for( n=0; n<font->num_glyphs; n++ )
+		cov->glyph_first[n+1] += cov->glyph_first[n];
+	
+	/* Filling moves glyph_first[g] to where the code points of g end, which is where the ones of g+1 begin */
+	b.pass = 2;
+	nibtree_walk( &font->cmap, add_code, &b );
+	memmove( cov->glyph_first + 1, cov->glyph_first, font->num_glyphs * sizeof( cov->glyph_first[0] ) );
+	cov->glyph_first[0] = 0;
+	
+	find_full_runs( cov );
+	return 1;
+}
+
+static int has_code( CmapCoverage const *cov, uint32_t c ) {
+	return c == '\n' || COVERAGE_HAS( cov, c );
+}
+
+int font_has_char( Font const *font, uint32_t code ) {
+	return COVERAGE_HAS( &font->coverage, code );
+}
+
+#ifdef __SSE2__
+/* Signed comparisons of biased values compare the unsigned values */
+static __m128i splat_biased( uint32_t x ) {
+	return _mm_set1_epi32( (int32_t)( x ^ 0x80000000u ) );
+}
+#endif
+
+size_t find_uncovered_char( Font const *font, uint32_t const text[], size_t text_len )
+{
+	CmapCoverage const *cov = &font->coverage;
+	size_t n = 0;
+	
+	#ifdef __SSE2__
+	/* Blocks of 4 code points that are all in the completely covered runs (or newlines) need no bitmap lookups */
+	__m128i bias = splat_biased( 0 ), newline = splat_biased( '\n' );
+	__m128i lo0 = splat_biased( cov->full_run[0][0] ), hi0 = splat_biased( cov->full_run[0][1] );
+	__m128i lo1 = splat_biased( cov->full_run[1][0] ), hi1 = splat_biased( cov->full_run[1][1] );
+	
+	for( ; n + 4 <= text_len; n += 4 )
+	{
+		__m128i x = _mm_xor_si128( _mm_loadu_si128( (__m128i const*)( text + n ) ), bias );
+		__m128i out0 = _mm_or_si128( _mm_cmplt_epi32( x, lo0 ), _mm_cmpgt_epi32( x, hi0 ) );
+		__m128i out1 = _mm_or_si128( _mm_cmplt_epi32( x, lo1 ), _mm_cmpgt_epi32( x, hi1 ) );
+		__m128i miss = _mm_andnot_si128( _mm_cmpeq_epi32( x, newline ), _mm_and_si128( out0, out1 ) );
+		
+		if ( _mm_movemask_epi8( miss ) ) {
+			size_t k;
+			for( k=n; k<n+4; k++ ) {
+				if ( !has_code( cov, text[k] ) )
+					return k;
+			}
+		}
+	}
+	#endif
+	
+	for( ; n<text_len; n++ ) {
+		if ( !has_code( cov, text[n] ) )
+			return n;
+	}
+	
+	return text_len;
+}
+
+size_t find_uncovered_char_utf8( Font const *font, char const *text_p, size_t num_bytes )
+{
+	uint8_t const *text = (uint8_t const*) text_p;
+	CmapCoverage const *cov = &font->coverage;
+	uint32_t buf[CHECK_CHUNK];
+	size_t pos = 0;
+	
+	#ifdef __SSE2__
+	/* The ASCII part of the run with 'a'. Bytes above 0x7F are negative and fall below it */
+	uint32_t first = cov->full_run[0][0], last = cov->full_run[0][1] < 0x7F ? cov->full_run[0][1] : 0x7F;
+	__m128i lo = _mm_set1_epi8( first <= last ? first : 1 ), hi = _mm_set1_epi8( first <= last ? last : 0 );
+	__m128i newline = _mm_set1_epi8( '\n' );
+	#endif
+	
+	while( pos < num_bytes )
+	{
+		size_t used, errors = 0, n, k;
+		
+		#ifdef __SSE2__
+		/* 16 bytes at a time while they are covered ASCII characters or newlines */
+		while( pos + 16 <= num_bytes )
+		{
+			__m128i x = _mm_loadu_si128( (__m128i const*)( text + pos ) );
+			__m128i out = _mm_or_si128( _mm_cmplt_epi8( x, lo ), _mm_cmpgt_epi8( x, hi ) );
+			if ( _mm_movemask_epi8( _mm_andnot_si128( _mm_cmpeq_epi8( x, newline ), out ) ) )
+				break;
+			pos += 16;
+		}
+		if ( pos == num_bytes )
+			break;
+		#endif
+		
+		n = decode_utf8( buf, CHECK_CHUNK, text + pos, num_bytes - pos, &used, &errors );
+		if ( !errors && find_uncovered_char( font, buf, n ) == n ) {
+			pos += used;
+			continue;
+		}
+		
+		/* Something in this chunk isn't covered. Find its byte offset one code point at a time */
+		for( k=0; k<n; k++ ) {
+			errors = 0;
+			decode_utf8( buf, 1, text + pos, num_bytes - pos, &used, &errors );
+			if ( errors || !has_code( cov, buf[0] ) )
+				return pos;
+			pos += used;
+		}
+	}
+	
+	return num_bytes;
+}
+
+int font_covers_text( Font const *font, uint32_t const text[], size_t text_len ) {
+	return find_uncovered_char( font, text, text_len ) == text_len;
+}
+
+int font_covers_text_utf8( Font const *font, char const *text, size_t num_bytes ) {
+	return find_uncovered_char_utf8( font, text, num_bytes ) == num_bytes;
+}
+
+size_t get_glyph_code_points( Font const *font, uint32_t glyph, uint32_t const **codes )
+{
+	CmapCoverage const *cov = &font->coverage;
+	
+	if ( !cov->glyph_first || glyph >= font->num_glyphs ) {
+		*codes = NULL;
+		return 0;
+	}
+	
+	*codes = cov->glyph_code + cov->glyph_first[ glyph ];
+	return cov->glyph_first[ glyph + 1 ] - cov->glyph_first[ glyph ];
+}
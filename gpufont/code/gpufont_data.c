@@ -2,59 +2,160 @@
 #include <string.h>
 #include "gpufont_data.h"
 
+static void free_unmerged_glyphs( Font *font )
+{
+	size_t n;
+	for( n=0; n<font->num_glyphs; n++ )
+	{
+		SimpleGlyph *g = font->glyphs[n];
+		if ( g ) {
+			if ( IS_SIMPLE_GLYPH( g ) ) {
+				if ( g->tris.end_points ) free( g->tris.end_points );
+				if ( g->tris.indices ) free( g->tris.indices );
+				if ( g->tris.points ) free( g->tris.points );
+				if ( g->tris.flags ) free( g->tris.flags );
+			}
+			free( g );
+		}
+	}
+	free( font->glyphs );
+	font->glyphs = NULL;
+	
+	if ( font->glyph_alias ) {
+		free( font->glyph_alias );
+		font->glyph_alias = NULL;
+	}
+}
+
 void destroy_font( Font *font )
 {
+	/* font->glyphs is still around if merge_glyph_data hasn't been called or if it failed */
 	if ( font->glyphs )
+		free_unmerged_glyphs( font );
+	if ( font->glyph_desc )
+		free( font->glyph_desc );
+	if ( font->all_glyphs )
+		free( font->all_glyphs );
+	if ( font->all_vertices )
+		free( font->all_vertices );
+	if ( font->all_indices )
+		free( font->all_indices );
+	if ( font->hmetrics )
+		free( font->hmetrics );
+	if ( font->metrics.adv_width )
+		free( font->metrics.adv_width );
+	if ( font->kerning.first )
+		free( font->kerning.first );
+	if ( font->subst.nodes )
+		free( font->subst.nodes );
+	if ( font->coverage.bits )
+		free( font->coverage.bits );
+	if ( font->coverage.glyph_first )
+		free( font->coverage.glyph_first );
+	memset( font, 0, sizeof(*font) );
+}
+
+int init_glyph_metrics( Font *font )
+{
+	GlyphMetrics *m = &font->metrics;
+	size_t n = font->num_glyphs;
+	
+	/* 6 arrays of 16-bit values */
+	m->adv_width = calloc( n ? n : 1, 6 * sizeof( uint16_t ) );
+	if ( !m->adv_width )
+		return 0;
+	
+	m->lsb = (int16_t*)( m->adv_width + n );
+	m->xmin = m->lsb + n;
+	m->ymin = m->xmin + n;
+	m->xmax = m->ymin + n;
+	m->ymax = m->xmax + n;
+	return 1;
+}
+
+/* Rounds to nearest (halfway cases away from zero) and clamps to the range of PackedCoord */
+static PackedCoord quantize_coord( PointCoord c, float scale )
+{
+	float q = c * scale;
+	if ( q <= -32768.0f ) return -32768;
+	if ( q >= 32767.0f ) return 32767;
+	return (PackedCoord)( q >= 0 ? q + 0.5f : q - 0.5f );
+}
+
+size_t pack_vertices( void *out, VertexLayout layout, PointCoord const points[], PointFlag const flags[], size_t num_points, unsigned coord_shift )
+{
+	size_t n;
+	
+	if ( layout == VERTEX_FLOAT )
 	{
-		if ( font->all_glyphs )
+		FloatVertex *v = out;
+		for( n=0; n<num_points; n++ )
 		{
-			/* merge_glyph_data has been called */
-			free( font->all_glyphs );
-			free( font->all_points );
-			free( font->all_indices );
-			free( font->all_flags );
+			v[n].pos[0] = points[2*n];
+			v[n].pos[1] = points[2*n+1];
+			v[n].flag = flags[n];
 		}
-		else
+	}
+	else
+	{
+		PackedVertex *v = out;
+		float scale = 1 << coord_shift;
+		for( n=0; n<num_points; n++ )
 		{
-			/* must delete everything individually */
-			size_t n;
-			for( n=0; n<font->num_glyphs; n++ )
-			{
-				SimpleGlyph *g = font->glyphs[n];
-				if ( g ) {
-					if ( IS_SIMPLE_GLYPH( g ) ) {
-						if ( g->tris.end_points ) free( g->tris.end_points );
-						if ( g->tris.indices ) free( g->tris.indices );
-						if ( g->tris.points ) free( g->tris.points );
-						if ( g->tris.flags ) free( g->tris.flags );
-					}
-					free( g );
-				}
+			v[n].pos[0] = quantize_coord( points[2*n], scale );
+			v[n].pos[1] = quantize_coord( points[2*n+1], scale );
+			v[n].flag = flags[n] & 7;
+			v[n].pad = 0;
+		}
+	}
+	
+	return num_points * VERTEX_SIZE( layout );
+}
+
+/* Picks the finest coordinate precision that still can represent every point of every glyph */
+static unsigned choose_coord_shift( Font *font )
+{
+	PointCoord max_abs = 0;
+	unsigned shift;
+	size_t n, k;
+	
+	for( n=0; n<font->num_glyphs; n++ )
+	{
+		SimpleGlyph *g = font->glyphs[n];
+		if ( g && IS_SIMPLE_GLYPH( g ) )
+		{
+			PointCoord *p = g->tris.points;
+			for( k=0; k < 2 * (size_t) g->tris.num_points_total; k++ ) {
+				PointCoord a = p[k] < 0 ? -p[k] : p[k];
+				max_abs = ( a > max_abs ) ? a : max_abs;
 			}
 		}
-		free( font->glyphs );
 	}
-	if ( font->hmetrics )
-		free( font->hmetrics );
-	memset( font, 0, sizeof(*font) );
+	
+	for( shift=MAX_COORD_SHIFT; shift > 0; shift-- ) {
+		if ( max_abs * ( 1 << shift ) <= 32767 )
+			break;
+	}
+	
+	return shift;
 }
 
 /* Merges all vertex & index arrays together so that every glyph can be put into the same VBO. Returns 0 if failure, 1 if success */
 int merge_glyph_data( Font *font )
 {
-	GlyphTriangles dummy;
-	size_t const point_size = sizeof( dummy.points[0] ) * 2;
-	size_t const index_size = sizeof( dummy.indices[0] );
-	size_t const flag_size = sizeof( dummy.flags[0] );
+	size_t const index_size = sizeof( PointIndex );
 	
 	size_t total_points = 0;
 	size_t total_indices = 0;
 	size_t total_glyphs_mem = 0;
-	char *all_glyphs=NULL, *glyph_p;
-	PointCoord *all_points=NULL, *point_p;
-	PointIndex *all_indices=NULL, *index_p;
-	PointFlag *all_flags=NULL, *flag_p;
-	size_t n;
+	char *all_glyphs=NULL;
+	char *all_vertices=NULL;
+	PointIndex *all_indices=NULL;
+	GlyphDesc *desc=NULL;
+	size_t n, point_p=0, index_p=0, glyph_p=0;
+	size_t vertex_p=0;
+	VertexLayout layout = font->vertex_layout;
+	unsigned coord_shift = 0;
 	
 	for( n=0; n<font->num_glyphs; n++ )
 	{
@@ -64,17 +165,18 @@ int merge_glyph_data( Font *font )
 			if ( IS_SIMPLE_GLYPH( g ) ) {
 				total_points += g->tris.num_points_total;
 				total_indices += g->tris.num_indices_total;
-				total_glyphs_mem += sizeof( SimpleGlyph );
 			} else {
 				total_glyphs_mem += COMPOSITE_GLYPH_SIZE( g->num_parts );
 			}
 		}
 	}
 	
+	if ( layout == VERTEX_PACKED )
+		coord_shift = choose_coord_shift( font );
+	
 	if ( total_points ) {
-		all_points = malloc( point_size * total_points );
-		all_flags = malloc( flag_size * total_points );
-		if ( !all_points || !all_flags )
+		all_vertices = malloc( VERTEX_SIZE( layout ) * total_points );
+		if ( !all_vertices )
 			goto out_of_mem;
 	}
 	
@@ -90,65 +192,82 @@ int merge_glyph_data( Font *font )
 			goto out_of_mem;
 	}
 	
-	point_p = font->all_points = all_points;
-	index_p = font->all_indices = all_indices;
-	glyph_p = font->all_glyphs = all_glyphs;
-	flag_p = font->all_flags = all_flags;
-	font->total_indices = total_indices;
-	font->total_points = total_points;
+	desc = calloc( font->num_glyphs ? font->num_glyphs : 1, sizeof( desc[0] ) );
+	if ( !desc )
+		goto out_of_mem;
 	
 	for( n=0; n<font->num_glyphs; n++ )
 	{
 		SimpleGlyph *g = font->glyphs[n];
-		if ( g )
+		GlyphDesc *d = desc + n;
+		
+		if ( !g )
+			continue;
+		
+		if ( IS_SIMPLE_GLYPH( g ) )
 		{
-			font->glyphs[n] = (SimpleGlyph*) glyph_p;
+			size_t np = g->tris.num_points_total;
+			size_t ni = g->tris.num_indices_total;
+			
+			d->first_vertex = point_p;
+			d->first_index = index_p;
+			d->num_points = np;
+			d->num_indices_curve = g->tris.num_indices_curve;
+			d->num_indices_solid = g->tris.num_indices_solid;
 			
-			if ( IS_SIMPLE_GLYPH( g ) )
+			if ( np )
 			{
-				size_t np = g->tris.num_points_total;
-				size_t ni = g->tris.num_indices_total;
-				
-				if ( np )
-				{
-					memcpy( point_p, g->tris.points, np * point_size );
-					memcpy( flag_p, g->tris.flags, np * flag_size );
-					free( g->tris.points );
-					free( g->tris.flags );
-					g->tris.points = point_p;
-					g->tris.flags = flag_p;
-					point_p += np * 2;
-					flag_p += np;
-				}
-				
-				if ( ni )
-				{
-					memcpy( index_p, g->tris.indices, ni * index_size );
-					free( g->tris.indices );
-					g->tris.indices = index_p;
-					index_p += ni;
-				}
-				
-				memcpy( glyph_p, g, sizeof( SimpleGlyph ) );
-				free( g );
-				glyph_p += sizeof( SimpleGlyph );
+				vertex_p += pack_vertices( all_vertices + vertex_p, layout, g->tris.points, g->tris.flags, np, coord_shift );
+				point_p += np;
 			}
-			else
+			
+			if ( ni )
 			{
-				size_t s = COMPOSITE_GLYPH_SIZE( g->num_parts );
-				memcpy( glyph_p, g, s );
-				free( g );
-				glyph_p += s / sizeof( *glyph_p );
+				memcpy( all_indices + index_p, g->tris.indices, ni * index_size );
+				index_p += ni;
 			}
 		}
+		else
+		{
+			size_t s = COMPOSITE_GLYPH_SIZE( g->num_parts );
+			d->first_index = glyph_p;
+			d->num_parts = g->num_parts;
+			memcpy( all_glyphs + glyph_p, g, s );
+			glyph_p += s;
+		}
 	}
 	
+	/* Glyphs that have the same outline as some other glyph */
+	if ( font->glyph_alias )
+	{
+		for( n=0; n<font->num_glyphs; n++ )
+		{
+			GlyphIndex a = font->glyph_alias[n];
+			if ( a != n )
+			{
+				desc[n] = desc[a];
+				desc[n].offset[0] = font->metrics.xmin[n] - font->metrics.xmin[a];
+				desc[n].offset[1] = font->metrics.ymin[n] - font->metrics.ymin[a];
+			}
+		}
+	}
+	
+	/* The per-glyph arrays aren't needed anymore */
+	free_unmerged_glyphs( font );
+	
+	font->glyph_desc = desc;
+	font->all_vertices = all_vertices;
+	font->all_indices = all_indices;
+	font->all_glyphs = all_glyphs;
+	font->coord_shift = coord_shift;
+	font->total_indices = total_indices;
+	font->total_points = total_points;
 	return 1;
 	
 out_of_mem:
-	if ( all_points ) free( all_points );
-	if ( all_flags ) free( all_flags );
+	if ( all_vertices ) free( all_vertices );
 	if ( all_indices ) free( all_indices );
 	if ( all_glyphs ) free( all_glyphs );
+	if ( desc ) free( desc );
 	return 0;
 }
@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <string.h>
+#include "opengl.h"
+#include "gpufont_data.h"
+#include "gpufont_draw.h"
+#include "gpufont_doc_view.h"
+#include "layout_internal.h"
+
+struct DocView {
+	Font *font;
+	void const *text;
+	size_t text_len; /* in code units */
+	TextEncoding enc;
+	int max_line_len;
+	float line_height_scale;
+	long line_height; /* see get_line_height */
+	size_t margin_rows;
+	
+	/* The line index. Line n is text[ line_start[n] .. line_start[n+1]-2 ] followed by a newline
+	line_start[num_lines] is text_len + 1 as if the text ended with a newline. first_row[num_lines] is the number of rows */
+	size_t num_lines;
+	size_t *line_start;
+	size_t *first_row; /* in the same block of memory as line_start */
+	
+	/* Lines win_first .. win_end-1 are laid out into buf. Its positions are scratch memory. Its VBO is kept and reused */
+	size_t win_first, win_end;
+	int have_window;
+	GlyphBuffer buf;
+	TempChar *chars;
+	size_t scratch_cap; /* code units that chars and buf.positions have room for */
+	size_t vbo_cap; /* in glyphs */
+	DocViewStats stats;
+};
+
+static size_t code_unit_size( TextEncoding enc ) {
+	return enc == TEXT_UTF32 ? 4 : 1;
+}
+
+static void const *text_at( DocView const *v, size_t pos ) {
+	return (char const*) v->text + pos * code_unit_size( v->enc );
+}
+
+static int is_newline( DocView const *v, size_t pos ) {
+	return v->enc == TEXT_UTF32 ? ((uint32_t const*) v->text)[pos] == '\n' : ((char const*) v->text)[pos] == '\n';
+}
+
+/* Row counting only needs the line number of the cursor */
+static void ignore_chars( struct Font *font, void *state, TempChar const chars[], size_t num_chars )
+{
+	(void) font;
+	(void) state;
+	(void) chars;
+	(void) num_chars;
+}
+
+/* Finds the lines and counts the rows of each line */
+static int build_line_index( DocView *v )
+{
+	size_t n, k, num_lines = 1;
+	
+	for( n=0; n<v->text_len; n++ )
+		num_lines += is_newline( v, n );
+	
+	v->line_start = malloc( 2 * ( num_lines + 1 ) * sizeof( v->line_start[0] ) );
+	if ( !v->line_start )
+		return 0;
+	v->first_row = v->line_start + num_lines + 1;
+	v->num_lines = num_lines;
+	
+	v->line_start[0] = 0;
+	for( n=0, k=1; n<v->text_len; n++ ) {
+		if ( is_newline( v, n ) )
+			v->line_start[k++] = n + 1;
+	}
+	v->line_start[num_lines] = v->text_len + 1;
+	
+	/* Unwrapped lines are one row each. Otherwise each line is positioned once to see where it wraps */
+	v->first_row[0] = 0;
+	for( n=0; n<num_lines; n++ )
+	{
+		size_t rows = 1;
+		
+		if ( v->max_line_len >= 0 ) {
+			size_t begin = v->line_start[n], len = v->line_start[n+1] - 1 - begin;
+			rows = position_text_chunks( v->font, text_at( v, begin ), len, v->enc, v->max_line_len, ignore_chars, NULL, NULL );
+		}
+		
+		v->first_row[n+1] = v->first_row[n] + rows;
+	}
+	
+	return 1;
+}
+
+static DocView *create_view( struct Font *font, void const *text, size_t text_len, TextEncoding enc, int max_line_len, float line_height_scale, size_t margin_rows )
+{
+	DocView *v = calloc( 1, sizeof(*v) );
+	
+	if ( !v )
+		return NULL;
+	
+	v->font = font;
+	v->text = text;
+	v->text_len = text_len;
+	v->enc = enc;
+	v->max_line_len = max_line_len;
+	v->line_height_scale = line_height_scale;
+	v->line_height = get_line_height( font, line_height_scale );
+	v->margin_rows = margin_rows;
+	
+	if ( !build_line_index( v ) ) {
+		free( v );
+		return NULL;
+	}
+	
+	return v;
+}
+
+DocView *create_doc_view( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, size_t margin_rows ) {
+	return create_view( font, text, text_len, TEXT_UTF32, max_line_len, line_height_scale, margin_rows );
+}
+
+DocView *create_doc_view_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, size_t margin_rows ) {
+	return create_view( font, text, num_bytes, TEXT_UTF8, max_line_len, line_height_scale, margin_rows );
+}
+
+void delete_doc_view( DocView *v )
+{
+	if ( !v )
+		return;
+	
+	if ( v->buf.positions_vbo ) glDeleteBuffers( 1, &v->buf.positions_vbo );
+	if ( v->buf.positions ) free( v->buf.positions );
+	if ( v->buf.glyph_indices ) free( v->buf.glyph_indices );
+	if ( v->chars ) free( v->chars );
+	free( v->line_start );
+	free( v );
+}
+
+size_t doc_view_num_lines( DocView const *v ) {
+	return v->num_lines;
+}
+
+size_t doc_view_num_rows( DocView const *v ) {
+	return v->first_row[ v->num_lines ];
+}
+
+size_t doc_view_line_row( DocView const *v, size_t line ) {
+	return v->first_row[ line < v->num_lines ? line : v->num_lines ];
+}
+
+size_t doc_view_row_line( DocView const *v, size_t row )
+{
+	/* Every line has at least one row, so first_row is strictly increasing */
+	size_t lo = 0, hi = v->num_lines - 1;
+	
+	while( lo < hi ) {
+		size_t mid = lo + ( hi - lo + 1 ) / 2;
+		if ( v->first_row[mid] <= row )
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	
+	return lo;
+}
+
+static int reserve_scratch( DocView *v, size_t len )
+{
+	TempChar *chars;
+	GlyphCoord *positions;
+	size_t cap = v->scratch_cap;
+	
+	if ( len <= cap )
+		return 1;
+	
+	while( cap < len )
+		cap = cap ? cap * 2 : 4096;
+	
+	chars = realloc( v->chars, cap * sizeof( chars[0] ) );
+	if ( !chars )
+		return 0;
+	v->chars = chars;
+	
+	positions = realloc( v->buf.positions, cap * 2 * sizeof( positions[0] ) );
+	if ( !positions )
+		return 0;
+	v->buf.positions = positions;
+	
+	v->scratch_cap = cap;
+	return 1;
+}
+
+/* Lays out lines first .. end-1 and uploads their positions */
+static int layout_window( DocView *v, size_t first, size_t end )
+{
+	size_t begin = v->line_start[first], len = v->line_start[end] - 1 - begin;
+	LayoutCursor cur = {0};
+	LayoutSpan span;
+	
+	v->have_window = 0;
+	v->buf.batch_count = 0;
+	
+	if ( !reserve_scratch( v, len + 1 ) )
+		return 0;
+	
+	/* The rows above the window only move the lines down */
+	memset( &span, 0, sizeof( span ) );
+	span.num_chars = map_text( v->font, v->chars, text_at( v, begin ), len, v->enc, len, v->max_line_len, &cur, NULL );
+	span.first_line = v->first_row[first];
+	
+	if ( v->buf.glyph_indices ) {
+		free( v->buf.glyph_indices );
+		v->buf.glyph_indices = NULL;
+		v->buf.batch_len = NULL;
+	}
+	
+	if ( !batch_glyphs( v->font, v->chars, &span, 1, v->line_height_scale, &v->buf, NULL ) )
+		return 0;
+	
+	v->stats.buffer_reallocs += orphan_glyph_vbo( &v->buf.positions_vbo, &v->vbo_cap, v->buf.total_glyphs, 2 * sizeof( GlyphCoord ) );
+	if ( v->buf.total_glyphs )
+		glBufferSubData( GL_ARRAY_BUFFER, 0, v->buf.total_glyphs * 2 * sizeof( GlyphCoord ), v->buf.positions );
+	
+	v->win_first = first;
+	v->win_end = end;
+	v->have_window = 1;
+	v->stats.relayouts++;
+	v->stats.lines_laid_out += end - first;
+	v->stats.glyphs_uploaded += v->buf.total_glyphs;
+	return 1;
+}
+
+/* Converts a y coordinate to a row number, clamped to 0 .. num_rows */
+static size_t row_at( DocView const *v, double y )
+{
+	double rows = (double) doc_view_num_rows( v );
+	double r = y * ( 1 << LINEH_PREC ) / v->line_height;
+	return r <= 0 ? 0 : ( r >= rows ? (size_t) rows : (size_t) r );
+}
+
+int set_doc_view_range( DocView *v, int32_t y0, int32_t y1 )
+{
+	size_t r0, r1, first, end;
+	
+	if ( !v->line_height ) {
+		/* Every row is at the same place */
+		r0 = 0;
+		r1 = doc_view_num_rows( v );
+	} else {
+		/* Line height can be negative. Glyphs reach into the rows next to their own */
+		r0 = row_at( v, y0 );
+		r1 = row_at( v, y1 );
+		if ( r0 > r1 ) {
+			size_t t = r0;
+			r0 = r1;
+			r1 = t;
+		}
+		r0 = r0 ? r0 - 1 : 0;
+		r1 = r1 + 1;
+	}
+	
+	first = doc_view_row_line( v, r0 );
+	end = doc_view_row_line( v, r1 ) + 1;
+	
+	if ( v->have_window && v->win_first <= first && end <= v->win_end )
+		return 1;
+	
+	first = doc_view_row_line( v, r0 > v->margin_rows ? r0 - v->margin_rows : 0 );
+	end = doc_view_row_line( v, r1 + v->margin_rows ) + 1;
+	return layout_window( v, first, end );
+}
+
+void draw_doc_view( DocView *v, float global_transform[16], int draw_flags )
+{
+	if ( v->have_window )
+		draw_batches( v->font, &v->buf, v->buf.positions_vbo, 0, global_transform, draw_flags );
+}
+
+void get_doc_view_stats( DocView const *v, DocViewStats *stats ) {
+	*stats = v->stats;
+}
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
@@ -13,6 +14,8 @@
 
 #define GLYPH_INDEX_GL_TYPE GET_UINT_TYPE( GlyphIndex )
 #define POINT_INDEX_GL_TYPE GET_UINT_TYPE( PointIndex )
+#define PACKED_FLAG_GL_TYPE GET_UINT_TYPE( uint8_t )
+#define PACKED_COORD_GL_TYPE GET_INT_TYPE( PackedCoord )
 #define POINT_FLAG_GL_TYPE GET_UINT_TYPE( PointFlag )
 #define POINT_COORD_GL_TYPE GET_INTFLOAT_TYPE( PointCoord )
 #define GLYPH_COORD_GL_TYPE GET_INTFLOAT_TYPE( GlyphCoord )
@@ -23,6 +26,10 @@ static struct {
 	GLint the_color;
 	GLint fill_mode;
 	GLint coord_scale;
+	GLint vertex_scale;
+	GLint glyph_offset;
+	GLint instance_styles;
+	GLint instance_matrices;
 } uniforms = {0};
 
 typedef enum {
@@ -35,7 +42,9 @@ typedef enum {
 enum {
 	ATTRIB_POS=0,
 	ATTRIB_FLAG=1,
-	ATTRIB_GLYPH_POS=2
+	ATTRIB_GLYPH_POS=2,
+	ATTRIB_INSTANCE_COLOR=3,
+	ATTRIB_INSTANCE_TRANSFORM=4
 };
 
 /* The shader program used to draw text */
@@ -51,6 +60,10 @@ int init_font_shader( GLuint_ linked_compiled_prog )
 	uniforms.the_color = glGetUniformLocation( the_prog, "the_color" );
 	uniforms.fill_mode = glGetUniformLocation( the_prog, "fill_mode" );
 	uniforms.coord_scale = glGetUniformLocation( the_prog, "coordinate_scale" );
+	uniforms.vertex_scale = glGetUniformLocation( the_prog, "vertex_scale" );
+	uniforms.glyph_offset = glGetUniformLocation( the_prog, "glyph_offset" );
+	uniforms.instance_styles = glGetUniformLocation( the_prog, "instance_styles" );
+	uniforms.instance_matrices = glGetUniformLocation( the_prog, "instance_matrices" );
 	return 1;
 }
 
@@ -58,23 +71,22 @@ void deinit_font_shader( void ) {
 	glDeleteProgram( the_prog );
 }
 
-static void add_glyph_stats( Font *font, SimpleGlyph *glyph, size_t counts[3], unsigned limits[3] )
+static void add_glyph_stats( Font *font, GlyphDesc const *glyph, size_t counts[3], unsigned limits[3] )
 {
-	if ( !glyph )
-		return;
 	if ( IS_SIMPLE_GLYPH( glyph ) ) {
-		counts[0] += glyph->tris.num_points_total;
-		counts[1] += glyph->tris.num_indices_curve;
-		counts[2] += glyph->tris.num_indices_solid;
-		limits[0] = ( glyph->tris.num_points_total > limits[0] ) ? glyph->tris.num_points_total : limits[0];
-		limits[1] = ( glyph->tris.num_indices_curve > limits[1] ) ? glyph->tris.num_indices_curve : limits[1];
-		limits[2] = ( glyph->tris.num_indices_solid > limits[2] ) ? glyph->tris.num_indices_solid : limits[2];
+		counts[0] += glyph->num_points;
+		counts[1] += glyph->num_indices_curve;
+		counts[2] += glyph->num_indices_solid;
+		limits[0] = ( glyph->num_points > limits[0] ) ? glyph->num_points : limits[0];
+		limits[1] = ( glyph->num_indices_curve > limits[1] ) ? glyph->num_indices_curve : limits[1];
+		limits[2] = ( glyph->num_indices_solid > limits[2] ) ? glyph->num_indices_solid : limits[2];
 	} else {
+		void *com = GET_COMPOSITE_GLYPH( font, glyph );
 		size_t k;
 		for( k=0; k < ( glyph->num_parts ); k++ )
 		{
-			GlyphIndex subglyph_id = GET_SUBGLYPH_INDEX( glyph, k );
-			add_glyph_stats( font, font->glyphs[subglyph_id], counts, limits );
+			GlyphIndex subglyph_id = GET_SUBGLYPH_INDEX( com, k );
+			add_glyph_stats( font, font->glyph_desc + subglyph_id, counts, limits );
 		}
 	}
 }
@@ -84,7 +96,7 @@ static void get_average_glyph_stats( Font *font, unsigned avg[3], unsigned max[3
 	size_t n, total[3] = {0,0,0};
 	max[0] = max[1] = max[2] = 0;
 	for( n=0; n<( font->num_glyphs ); n++ )
-		add_glyph_stats( font, font->glyphs[n], total, max );
+		add_glyph_stats( font, font->glyph_desc + n, total, max );
 	for( n=0; n<3; n++ )
 		avg[n] = total[n] / font->num_glyphs;
 }
@@ -100,9 +112,8 @@ void prepare_font( Font *font )
 	
 	get_average_glyph_stats( font, stats, limits );
 	
-	all_data_size = font->total_points * sizeof( PointCoord ) * 2;
+	all_data_size = font->total_points * VERTEX_SIZE( font->vertex_layout );
 	all_data_size += font->total_indices * sizeof( PointIndex );
-	all_data_size += font->total_points * sizeof( PointFlag );
 	
 	printf(
 	"Uploading font to GL\n"
@@ -122,25 +133,30 @@ void prepare_font( Font *font )
 	glUseProgram( the_prog );
 	
 	glGenVertexArrays( 1, buf );
-	glGenBuffers( 3, buf+1 );
+	glGenBuffers( 2, buf+1 );
 	
 	glBindVertexArray( buf[0] );
 	glEnableVertexAttribArray( ATTRIB_POS );
 	glEnableVertexAttribArray( ATTRIB_FLAG );
 	glEnableVertexAttribArray( ATTRIB_GLYPH_POS ); /* don't have a VBO for this attribute yet */
 	glVertexAttribDivisor( ATTRIB_GLYPH_POS, 1 );
+	glVertexAttribDivisor( ATTRIB_INSTANCE_COLOR, 1 ); /* enabled by begin_instance_styles */
+	glVertexAttribDivisor( ATTRIB_INSTANCE_TRANSFORM, 1 );
 	
-	/* point coords & indices */
+	/* interleaved vertices & indices */
 	glBindBuffer( GL_ARRAY_BUFFER, buf[1] );
 	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, buf[2] );
-	glBufferData( GL_ARRAY_BUFFER, font->total_points * sizeof( PointCoord ) * 2, font->all_points, GL_STATIC_DRAW );
+	glBufferData( GL_ARRAY_BUFFER, font->total_points * VERTEX_SIZE( font->vertex_layout ), font->all_vertices, GL_STATIC_DRAW );
 	glBufferData( GL_ELEMENT_ARRAY_BUFFER, font->total_indices * sizeof( PointIndex ), font->all_indices, GL_STATIC_DRAW );
-	glVertexAttribPointer( ATTRIB_POS, 2, POINT_COORD_GL_TYPE, GL_FALSE, 0, 0 );
 	
-	/* point flags */
-	glBindBuffer( GL_ARRAY_BUFFER, buf[3] );
-	glBufferData( GL_ARRAY_BUFFER, font->total_points * sizeof( PointFlag ), font->all_flags, GL_STATIC_DRAW );
-	glVertexAttribIPointer( ATTRIB_FLAG, 1, POINT_FLAG_GL_TYPE, 0, 0 );
+	if ( font->vertex_layout == VERTEX_FLOAT ) {
+		glVertexAttribPointer( ATTRIB_POS, 2, POINT_COORD_GL_TYPE, GL_FALSE, sizeof( FloatVertex ), (void*) offsetof( FloatVertex, pos ) );
+		glVertexAttribIPointer( ATTRIB_FLAG, 1, POINT_FLAG_GL_TYPE, sizeof( FloatVertex ), (void*) offsetof( FloatVertex, flag ) );
+	} else {
+		/* integer coordinates are converted to floats (not normalized). The shader scales them with vertex_scale */
+		glVertexAttribPointer( ATTRIB_POS, 2, PACKED_COORD_GL_TYPE, GL_FALSE, sizeof( PackedVertex ), (void*) offsetof( PackedVertex, pos ) );
+		glVertexAttribIPointer( ATTRIB_FLAG, 1, PACKED_FLAG_GL_TYPE, sizeof( PackedVertex ), (void*) offsetof( PackedVertex, flag ) );
+	}
 	
 	glBindVertexArray( 0 );
 	
@@ -153,7 +169,7 @@ void release_font( Font *font )
 {
 	printf( "Releasing font GL buffers\n" );
 	glDeleteVertexArrays( 1, font->gl_buffers );
-	glDeleteBuffers( 3, font->gl_buffers+1 );
+	glDeleteBuffers( 2, font->gl_buffers+1 );
 }
 
 void set_text_color( float c[4] ) {
@@ -177,6 +193,7 @@ void begin_text( Font *font )
 {
 	glUseProgram( the_prog );
 	glUniform1f( uniforms.coord_scale, 1.0f / font->units_per_em );
+	glUniform1f( uniforms.vertex_scale, 1.0f / ( 1 << font->coord_shift ) );
 	debug_color( 0 );
 	glBindVertexArray( font->gl_buffers[0] );
 }
@@ -200,27 +217,35 @@ static void set_fill_mode( FillMode mode )
 	glUniform1i( uniforms.fill_mode, mode );
 }
 
+/* Moves glyphs that borrow the outline of another glyph */
+static void set_glyph_offset( int16_t const offset[2] )
+{
+	static int16_t cur_offset[2] = {0,0}; /* same initial value as in the vertex shader code */
+	if ( offset[0] == cur_offset[0] && offset[1] == cur_offset[1] ) return;
+	cur_offset[0] = offset[0];
+	cur_offset[1] = offset[1];
+	glUniform2f( uniforms.glyph_offset, offset[0], offset[1] );
+}
+
 /* Draws only simple glyphs !! */
-static void draw_instances( Font *font, size_t num_instances, size_t glyph_index, int flags )
+static void draw_instances( size_t num_instances, GlyphDesc const *glyph, int flags )
 {
-	SimpleGlyph *glyph = font->glyphs[ glyph_index ];
-	GLint first_vertex;
+	GLint first_vertex = glyph->first_vertex;
 	FillMode fill_curve=FILL_CURVE, show_flags=SHOW_FLAGS;
 	
-	if ( glyph->tris.num_points_total == 0 )
+	if ( glyph->num_points == 0 )
 		return;
 	
 	if ( flags & F_ALL_SOLID )
 		fill_curve = show_flags = FILL_SOLID;
 	
-	/* divided by 2 because each point has both X and Y coordinate */
-	first_vertex = ( glyph->tris.points - font->all_points ) / 2;
+	set_glyph_offset( glyph->offset );
 	
 	if ( flags & F_DRAW_TRIS )
 	{
-		size_t offset = ( sizeof( PointIndex ) * ( glyph->tris.indices - font->all_indices ) );
-		unsigned n_curve = glyph->tris.num_indices_curve;
-		unsigned n_solid = glyph->tris.num_indices_solid;
+		size_t offset = sizeof( PointIndex ) * glyph->first_index;
+		unsigned n_curve = glyph->num_indices_curve;
+		unsigned n_solid = glyph->num_indices_solid;
 		
 		if ( ( flags & F_DRAW_CURVE ) && n_curve ) {
 			if ( flags & F_DEBUG_COLORS )
@@ -244,7 +269,7 @@ static void draw_instances( Font *font, size_t num_instances, size_t glyph_index
 		} else {
 			set_fill_mode( FILL_SOLID );
 		}
-		glDrawArraysInstancedARB( GL_POINTS, first_vertex, glyph->tris.num_points_total, num_instances );
+		glDrawArraysInstancedARB( GL_POINTS, first_vertex, glyph->num_points, num_instances );
 	}
 }
 
@@ -283,27 +308,25 @@ static void compute_subglyph_matrix( float out[16], float sg_mat[4], float sg_of
 	/* todo */
 }
 
-static void draw_composite_glyph( Font *font, void *glyph, size_t num_instances, float global_transform[16], int flags )
+static void draw_composite_glyph( Font *font, GlyphDesc const *desc, size_t num_instances, float global_transform[16], int flags )
 {
+	void *glyph = GET_COMPOSITE_GLYPH( font, desc );
 	size_t num_parts = GET_SUBGLYPH_COUNT( glyph );
 	size_t p;
 	
 	for( p=0; p < num_parts; p++ )
 	{
 		GlyphIndex subglyph_index = GET_SUBGLYPH_INDEX( glyph, p );
-		SimpleGlyph *subglyph = font->glyphs[ subglyph_index ];
+		GlyphDesc const *subglyph = font->glyph_desc + subglyph_index;
 		float *matrix = GET_SUBGLYPH_TRANSFORM( glyph, p );
 		float *offset = matrix + 4;
 		float m[16];
 		
-		if ( !subglyph )
-			continue;
-		
 		compute_subglyph_matrix( m, matrix, offset, global_transform );
 		
 		if ( subglyph->num_parts == 0 ) {
 			send_matrix( m );
-			draw_instances( font, num_instances, subglyph_index, flags );
+			draw_instances( num_instances, subglyph, flags );
 		} else {
 			/* composite glyph contains other composite glyphs. At least FreeSans.ttf has these */
 			/*
@@ -324,24 +347,49 @@ void bind_glyph_positions( GLuint_ vbo, size_t first )
 
 void draw_glyphs( struct Font *font, float global_transform[16], size_t glyph_index, size_t num_instances, int flags )
 {
-	SimpleGlyph *glyph;
+	GlyphDesc const *glyph;
 	
 	if ( !num_instances )
 		return;
 	
-	glyph = font->glyphs[ glyph_index ];
-	
-	if ( !glyph || !glyph->tris.num_points_total ) {
-		/* glyph has no outline or doesn't even exist */
-		return;
-	}
+	glyph = font->glyph_desc + glyph_index;
 	
 	if ( IS_SIMPLE_GLYPH( glyph ) ) {
+		if ( !glyph->num_points ) {
+			/* glyph has no outline */
+			return;
+		}
 		send_matrix( global_transform );
-		draw_instances( font, num_instances, glyph_index, flags );
+		draw_instances( num_instances, glyph, flags );
 	} else {
 		#if ENABLE_COMPOSITE_GLYPHS
 		draw_composite_glyph( font, glyph, num_instances, global_transform, flags );
 		#endif
 	}
 }
+
+void begin_instance_styles( void )
+{
+	glEnableVertexAttribArray( ATTRIB_INSTANCE_COLOR );
+	glEnableVertexAttribArray( ATTRIB_INSTANCE_TRANSFORM );
+	glUniform1i( uniforms.instance_styles, 1 );
+}
+
+void end_instance_styles( void )
+{
+	glDisableVertexAttribArray( ATTRIB_INSTANCE_COLOR );
+	glDisableVertexAttribArray( ATTRIB_INSTANCE_TRANSFORM );
+	glUniform1i( uniforms.instance_styles, 0 );
+}
+
+void set_instance_transforms( float matrices[][16], size_t count ) {
+	glUniformMatrix4fv( uniforms.instance_matrices, count, GL_FALSE, matrices[0] );
+}
+
+void bind_instance_styles( GLuint_ vbo, size_t offset, size_t first )
+{
+	offset += first * sizeof( InstanceStyle );
+	glBindBuffer( GL_ARRAY_BUFFER, vbo );
+	glVertexAttribPointer( ATTRIB_INSTANCE_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof( InstanceStyle ), (void*)( offset + offsetof( InstanceStyle, color ) ) );
+	glVertexAttribPointer( ATTRIB_INSTANCE_TRANSFORM, 1, GL_FLOAT, GL_FALSE, sizeof( InstanceStyle ), (void*)( offset + offsetof( InstanceStyle, transform ) ) );
+}
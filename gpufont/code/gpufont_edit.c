@@ -0,0 +1,407 @@
+#include <stdlib.h>
+#include <string.h>
+#include "opengl.h"
+#include "gpufont_data.h"
+#include "gpufont_draw.h"
+#include "gpufont_edit.h"
+#include "layout_internal.h"
+
+typedef struct {
+	uint32_t *text; /* without the newline */
+	size_t len, cap;
+	int32_t num_rows; /* 1 + number of wraps */
+	size_t num_glyphs;
+	size_t num_batches;
+	GlyphIndex *glyph_indices; /* batch_len is in the same block of memory */
+	size_t *batch_len;
+	size_t slot_first, slot_cap; /* region of the position VBO reserved for this line (in glyphs) */
+} EditLine;
+
+struct TextEdit {
+	Font *font;
+	int max_line_len;
+	float line_height_scale;
+	EditLine *lines;
+	size_t num_lines, lines_cap;
+	GLuint vbo;
+	size_t vbo_cap, vbo_used; /* in glyphs */
+	size_t vbo_wasted; /* slots that no line uses anymore */
+	TextEditStats stats;
+};
+
+static void free_line( TextEdit *te, EditLine *ln )
+{
+	te->vbo_wasted += ln->slot_cap;
+	if ( ln->text ) free( ln->text );
+	if ( ln->glyph_indices ) free( ln->glyph_indices );
+	memset( ln, 0, sizeof(*ln) );
+}
+
+static int reserve_text( EditLine *ln, size_t len )
+{
+	uint32_t *p;
+	size_t cap = ln->cap;
+	
+	if ( len <= cap )
+		return 1;
+	
+	while( cap < len )
+		cap = cap ? cap * 2 : 16;
+	
+	p = realloc( ln->text, cap * sizeof( p[0] ) );
+	if ( !p )
+		return 0;
+	
+	ln->text = p;
+	ln->cap = cap;
+	return 1;
+}
+
+/* Moves the position data into a new VBO of new_cap glyphs. If compact is nonzero, slots are packed together */
+static void realloc_vbo( TextEdit *te, size_t new_cap, int compact )
+{
+	const size_t vec_size = 2 * sizeof( GlyphCoord );
+	GLuint vbo;
+	
+	glGenBuffers( 1, &vbo );
+	glBindBuffer( GL_COPY_WRITE_BUFFER, vbo );
+	glBufferData( GL_COPY_WRITE_BUFFER, new_cap * vec_size, NULL, GL_DYNAMIC_DRAW );
+	
+	if ( te->vbo )
+	{
+		glBindBuffer( GL_COPY_READ_BUFFER, te->vbo );
+		
+		if ( compact )
+		{
+			size_t n, dst = 0;
+			for( n=0; n<te->num_lines; n++ )
+			{
+				EditLine *ln = te->lines + n;
+				/* A line that is being laid out again has already given up its slot (slot_cap is 0) */
+				size_t count = ln->num_glyphs < ln->slot_cap ? ln->num_glyphs : ln->slot_cap;
+				if ( count )
+					glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, ln->slot_first * vec_size, dst * vec_size, count * vec_size );
+				ln->slot_first = dst;
+				dst += ln->slot_cap;
+			}
+			te->vbo_used = dst;
+			te->vbo_wasted = 0;
+		}
+		else if ( te->vbo_used )
+		{
+			glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, te->vbo_used * vec_size );
+		}
+		
+		glDeleteBuffers( 1, &te->vbo );
+	}
+	
+	te->vbo = vbo;
+	te->vbo_cap = new_cap;
+	te->stats.buffer_reallocs++;
+}
+
+/* Gives the line a slot that can hold at least num_glyphs positions */
+static void reserve_slot( TextEdit *te, EditLine *ln, size_t num_glyphs )
+{
+	size_t cap;
+	
+	if ( num_glyphs <= ln->slot_cap )
+		return;
+	
+	/* The old slot is abandoned. Leave room to grow */
+	te->vbo_wasted += ln->slot_cap;
+	ln->slot_cap = 0;
+	cap = num_glyphs + num_glyphs / 2 + 8;
+	
+	if ( te->vbo_used + cap > te->vbo_cap )
+	{
+		size_t live = te->vbo_used - te->vbo_wasted;
+		size_t new_cap = 2 * ( live + cap );
+		if ( new_cap < MIN_VBO_GLYPHS )
+			new_cap = MIN_VBO_GLYPHS;
+		
+		/* Compact when at least half of the buffer is garbage. Otherwise just grow */
+		realloc_vbo( te, new_cap, te->vbo_wasted > live );
+	}
+	
+	ln->slot_first = te->vbo_used;
+	ln->slot_cap = cap;
+	te->vbo_used += cap;
+}
+
+static int relayout_line( TextEdit *te, EditLine *ln )
+{
+	LayoutCursor cur = {0};
+	LayoutSpan span;
+	GlyphBuffer tmp;
+	TempChar *chars;
+	
+	chars = malloc( ln->len * sizeof( chars[0] ) + 1 );
+	tmp.positions = malloc( ln->len * 2 * sizeof( tmp.positions[0] ) + 1 );
+	tmp.glyph_indices = NULL;
+	tmp.batch_len = NULL;
+	
+	if ( !chars || !tmp.positions ) {
+		if ( chars ) free( chars );
+		if ( tmp.positions ) free( tmp.positions );
+		return 0;
+	}
+	
+	memset( &span, 0, sizeof( span ) );
+	span.num_chars = init_glyph_positions( te->font, chars, ln->text, ln->len, te->max_line_len, 1, &cur );
+	
+	if ( !batch_glyphs( te->font, chars, &span, 1, te->line_height_scale, &tmp, NULL ) ) {
+		free( chars );
+		free( tmp.positions );
+		return 0;
+	}
+	
+	if ( ln->glyph_indices )
+		free( ln->glyph_indices );
+	
+	ln->num_rows = cur.line + 1;
+	ln->num_glyphs = tmp.total_glyphs;
+	ln->num_batches = tmp.batch_count;
+	ln->glyph_indices = tmp.glyph_indices;
+	ln->batch_len = tmp.batch_len;
+	
+	reserve_slot( te, ln, ln->num_glyphs );
+	if ( ln->num_glyphs ) {
+		glBindBuffer( GL_ARRAY_BUFFER, te->vbo );
+		glBufferSubData( GL_ARRAY_BUFFER, ln->slot_first * 2 * sizeof( GlyphCoord ), ln->num_glyphs * 2 * sizeof( GlyphCoord ), tmp.positions );
+	}
+	
+	te->stats.lines_laid_out++;
+	te->stats.glyphs_uploaded += ln->num_glyphs;
+	
+	free( chars );
+	free( tmp.positions );
+	return 1;
+}
+
+/* Inserts count empty lines before line 'at' */
+static int insert_lines( TextEdit *te, size_t at, size_t count )
+{
+	if ( te->num_lines + count > te->lines_cap )
+	{
+		size_t cap = te->lines_cap ? te->lines_cap : 16;
+		EditLine *p;
+		while( cap < te->num_lines + count )
+			cap *= 2;
+		p = realloc( te->lines, cap * sizeof( p[0] ) );
+		if ( !p )
+			return 0;
+		te->lines = p;
+		te->lines_cap = cap;
+	}
+	
+	memmove( te->lines + at + count, te->lines + at, ( te->num_lines - at ) * sizeof( te->lines[0] ) );
+	memset( te->lines + at, 0, count * sizeof( te->lines[0] ) );
+	te->num_lines += count;
+	return 1;
+}
+
+static void remove_line( TextEdit *te, size_t at )
+{
+	free_line( te, te->lines + at );
+	te->num_lines--;
+	memmove( te->lines + at, te->lines + at + 1, ( te->num_lines - at ) * sizeof( te->lines[0] ) );
+}
+
+TextEdit *create_text_edit( struct Font *font, int max_line_len, float line_height_scale )
+{
+	TextEdit *te = calloc( 1, sizeof(*te) );
+	
+	if ( !te )
+		return NULL;
+	
+	te->font = font;
+	te->max_line_len = max_line_len;
+	te->line_height_scale = line_height_scale;
+	
+	/* There is always at least one (possibly empty) line */
+	if ( !insert_lines( te, 0, 1 ) || !relayout_line( te, te->lines ) ) {
+		delete_text_edit( te );
+		return NULL;
+	}
+	
+	return te;
+}
+
+void delete_text_edit( TextEdit *te )
+{
+	size_t n;
+	if ( !te )
+		return;
+	for( n=0; n<te->num_lines; n++ )
+		free_line( te, te->lines + n );
+	if ( te->lines )
+		free( te->lines );
+	if ( te->vbo )
+		glDeleteBuffers( 1, &te->vbo );
+	free( te );
+}
+
+int text_edit_insert( TextEdit *te, size_t line, size_t column, uint32_t const *text, size_t text_len )
+{
+	EditLine *ln;
+	size_t tail_len, first_len = 0, old_len, num_newlines = 0, n, seg, k;
+	
+	if ( line >= te->num_lines || column > te->lines[line].len )
+		return 0;
+	
+	for( n=0; n<text_len; n++ )
+		num_newlines += ( text[n] == '\n' );
+	
+	if ( !num_newlines )
+	{
+		ln = te->lines + line;
+		if ( !reserve_text( ln, ln->len + text_len ) )
+			return 0;
+		memmove( ln->text + column + text_len, ln->text + column, ( ln->len - column ) * sizeof( ln->text[0] ) );
+		memcpy( ln->text + column, text, text_len * sizeof( text[0] ) );
+		ln->len += text_len;
+		return relayout_line( te, ln );
+	}
+	
+	/* The new lines are filled and laid out before the line itself changes, so running out of memory leaves the text as it was
+	The part of the line after the cursor goes to the end of the last new line */
+	if ( !insert_lines( te, line + 1, num_newlines ) )
+		return 0;
+	
+	ln = te->lines + line;
+	tail_len = ln->len - column;
+	
+	for( n=0, seg=0, k=0; n<=text_len; n++ )
+	{
+		if ( n == text_len || text[n] == '\n' )
+		{
+			size_t seg_len = n - seg;
+			int last = ( n == text_len );
+			EditLine *nl = ln + k;
+			
+			if ( !k ) {
+				first_len = seg_len;
+			} else {
+				if ( !reserve_text( nl, seg_len + ( last ? tail_len : 0 ) ) )
+					goto error_handler;
+				memcpy( nl->text, text + seg, seg_len * sizeof( text[0] ) );
+				nl->len = seg_len;
+				if ( last ) {
+					memcpy( nl->text + nl->len, ln->text + column, tail_len * sizeof( ln->text[0] ) );
+					nl->len += tail_len;
+				}
+				if ( !relayout_line( te, nl ) )
+					goto error_handler;
+			}
+			
+			k++;
+			seg = n + 1;
+		}
+	}
+	
+	/* The text before the first newline replaces the tail */
+	if ( !reserve_text( ln, column + first_len ) )
+		goto error_handler;
+	old_len = ln->len;
+	memcpy( ln->text + column, text, first_len * sizeof( text[0] ) );
+	ln->len = column + first_len;
+	if ( relayout_line( te, ln ) )
+		return 1;
+	
+	/* The old batches of the line are still there. Put the tail back from the last new line */
+	memcpy( ln->text + column, ln[num_newlines].text + ln[num_newlines].len - tail_len, tail_len * sizeof( ln->text[0] ) );
+	ln->len = old_len;
+	
+error_handler:;
+	for( k=1; k<=num_newlines; k++ )
+		free_line( te, ln + k );
+	te->num_lines -= num_newlines;
+	memmove( ln + 1, ln + 1 + num_newlines, ( te->num_lines - line - 1 ) * sizeof( ln[0] ) );
+	return 0;
+}
+
+int text_edit_delete( TextEdit *te, size_t line, size_t column, size_t count )
+{
+	EditLine *ln;
+	
+	if ( line >= te->num_lines || column > te->lines[line].len )
+		return 0;
+	
+	ln = te->lines + line;
+	
+	while( count )
+	{
+		size_t avail = ln->len - column;
+		EditLine *next;
+		
+		if ( count <= avail ) {
+			memmove( ln->text + column, ln->text + column + count, ( avail - count ) * sizeof( ln->text[0] ) );
+			ln->len -= count;
+			break;
+		}
+		
+		/* Delete the rest of the line and the newline. Then continue on the next line */
+		ln->len = column;
+		count -= avail;
+		
+		if ( line + 1 >= te->num_lines )
+			break;
+		
+		count--;
+		next = ln + 1;
+		if ( !reserve_text( ln, ln->len + next->len ) )
+			return 0;
+		memcpy( ln->text + ln->len, next->text, next->len * sizeof( ln->text[0] ) );
+		ln->len += next->len;
+		remove_line( te, line + 1 );
+	}
+	
+	return relayout_line( te, ln );
+}
+
+size_t text_edit_num_lines( TextEdit const *te ) {
+	return te->num_lines;
+}
+
+size_t text_edit_line_len( TextEdit const *te, size_t line ) {
+	return line < te->num_lines ? te->lines[line].len : 0;
+}
+
+void draw_text_edit( TextEdit *te, float global_transform[16], int draw_flags )
+{
+	long line_height = get_line_height( te->font, te->line_height_scale );
+	float upem = te->font->units_per_em;
+	int32_t row = 0;
+	size_t n, b, k;
+	
+	for( n=0; n<te->num_lines; n++ )
+	{
+		EditLine *ln = te->lines + n;
+		
+		if ( ln->num_batches )
+		{
+			/* Move the line down by the rows above it */
+			float mat[16];
+			float y = ( row * line_height >> LINEH_PREC ) / upem;
+			size_t first = ln->slot_first;
+			
+			memcpy( mat, global_transform, sizeof( mat ) );
+			for( k=0; k<4; k++ )
+				mat[12+k] += global_transform[4+k] * y;
+			
+			for( b=0; b<ln->num_batches; b++ )
+			{
+				bind_glyph_positions( te->vbo, first );
+				draw_glyphs( te->font, mat, ln->glyph_indices[b], ln->batch_len[b], draw_flags );
+				first += ln->batch_len[b];
+			}
+		}
+		
+		row += ln->num_rows;
+	}
+}
+
+void get_text_edit_stats( TextEdit const *te, TextEditStats *stats ) {
+	*stats = te->stats;
+}
@@ -0,0 +1,364 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "gpufont_data.h"
+#include "gpufont_font_cache.h"
+#include "coverage.h"
+
+#define CACHE_MAGIC 0x31434647 /* "GFC1" */
+#define CACHE_VERSION 1
+#define CACHE_BYTE_ORDER 0x01020304
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t byte_order; /* CACHE_BYTE_ORDER in the byte order of the writer */
+	uint32_t type_sizes; /* sizes of GlyphDesc, PointIndex, GlyphIndex and SubstNode */
+	uint32_t num_glyphs;
+	uint32_t units_per_em;
+	uint32_t vertex_layout;
+	uint32_t coord_shift;
+	uint32_t total_points;
+	uint32_t total_indices;
+	uint32_t composite_bytes; /* size of all_glyphs */
+	uint32_t num_cmap; /* (code point, glyph) pairs */
+	uint32_t num_kern_pairs;
+	uint32_t num_subst_nodes;
+	uint32_t num_subst_edges;
+	uint32_t num_ligatures;
+	int32_t horz_ascender;
+	int32_t horz_descender;
+	int32_t horz_linegap;
+} CacheHeader;
+
+#define TYPE_SIZES (( sizeof( GlyphDesc ) | sizeof( PointIndex ) << 8 | sizeof( GlyphIndex ) << 16 | sizeof( SubstNode ) << 24 ))
+
+/* The cmap is saved as pairs of code point and glyph */
+typedef struct {
+	uint32_t *pairs;
+	size_t count;
+} CmapPairs;
+
+static void add_cmap_pair( void *p, NibValue code, NibValue glyph )
+{
+	CmapPairs *c = p;
+	if ( c->pairs ) {
+		c->pairs[ 2 * c->count ] = code;
+		c->pairs[ 2 * c->count + 1 ] = glyph;
+	}
+	c->count++;
+}
+
+static size_t kern_block_size( size_t num_glyphs, size_t num_pairs ) {
+	return ( num_glyphs + 1 ) * sizeof( uint32_t ) + num_pairs * ( sizeof( uint16_t ) + sizeof( int16_t ) );
+}
+
+static size_t subst_block_size( size_t num_nodes, size_t num_edges ) {
+	return num_nodes * sizeof( SubstNode ) + num_edges * ( sizeof( GlyphIndex ) + sizeof( uint32_t ) );
+}
+
+static int write_block( FILE *fp, void const *data, size_t size ) {
+	return !size || fwrite( data, size, 1, fp ) == 1;
+}
+
+FontStatus save_font_cache( Font const *font, const char filename[] )
+{
+	CacheHeader h;
+	CmapPairs cmap;
+	size_t n, composite_bytes = 0, n_glyphs = font->num_glyphs;
+	FILE *fp;
+	int ok;
+	
+	if ( !font->glyph_desc )
+		return F_FAIL_INCOMPLETE;
+	
+	for( n=0; n<n_glyphs; n++ ) {
+		if ( font->glyph_desc[n].num_parts )
+			composite_bytes += COMPOSITE_GLYPH_SIZE( font->glyph_desc[n].num_parts );
+	}
+	
+	/* nibtree_walk needs a mutable tree but doesn't change it */
+	memset( &cmap, 0, sizeof( cmap ) );
+	nibtree_walk( (NibTree*) &font->cmap, add_cmap_pair, &cmap );
+	cmap.pairs = malloc( cmap.count * 2 * sizeof( cmap.pairs[0] ) + 1 );
+	if ( !cmap.pairs )
+		return F_FAIL_ALLOC;
+	cmap.count = 0;
+	nibtree_walk( (NibTree*) &font->cmap, add_cmap_pair, &cmap );
+	
+	memset( &h, 0, sizeof( h ) );
+	h.magic = CACHE_MAGIC;
+	h.version = CACHE_VERSION;
+	h.byte_order = CACHE_BYTE_ORDER;
+	h.type_sizes = TYPE_SIZES;
+	h.num_glyphs = n_glyphs;
+	h.units_per_em = font->units_per_em;
+	h.vertex_layout = font->vertex_layout;
+	h.coord_shift = font->coord_shift;
+	h.total_points = font->total_points;
+	h.total_indices = font->total_indices;
+	h.composite_bytes = composite_bytes;
+	h.num_cmap = cmap.count;
+	h.num_kern_pairs = font->kerning.first ? font->kerning.num_pairs : 0;
+	h.num_subst_nodes = font->subst.nodes ? font->subst.num_nodes : 0;
+	h.num_subst_edges = font->subst.nodes ? font->subst.num_edges : 0;
+	h.num_ligatures = font->subst.nodes ? font->subst.num_ligatures : 0;
+	h.horz_ascender = font->horz_ascender;
+	h.horz_descender = font->horz_descender;
+	h.horz_linegap = font->horz_linegap;
+	
+	fp = fopen( filename, "wb" );
+	if ( !fp ) {
+		free( cmap.pairs );
+		return F_FAIL_OPEN;
+	}
+	
+	/* The kerning and substitution arrays are each in one block of memory that starts at 'first' and 'nodes' */
+	ok = write_block( fp, &h, sizeof( h ) )
+		&& write_block( fp, font->glyph_desc, n_glyphs * sizeof( GlyphDesc ) )
+		&& write_block( fp, font->all_vertices, font->total_points * VERTEX_SIZE( font->vertex_layout ) )
+		&& write_block( fp, font->all_indices, font->total_indices * sizeof( PointIndex ) )
+		&& write_block( fp, font->all_glyphs, composite_bytes )
+		&& write_block( fp, font->metrics.adv_width, n_glyphs * 6 * sizeof( uint16_t ) )
+		&& write_block( fp, font->hmetrics, n_glyphs * sizeof( LongHorzMetrics ) )
+		&& write_block( fp, cmap.pairs, cmap.count * 2 * sizeof( cmap.pairs[0] ) )
+		&& ( !h.num_kern_pairs || write_block( fp, font->kerning.first, kern_block_size( n_glyphs, h.num_kern_pairs ) ) )
+		&& ( !h.num_subst_nodes || write_block( fp, font->subst.nodes, subst_block_size( h.num_subst_nodes, h.num_subst_edges ) ) );
+	
+	free( cmap.pairs );
+	
+	if ( fclose( fp ) != 0 )
+		ok = 0;
+	
+	return ok ? F_SUCCESS : F_FAIL_WRITE;
+}
+
+/* Allocates and reads size bytes. *out stays NULL if size is 0 */
+static FontStatus read_block( FILE *fp, void *out_p, size_t size )
+{
+	void **out = out_p;
+	
+	*out = NULL;
+	if ( !size )
+		return F_SUCCESS;
+	
+	*out = malloc( size );
+	if ( !*out )
+		return F_FAIL_ALLOC;
+	
+	if ( fread( *out, size, 1, fp ) != 1 )
+		return F_FAIL_EOF;
+	
+	return F_SUCCESS;
+}
+
+/* Composite glyphs can contain other composite glyphs, but not this deep or in a loop */
+#define MAX_COMPOSITE_DEPTH 16
+
+/* The parts of a composite glyph must be glyphs of the font and their records must be inside all_glyphs
+state[] is 0 for glyphs that haven't been checked, 1 while checking and 2 when done. Returns 0 if the glyph is corrupt */
+static int check_composite( Font const *font, size_t composite_bytes, GlyphIndex g, uint8_t state[], int depth )
+{
+	GlyphDesc const *d = font->glyph_desc + g;
+	void *com;
+	size_t k;
+	
+	if ( IS_SIMPLE_GLYPH( d ) || state[g] == 2 )
+		return 1;
+	if ( state[g] == 1 || depth > MAX_COMPOSITE_DEPTH )
+		return 0;
+	if ( (size_t) d->first_index + COMPOSITE_GLYPH_SIZE( d->num_parts ) > composite_bytes )
+		return 0;
+	
+	com = GET_COMPOSITE_GLYPH( font, d );
+	if ( GET_SUBGLYPH_COUNT( com ) != d->num_parts )
+		return 0;
+	
+	state[g] = 1;
+	for( k=0; k<d->num_parts; k++ ) {
+		GlyphIndex part = GET_SUBGLYPH_INDEX( com, k );
+		if ( part >= font->num_glyphs || !check_composite( font, composite_bytes, part, state, depth + 1 ) )
+			return 0;
+	}
+	state[g] = 2;
+	return 1;
+}
+
+/* Every glyph index in the kerning pairs must be a glyph of the font and the pairs of each glyph must be in order */
+static int check_kerning( KernPairs const *k, size_t n_glyphs )
+{
+	size_t n;
+	
+	if ( k->first[0] != 0 || k->first[n_glyphs] != k->num_pairs )
+		return 0;
+	for( n=0; n<n_glyphs; n++ ) {
+		if ( k->first[n] > k->first[n+1] )
+			return 0;
+	}
+	for( n=0; n<k->num_pairs; n++ ) {
+		if ( k->right[n] >= n_glyphs )
+			return 0;
+	}
+	
+	return 1;
+}
+
+/* Outputs and edge keys must be glyphs of the font and edges must point to nodes of the trie */
+static int check_subst( GlyphSubst const *s, size_t n_glyphs )
+{
+	size_t n;
+	
+	for( n=0; n<s->num_nodes; n++ ) {
+		SubstNode const *node = s->nodes + n;
+		if ( node->output >= n_glyphs || (size_t) node->first_edge + node->num_edges > s->num_edges )
+			return 0;
+	}
+	for( n=0; n<s->num_edges; n++ ) {
+		if ( s->edge_glyph[n] >= n_glyphs || s->edge_node[n] >= s->num_nodes )
+			return 0;
+	}
+	
+	return 1;
+}
+
+static FontStatus read_cache( FILE *fp, Font font[1] )
+{
+	CacheHeader h;
+	uint32_t *cmap = NULL;
+	size_t n, n_glyphs;
+	FontStatus status;
+	
+	if ( fread( &h, sizeof( h ), 1, fp ) != 1 )
+		return F_FAIL_EOF;
+	if ( h.magic != CACHE_MAGIC )
+		return F_FAIL_UNK_FILEF;
+	if ( h.version != CACHE_VERSION || h.byte_order != CACHE_BYTE_ORDER || h.type_sizes != TYPE_SIZES )
+		return F_FAIL_UNSUP_VER;
+	if ( h.vertex_layout > VERTEX_FLOAT || ( h.num_subst_nodes && h.num_subst_nodes < h.num_glyphs ) )
+		return F_FAIL_CORRUPT;
+	if ( h.coord_shift > ( h.vertex_layout == VERTEX_PACKED ? MAX_COORD_SHIFT : 0 ) )
+		return F_FAIL_CORRUPT;
+	
+	n_glyphs = h.num_glyphs;
+	font->num_glyphs = n_glyphs;
+	font->units_per_em = h.units_per_em;
+	font->vertex_layout = h.vertex_layout;
+	font->coord_shift = h.coord_shift;
+	font->total_points = h.total_points;
+	font->total_indices = h.total_indices;
+	font->horz_ascender = h.horz_ascender;
+	font->horz_descender = h.horz_descender;
+	font->horz_linegap = h.horz_linegap;
+	font->use_kerning = 1;
+	font->use_subst = 1;
+	
+	if ( ( status = read_block( fp, &font->glyph_desc, n_glyphs * sizeof( GlyphDesc ) ) ) != F_SUCCESS
+	|| ( status = read_block( fp, &font->all_vertices, h.total_points * VERTEX_SIZE( font->vertex_layout ) ) ) != F_SUCCESS
+	|| ( status = read_block( fp, &font->all_indices, h.total_indices * sizeof( PointIndex ) ) ) != F_SUCCESS
+	|| ( status = read_block( fp, &font->all_glyphs, h.composite_bytes ) ) != F_SUCCESS )
+		return status;
+	
+	/* Geometry ranges must be inside the arrays and indices must point to the glyph's own points since they end up in draw calls */
+	for( n=0; n<n_glyphs; n++ )
+	{
+		GlyphDesc const *d = font->glyph_desc + n;
+		size_t k, num_indices = (size_t) d->num_indices_curve + d->num_indices_solid;
+		
+		if ( d->num_parts )
+			continue;
+		if ( (size_t) d->first_vertex + d->num_points > h.total_points || (size_t) d->first_index + num_indices > h.total_indices )
+			return F_FAIL_CORRUPT;
+		for( k=0; k<num_indices; k++ ) {
+			if ( font->all_indices[ d->first_index + k ] >= d->num_points )
+				return F_FAIL_CORRUPT;
+		}
+	}
+	
+	if ( n_glyphs )
+	{
+		uint8_t *state = calloc( n_glyphs, 1 );
+		int ok = 1;
+		
+		if ( !state )
+			return F_FAIL_ALLOC;
+		for( n=0; ok && n<n_glyphs; n++ )
+			ok = check_composite( font, h.composite_bytes, n, state, 0 );
+		free( state );
+		
+		if ( !ok )
+			return F_FAIL_CORRUPT;
+	}
+	
+	if ( !init_glyph_metrics( font ) )
+		return F_FAIL_ALLOC;
+	if ( n_glyphs && fread( font->metrics.adv_width, n_glyphs * 6 * sizeof( uint16_t ), 1, fp ) != 1 )
+		return F_FAIL_EOF;
+	
+	if ( ( status = read_block( fp, &font->hmetrics, n_glyphs * sizeof( LongHorzMetrics ) ) ) != F_SUCCESS )
+		return status;
+	
+	/* The cmap goes back into a NibTree */
+	if ( ( status = read_block( fp, &cmap, h.num_cmap * 2 * sizeof( cmap[0] ) ) ) != F_SUCCESS ) {
+		if ( cmap ) free( cmap );
+		return status;
+	}
+	for( n=0; n<h.num_cmap; n++ ) {
+		if ( cmap[2*n+1] >= n_glyphs ) {
+			free( cmap );
+			return F_FAIL_CORRUPT;
+		}
+		if ( !set_cmap_entry( font, cmap[2*n], cmap[2*n+1] ) ) {
+			free( cmap );
+			return F_FAIL_ALLOC;
+		}
+	}
+	if ( cmap ) free( cmap );
+	
+	if ( !build_cmap_coverage( font ) )
+		return F_FAIL_ALLOC;
+	
+	if ( h.num_kern_pairs )
+	{
+		KernPairs *k = &font->kerning;
+		if ( ( status = read_block( fp, &k->first, kern_block_size( n_glyphs, h.num_kern_pairs ) ) ) != F_SUCCESS )
+			return status;
+		k->right = (uint16_t*)( k->first + n_glyphs + 1 );
+		k->value = (int16_t*)( k->right + h.num_kern_pairs );
+		k->num_pairs = h.num_kern_pairs;
+		if ( !check_kerning( k, n_glyphs ) )
+			return F_FAIL_CORRUPT;
+	}
+	
+	if ( h.num_subst_nodes )
+	{
+		GlyphSubst *s = &font->subst;
+		if ( ( status = read_block( fp, &s->nodes, subst_block_size( h.num_subst_nodes, h.num_subst_edges ) ) ) != F_SUCCESS )
+			return status;
+		s->edge_glyph = (GlyphIndex*)( s->nodes + h.num_subst_nodes );
+		s->edge_node = s->edge_glyph + h.num_subst_edges;
+		s->num_nodes = h.num_subst_nodes;
+		s->num_edges = h.num_subst_edges;
+		s->num_ligatures = h.num_ligatures;
+		if ( !check_subst( s, n_glyphs ) )
+			return F_FAIL_CORRUPT;
+	}
+	
+	return F_SUCCESS;
+}
+
+FontStatus load_font_cache( Font *font, const char filename[] )
+{
+	FILE *fp;
+	FontStatus status;
+	
+	memset( font, 0, sizeof(*font) );
+	fp = fopen( filename, "rb" );
+	
+	if ( !fp )
+		return F_FAIL_OPEN;
+	
+	status = read_cache( fp, font );
+	
+	fclose( fp );
+	return status;
+}
@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <string.h>
+#include "opengl.h"
+#include "gpufont_data.h"
+#include "gpufont_draw.h"
+#include "gpufont_layout.h"
+#include "gpufont_font_stack.h"
+#include "utf_decode.h"
+#include "kerning.h"
+#include "substitution.h"
+#include "coverage.h"
+#include "layout_internal.h"
+
+/* The stack keeps its own copy of the BMP coverage of its fonts. Code points above it are looked up from the bitmaps of each font */
+#define COVERAGE_LIMIT 0x10000
+#define COVERAGE_WORDS ( COVERAGE_LIMIT / 32 )
+
+/* How many code points of UTF-8 text are decoded at a time */
+#define DECODE_CHUNK 256
+
+struct FontStack {
+	size_t num_fonts;
+	Font *fonts[MAX_STACK_FONTS];
+	GlyphIndex glyph_base[MAX_STACK_FONTS + 1]; /* glyph g of font f is glyph_base[f] + g in the batches of a layout */
+	double scale[MAX_STACK_FONTS]; /* converts units of font f to units of the primary font */
+	uint32_t *coverage; /* COVERAGE_WORDS * num_fonts words. The words of all fonts for the same 32 code points are next to each other */
+};
+
+FontStack *create_font_stack( Font *const fonts[], size_t num_fonts )
+{
+	FontStack *s;
+	size_t f, w;
+	
+	if ( !num_fonts || num_fonts > MAX_STACK_FONTS )
+		return NULL;
+	
+	s = malloc( sizeof( *s ) );
+	if ( !s )
+		return NULL;
+	
+	s->coverage = calloc( COVERAGE_WORDS * num_fonts, sizeof( s->coverage[0] ) );
+	if ( !s->coverage ) {
+		free( s );
+		return NULL;
+	}
+	
+	s->num_fonts = num_fonts;
+	s->glyph_base[0] = 0;
+	for( f=0; f<num_fonts; f++ )
+	{
+		Font *font = fonts[f];
+		uint32_t const *bmp = font->coverage.plane[0];
+		
+		s->fonts[f] = font;
+		s->glyph_base[f+1] = s->glyph_base[f] + font->num_glyphs;
+		s->scale[f] = (double) fonts[0]->units_per_em / font->units_per_em;
+		
+		for( w=0; bmp && w<COVERAGE_WORDS; w++ )
+			s->coverage[ w * num_fonts + f ] = bmp[w];
+	}
+	
+	return s;
+}
+
+void delete_font_stack( FontStack *s )
+{
+	if ( s ) {
+		free( s->coverage );
+		free( s );
+	}
+}
+
+size_t font_stack_size( FontStack const *s ) {
+	return s->num_fonts;
+}
+
+Font *font_stack_font( FontStack const *s, size_t n ) {
+	return s->fonts[n];
+}
+
+size_t font_stack_lookup( FontStack const *s, uint32_t code, uint32_t *glyph )
+{
+	size_t f;
+	
+	if ( code < COVERAGE_LIMIT )
+	{
+		uint32_t const *cov = s->coverage + ( code >> 5 ) * s->num_fonts;
+		for( f=0; f<s->num_fonts; f++ ) {
+			if ( cov[f] >> ( code & 31 ) & 1 ) {
+				*glyph = get_cmap_entry( s->fonts[f], code );
+				return f;
+			}
+		}
+	}
+	else
+	{
+		for( f=0; f<s->num_fonts; f++ ) {
+			if ( COVERAGE_HAS( &s->fonts[f]->coverage, code ) ) {
+				*glyph = get_cmap_entry( s->fonts[f], code );
+				return f;
+			}
+		}
+	}
+	
+	*glyph = 0;
+	return 0;
+}
+
+/* Converts a length in units of font f to units of the primary font */
+static int32_t to_primary_units( FontStack const *s, size_t f, int32_t x )
+{
+	double y;
+	if ( !f )
+		return x;
+	y = x * s->scale[f];
+	return (int32_t)( y < 0 ? y - 0.5 : y + 0.5 );
+}
+
+/* Same as init_glyph_positions but resolves characters through the stack. The glyph of each TempChar and cur->prev_glyph are offset by the glyph_base of their font
+A ligature only uses the code points that follow it as long as the same font draws them. If end_of_text is 0, stops before a ligature that could continue past text_len
+*used is set to the number of code points that were positioned */
+static size_t position_stack_glyphs( FontStack *s, TempChar chars[], uint32_t const text[], size_t text_len, int max_line_len, int end_of_text, LayoutCursor *cursor, size_t *used_out )
+{
+	LayoutCursor c = *cursor, *cur = &c; /* chars[] could alias *cursor as far as the compiler knows */
+	size_t n = 0, num_out = 0;
+	
+	while( n < text_len )
+	{
+		uint32_t cha = text[n];
+		size_t used = 1, f;
+		GlyphIndex glyph, prev = 0;
+		Font *font;
+		int32_t kerning = 0;
+		
+		if ( cha == '\n' ) {
+			cursor_newline( cur );
+			cur->text_pos++;
+			n++;
+			continue;
+		}
+		
+		f = font_stack_lookup( s, cha, &glyph );
+		font = s->fonts[f];
+		
+		if ( font->use_subst && font->subst.nodes ) {
+			SubstNode const *subst = font->subst.nodes;
+			if ( subst[glyph].num_edges ) {
+				GlyphIndex first = glyph;
+				size_t run = n + 1;
+				uint32_t other;
+				
+				glyph = substitute_glyph( font, first, text + n + 1, text_len - n - 1, end_of_text, &used );
+				if ( !used )
+					break;
+				
+				/* Most ligatures only use characters of this font. Otherwise match again up to the first character that another font draws
+				A shorter match can't be longer than this one, so only the code points that this one used need to be looked up */
+				while( run < n + used && font_stack_lookup( s, text[run], &other ) == f )
+					run++;
+				if ( run < n + used )
+					glyph = substitute_glyph( font, first, text + n + 1, run - n - 1, 1, &used );
+			} else {
+				glyph = subst[glyph].output;
+			}
+		}
+		
+		/* Kerning only applies if the previous glyph is from the same font */
+		if ( cur->prev_glyph >= s->glyph_base[f] && cur->prev_glyph < s->glyph_base[f+1] )
+			prev = cur->prev_glyph - s->glyph_base[f];
+		if ( prev )
+			kerning = to_primary_units( s, f, kerning_after( font, prev, glyph ) );
+		
+		place_glyph( cur, chars + num_out++, s->glyph_base[f] + glyph, kerning,
+			to_primary_units( s, f, font->metrics.lsb[ glyph ] ), to_primary_units( s, f, font->metrics.adv_width[ glyph ] ), max_line_len );
+		cur->text_pos += used;
+		n += used;
+	}
+	
+	*cursor = c;
+	*used_out = n;
+	return num_out;
+}
+
+/* Finds the font of a batch from its glyph index */
+static size_t batch_font( FontStack const *s, GlyphIndex g )
+{
+	size_t f = s->num_fonts - 1;
+	while( g < s->glyph_base[f] )
+		f--;
+	return f;
+}
+
+/* text_len is given in code units. UTF-8 is decoded in chunks */
+static GlyphBuffer *do_stack_layout( FontStack *s, void const *text, size_t text_len, TextEncoding enc, int max_line_len, float line_height_scale, size_t *num_errors )
+{
+	GlyphBuffer *b = NULL;
+	TempChar *chars = NULL;
+	GlyphCoord *positions = NULL;
+	LayoutCursor cur = {0};
+	LayoutSpan span;
+	size_t n, first, used;
+	
+	if ( !text_len )
+		return &THE_EMPTY_BUFFER;
+	
+	/* There can't be more glyphs than code units */
+	b = calloc( 1, sizeof(*b) );
+	chars = malloc( text_len * sizeof(*chars) );
+	positions = malloc( text_len * sizeof(*positions) * 2 );
+	if ( !b || !chars || !positions )
+		goto error_handler;
+	
+	memset( &span, 0, sizeof( span ) );
+	if ( enc == TEXT_UTF32 ) {
+		span.num_chars = position_stack_glyphs( s, chars, text, text_len, max_line_len, 1, &cur, &used );
+	} else {
+		/* Code points that may begin a ligature are moved to the front of the buffer and positioned with the next chunk */
+		uint32_t buf[DECODE_CHUNK + MAX_LIGATURE_LEN];
+		size_t in_pos = 0, errors = 0, kept = 0;
+		while( in_pos < text_len ) {
+			size_t k = kept + decode_utf8( buf + kept, DECODE_CHUNK, (uint8_t const*) text + in_pos, text_len - in_pos, &used, &errors );
+			in_pos += used;
+			span.num_chars += position_stack_glyphs( s, chars + span.num_chars, buf, k, max_line_len, in_pos == text_len, &cur, &used );
+			kept = k - used;
+			memmove( buf, buf + used, kept * sizeof( buf[0] ) );
+		}
+		if ( num_errors )
+			*num_errors += errors;
+	}
+	
+	/* Batches come in descending glyph order, so the batches of each font are next to each other */
+	b->positions = positions;
+	if ( !batch_glyphs( s->fonts[0], chars, &span, 1, line_height_scale, b, NULL ) )
+		goto error_handler;
+	
+	/* Positions were computed in units of the primary font. Each font draws in its own units */
+	for( n=first=0; n<b->batch_count; n++ )
+	{
+		size_t f = batch_font( s, b->glyph_indices[n] ), k;
+		if ( s->fonts[f]->units_per_em != s->fonts[0]->units_per_em ) {
+			GlyphCoord r = 1.0 / s->scale[f];
+			for( k=2*first; k<2*( first + b->batch_len[n] ); k++ )
+				positions[k] *= r;
+		}
+		first += b->batch_len[n];
+	}
+	
+	glGenBuffers( 1, &b->positions_vbo );
+	glBindBuffer( GL_ARRAY_BUFFER, b->positions_vbo );
+	glBufferData( GL_ARRAY_BUFFER, b->total_glyphs * 2 * sizeof( positions[0] ), positions, GL_STATIC_DRAW );
+	
+	free( chars );
+	free( positions );
+	b->positions = NULL;
+	return b;
+	
+error_handler:;
+	if ( b ) {
+		if ( b->glyph_indices ) free( b->glyph_indices );
+		free( b );
+	}
+	if ( chars ) free( chars );
+	if ( positions ) free( positions );
+	return NULL;
+}
+
+GlyphBuffer *do_font_stack_layout( FontStack *s, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale ) {
+	return do_stack_layout( s, text, text_len, TEXT_UTF32, max_line_len, line_height_scale, NULL );
+}
+
+GlyphBuffer *do_font_stack_layout_utf8( FontStack *s, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, size_t *num_errors ) {
+	return do_stack_layout( s, text, num_bytes, TEXT_UTF8, max_line_len, line_height_scale, num_errors );
+}
+
+void draw_font_stack_buffer( FontStack *s, GlyphBuffer *buf, float global_transform[16], int draw_flags )
+{
+	size_t b, f = s->num_fonts, first = 0;
+	
+	for( b=0; b<buf->batch_count; b++ )
+	{
+		GlyphIndex g = buf->glyph_indices[b];
+		
+		if ( f == s->num_fonts || g < s->glyph_base[f] ) {
+			f = batch_font( s, g );
+			begin_text( s->fonts[f] );
+		}
+		
+		bind_glyph_positions( buf->positions_vbo, first );
+		draw_glyphs( s->fonts[f], global_transform, g - s->glyph_base[f], buf->batch_len[b], draw_flags );
+		first += buf->batch_len[b];
+	}
+}
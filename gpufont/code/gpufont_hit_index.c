@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "gpufont_data.h"
+#include "gpufont_layout.h"
+#include "utf_decode.h"
+#include "layout_internal.h"
+
+/* A glyph in text order */
+typedef struct {
+	size_t text_begin, text_end;
+	size_t slot; /* instance in the position VBO */
+	int32_t line;
+	int32_t x0, x1;
+} HitChar;
+
+struct HitIndex {
+	size_t num_chars;
+	HitChar *chars;
+	size_t num_rows;
+	size_t *row_first; /* glyphs of row r are chars[ row_first[r] .. row_first[r+1]-1 ] */
+	size_t *by_x; /* the same glyphs sorted by x0 within each row */
+	size_t *row_text; /* where the text of each row begins, for rows without glyphs */
+	size_t *batch_first; /* batch_count + 1 elements */
+	size_t batch_count;
+	long line_height; /* see get_line_height */
+	int32_t ascender, descender;
+};
+
+void delete_hit_index( HitIndex *h )
+{
+	if ( h ) {
+		free( h->chars );
+		free( h->row_first );
+		free( h );
+	}
+}
+
+/* How many code points TextScan decodes at a time */
+#define SCAN_CHUNK 256
+
+/* Walks the code points of the text and their code unit offsets */
+typedef struct {
+	void const *text;
+	size_t text_len;
+	TextEncoding enc;
+	size_t in_pos; /* code units decoded so far */
+	size_t pos; /* offset of buf[next] */
+	size_t num, next;
+	uint32_t buf[SCAN_CHUNK];
+} TextScan;
+
+/* Returns the next code point and its offset in *begin. Must not be called past the end of the text */
+static uint32_t scan_code_point( TextScan *s, size_t *begin )
+{
+	uint32_t c;
+	size_t len = 1;
+	
+	if ( s->next == s->num )
+	{
+		size_t used = 0, errors = 0;
+		
+		if ( s->enc == TEXT_UTF8 )
+			s->num = decode_utf8( s->buf, SCAN_CHUNK, (uint8_t const*) s->text + s->in_pos, s->text_len - s->in_pos, &used, &errors );
+		else if ( s->enc == TEXT_UTF16 )
+			s->num = decode_utf16( s->buf, SCAN_CHUNK, (uint16_t const*) s->text + s->in_pos, s->text_len - s->in_pos, &used, &errors );
+		else
+			s->num = used = s->text_len - s->in_pos < SCAN_CHUNK ? s->text_len - s->in_pos : SCAN_CHUNK;
+		
+		if ( s->enc == TEXT_UTF32 )
+			memcpy( s->buf, (uint32_t const*) s->text + s->in_pos, s->num * sizeof( s->buf[0] ) );
+		s->in_pos += used;
+		s->next = 0;
+	}
+	
+	c = s->buf[ s->next++ ];
+	
+	/* The decoders reject overlong forms, so the length follows from the code point. Except for U+FFFD, which may stand for a malformed sequence */
+	if ( s->enc == TEXT_UTF8 ) {
+		if ( c == UTF_REPLACEMENT_CHAR ) {
+			size_t errors = 0;
+			uint32_t tmp;
+			decode_utf8( &tmp, 1, (uint8_t const*) s->text + s->pos, s->text_len - s->pos, &len, &errors );
+		} else {
+			len = 1 + ( c >= 0x80 ) + ( c >= 0x800 ) + ( c >= 0x10000 );
+		}
+	} else if ( s->enc == TEXT_UTF16 ) {
+		len = 1 + ( c >= 0x10000 );
+	}
+	
+	*begin = s->pos;
+	s->pos += len;
+	return c;
+}
+
+/* Batches are in descending glyph order */
+static size_t find_batch( GlyphBuffer const *b, GlyphIndex g )
+{
+	size_t lo = 0, hi = b->batch_count - 1;
+	while( lo < hi ) {
+		size_t mid = lo + ( hi - lo ) / 2;
+		if ( b->glyph_indices[mid] > g )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Rows that begin between two glyphs. row is the row of the earlier glyph (or 0 before the first glyph) and next_row the row of the later one (or the last row after the last glyph)
+Each newline in between begins a row. If the earlier glyph wrapped, the row after it begins where the glyph ends and the newlines come after that
+newline_end[] are the offsets after the newlines. Returns 0 if the rows don't add up */
+static int add_empty_rows( HitIndex *h, int32_t row, int32_t next_row, size_t glyph_end, size_t const newline_end[], size_t num_newlines )
+{
+	int32_t wrap = next_row - row - (int32_t) num_newlines;
+	size_t n;
+	
+	if ( wrap < 0 || wrap > 1 )
+		return 0;
+	if ( wrap )
+		h->row_text[ row + 1 ] = glyph_end;
+	for( n=0; n<num_newlines; n++ )
+		h->row_text[ row + wrap + 1 + n ] = newline_end[n];
+	
+	return 1;
+}
+
+/* Finds the characters of each glyph from the code point positions that the layout recorded in chars[]
+Everything between two glyphs that isn't part of the earlier one is newlines. Returns 0 if the glyphs don't match the text */
+static int find_char_ranges( Font *font, HitIndex *h, TextScan *scan, TempChar const chars[], size_t *newline_end )
+{
+	size_t k, num_newlines = 0, glyph_end = 0;
+	uint32_t cp = 0; /* index of the next code point of the scan */
+	int32_t row = 0;
+	
+	h->row_text[0] = 0;
+	for( k=0; k<=h->num_chars; k++ )
+	{
+		/* After the last glyph the scan goes on to the end of the text */
+		int last = ( k == h->num_chars );
+		int32_t next_row = last ? (int32_t) h->num_rows - 1 : chars[k].line_num;
+		size_t begin;
+		
+		if ( next_row < row || next_row >= (int32_t) h->num_rows )
+			return 0;
+		
+		/* Code points after the previous glyph. Its ligature ends at the first newline */
+		while( last ? scan->pos < scan->text_len : cp != chars[k].text_pos )
+		{
+			if ( scan->pos >= scan->text_len || (size_t) next_row - row < num_newlines )
+				return 0;
+			if ( scan_code_point( scan, &begin ) == '\n' )
+				newline_end[ num_newlines++ ] = scan->pos;
+			else if ( num_newlines || !k )
+				return 0;
+			else
+				glyph_end = scan->pos;
+			cp++;
+		}
+		
+		if ( !add_empty_rows( h, row, next_row, glyph_end, newline_end, num_newlines ) )
+			return 0;
+		if ( last )
+			break;
+		
+		/* The first code point of this glyph */
+		if ( scan->pos >= scan->text_len )
+			return 0;
+		scan_code_point( scan, &begin );
+		cp++;
+		
+		if ( k )
+			h->chars[k-1].text_end = glyph_end;
+		h->chars[k].text_begin = begin;
+		h->chars[k].line = next_row;
+		h->chars[k].x0 = chars[k].pos_x + font->metrics.lsb[ chars[k].glyph ];
+		h->chars[k].x1 = h->chars[k].x0 + font->metrics.adv_width[ chars[k].glyph ];
+		
+		row = next_row;
+		glyph_end = scan->pos;
+		num_newlines = 0;
+	}
+	
+	if ( h->num_chars )
+		h->chars[ h->num_chars - 1 ].text_end = glyph_end;
+	return 1;
+}
+
+int build_hit_index( struct Font *font, GlyphBuffer *b, void const *text, size_t text_len, TextEncoding enc, TempChar const chars[], size_t num_lines, float line_height_scale, size_t const moved_to[] )
+{
+	HitIndex *h = calloc( 1, sizeof( *h ) );
+	TextScan *scan = malloc( sizeof( *scan ) );
+	size_t *next, *newline_end, n, r;
+	int ok = 0;
+	
+	if ( !h || !scan || !num_lines )
+		goto done;
+	
+	h->num_chars = b->total_glyphs;
+	h->num_rows = num_lines;
+	h->batch_count = b->batch_count;
+	h->line_height = get_line_height( font, line_height_scale );
+	h->ascender = font->horz_ascender;
+	h->descender = font->horz_descender;
+	
+	/* One block for the arrays of rows and batches and the newlines between two glyphs (at most one per row) */
+	h->chars = malloc( h->num_chars * sizeof( h->chars[0] ) + 1 );
+	h->row_first = malloc( ( 3 * ( num_lines + 1 ) + h->num_chars + 2 * b->batch_count + 1 ) * sizeof( size_t ) );
+	if ( !h->chars || !h->row_first )
+		goto done;
+	h->row_text = h->row_first + num_lines + 1;
+	newline_end = h->row_text + num_lines + 1;
+	h->by_x = newline_end + num_lines + 1;
+	h->batch_first = h->by_x + h->num_chars;
+	next = h->batch_first + b->batch_count + 1;
+	
+	scan->text = text;
+	scan->text_len = text_len;
+	scan->enc = enc;
+	scan->in_pos = scan->pos = 0;
+	scan->num = scan->next = 0;
+	if ( !find_char_ranges( font, h, scan, chars, newline_end ) )
+		goto done;
+	
+	/* Instances of a batch are in text order unless they were moved by tiling */
+	h->batch_first[0] = 0;
+	for( n=0; n<b->batch_count; n++ ) {
+		next[n] = h->batch_first[n];
+		h->batch_first[n+1] = h->batch_first[n] + b->batch_len[n];
+	}
+	for( n=0; n<h->num_chars; n++ ) {
+		size_t slot = next[ find_batch( b, chars[n].glyph ) ]++;
+		h->chars[n].slot = moved_to ? moved_to[slot] : slot;
+	}
+	
+	/* Rows are in text order. x0 goes up within a row except where kerning moves a glyph behind the previous one */
+	memset( h->row_first, 0, ( h->num_rows + 1 ) * sizeof( h->row_first[0] ) );
+	for( n=0; n<h->num_chars; n++ )
+		h->row_first[ h->chars[n].line + 1 ]++;
+	for( r=0; r<h->num_rows; r++ )
+		h->row_first[r+1] += h->row_first[r];
+	
+	for( n=0; n<h->num_chars; n++ )
+	{
+		size_t k = n, first = h->row_first[ h->chars[n].line ];
+		while( k > first && h->chars[ h->by_x[k-1] ].x0 > h->chars[n].x0 ) {
+			h->by_x[k] = h->by_x[k-1];
+			k--;
+		}
+		h->by_x[k] = n;
+	}
+	
+	ok = 1;
+
+done:;
+	if ( scan ) free( scan );
+	if ( ok )
+		b->hits = h;
+	else
+		delete_hit_index( h );
+	return ok;
+}
+
+static void fill_hit( HitIndex const *h, size_t k, GlyphHit *hit )
+{
+	HitChar const *c = h->chars + k;
+	size_t lo = 0, hi = h->batch_count - 1;
+	long base = c->line * h->line_height >> LINEH_PREC;
+	
+	while( lo < hi ) {
+		size_t mid = lo + ( hi - lo + 1 ) / 2;
+		if ( h->batch_first[mid] <= c->slot )
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	
+	hit->text_begin = c->text_begin;
+	hit->text_end = c->text_end;
+	hit->batch = lo;
+	hit->instance = c->slot - h->batch_first[lo];
+	hit->line = c->line;
+	hit->x0 = c->x0;
+	hit->x1 = c->x1;
+	hit->y0 = base + h->descender;
+	hit->y1 = base + h->ascender;
+}
+
+/* Row r reaches from its baseline + descender one line height towards the next row */
+static size_t row_at( HitIndex const *h, float y )
+{
+	double t, r;
+	
+	if ( !h->line_height )
+		return 0;
+	
+	t = ( y - h->descender ) / ( h->line_height / (double)( 1 << LINEH_PREC ) );
+	r = h->line_height > 0 ? floor( t ) : ceil( t );
+	return r <= 0 ? 0 : ( r >= h->num_rows ? h->num_rows - 1 : (size_t) r );
+}
+
+/* The glyph of row r that x falls on. The row must have glyphs */
+static size_t glyph_at( HitIndex const *h, size_t r, float x )
+{
+	size_t lo = h->row_first[r], hi = h->row_first[r+1] - 1;
+	
+	while( lo < hi ) {
+		size_t mid = lo + ( hi - lo + 1 ) / 2;
+		if ( h->chars[ h->by_x[mid] ].x0 <= x )
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	
+	return h->by_x[lo];
+}
+
+int hit_test_point( GlyphBuffer const *b, float x, float y, GlyphHit *hit )
+{
+	HitIndex const *h = b->hits;
+	size_t r;
+	
+	if ( !h || !h->num_chars )
+		return 0;
+	
+	r = row_at( h, y );
+	if ( h->row_first[r] == h->row_first[r+1] )
+		return 0;
+	
+	fill_hit( h, glyph_at( h, r, x ), hit );
+	return 1;
+}
+
+size_t caret_at_point( GlyphBuffer const *b, float x, float y )
+{
+	HitIndex const *h = b->hits;
+	HitChar const *c;
+	size_t r;
+	
+	if ( !h )
+		return 0;
+	
+	r = row_at( h, y );
+	if ( h->row_first[r] == h->row_first[r+1] )
+		return h->row_text[r];
+	
+	c = h->chars + glyph_at( h, r, x );
+	return 2 * x < c->x0 + c->x1 ? c->text_begin : c->text_end;
+}
+
+int hit_test_char( GlyphBuffer const *b, size_t text_pos, GlyphHit *hit )
+{
+	HitIndex const *h = b->hits;
+	size_t lo = 0, hi;
+	
+	if ( !h || !h->num_chars || text_pos < h->chars[0].text_begin )
+		return 0;
+	
+	hi = h->num_chars - 1;
+	while( lo < hi ) {
+		size_t mid = lo + ( hi - lo + 1 ) / 2;
+		if ( h->chars[mid].text_begin <= text_pos )
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	
+	if ( text_pos >= h->chars[lo].text_end )
+		return 0;
+	
+	fill_hit( h, lo, hit );
+	return 1;
+}
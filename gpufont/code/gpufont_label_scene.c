@@ -0,0 +1,305 @@
+#include <stdlib.h>
+#include <string.h>
+#include "opengl.h"
+#include "gpufont_data.h"
+#include "gpufont_draw.h"
+#include "gpufont_label_scene.h"
+#include "layout_internal.h"
+
+/* A glyph of some label. Its position already includes the position of the label */
+typedef struct {
+	GlyphIndex glyph;
+	size_t transform;
+	GlyphCoord x, y;
+	float color[4];
+} SceneGlyph;
+
+/* Glyphs that are drawn with one call. Their transforms are in the same group of MAX_INSTANCE_TRANSFORMS */
+typedef struct {
+	size_t group;
+	GlyphIndex glyph;
+	size_t count;
+} SceneRun;
+
+struct LabelScene {
+	Font *font;
+	long line_height; /* see get_line_height */
+	size_t num_labels;
+	SceneGlyph *glyphs;
+	size_t num_glyphs, glyphs_cap;
+	size_t num_transforms; /* largest transform index + 1 */
+	
+	/* Built from the glyphs by draw_label_scene. Scratch memory has room for glyphs_cap glyphs */
+	int sorted; /* runs and the VBO match the glyphs */
+	SceneRun *runs;
+	size_t num_runs;
+	GlyphCoord *positions;
+	InstanceStyle *styles;
+	size_t *order; /* 2 * glyphs_cap elements */
+	size_t *counts;
+	size_t counts_cap;
+	GLuint vbo; /* vbo_cap positions followed by vbo_cap styles */
+	size_t vbo_cap; /* in glyphs */
+	LabelSceneStats stats;
+};
+
+LabelScene *create_label_scene( struct Font *font, float line_height_scale )
+{
+	LabelScene *s = calloc( 1, sizeof( *s ) );
+	
+	if ( !s )
+		return NULL;
+	
+	s->font = font;
+	s->line_height = get_line_height( font, line_height_scale );
+	return s;
+}
+
+void delete_label_scene( LabelScene *s )
+{
+	if ( !s )
+		return;
+	
+	if ( s->vbo ) glDeleteBuffers( 1, &s->vbo );
+	if ( s->glyphs ) free( s->glyphs );
+	if ( s->runs ) free( s->runs );
+	if ( s->positions ) free( s->positions );
+	if ( s->styles ) free( s->styles );
+	if ( s->order ) free( s->order );
+	if ( s->counts ) free( s->counts );
+	free( s );
+}
+
+void clear_label_scene( LabelScene *s )
+{
+	s->num_labels = 0;
+	s->num_glyphs = 0;
+	s->num_transforms = 0;
+	s->sorted = 0;
+}
+
+/* Grows the glyph array and the scratch memory that draw_label_scene needs for that many glyphs */
+static int reserve_glyphs( LabelScene *s, size_t count )
+{
+	size_t cap = s->glyphs_cap;
+	void *p;
+	
+	if ( count <= cap )
+		return 1;
+	
+	while( cap < count )
+		cap = cap ? cap * 2 : 4096;
+	
+	if ( !( p = realloc( s->glyphs, cap * sizeof( s->glyphs[0] ) ) ) )
+		return 0;
+	s->glyphs = p;
+	if ( !( p = realloc( s->runs, cap * sizeof( s->runs[0] ) ) ) )
+		return 0;
+	s->runs = p;
+	if ( !( p = realloc( s->positions, cap * 2 * sizeof( s->positions[0] ) ) ) )
+		return 0;
+	s->positions = p;
+	if ( !( p = realloc( s->styles, cap * sizeof( s->styles[0] ) ) ) )
+		return 0;
+	s->styles = p;
+	if ( !( p = realloc( s->order, cap * 2 * sizeof( s->order[0] ) ) ) )
+		return 0;
+	s->order = p;
+	
+	s->glyphs_cap = cap;
+	return 1;
+}
+
+typedef struct {
+	LabelScene *scene;
+	float x, y;
+	float const *color;
+	size_t transform;
+	int failed;
+} LabelSink;
+
+static void add_label_glyphs( struct Font *font, void *p, TempChar const chars[], size_t num_chars )
+{
+	LabelSink *ls = p;
+	LabelScene *s = ls->scene;
+	size_t n;
+	
+	if ( ls->failed || !reserve_glyphs( s, s->num_glyphs + num_chars ) ) {
+		ls->failed = 1;
+		return;
+	}
+	
+	for( n=0; n<num_chars; n++ )
+	{
+		GlyphDesc const *desc = font->glyph_desc + chars[n].glyph;
+		SceneGlyph *g;
+		
+		/* Nothing to draw */
+		if ( IS_SIMPLE_GLYPH( desc ) && !desc->num_points )
+			continue;
+		
+		g = s->glyphs + s->num_glyphs++;
+		g->glyph = chars[n].glyph;
+		g->transform = ls->transform;
+		g->x = ls->x + chars[n].pos_x;
+		g->y = ls->y + ( chars[n].line_num * s->line_height >> LINEH_PREC );
+		memcpy( g->color, ls->color, sizeof( g->color ) );
+	}
+}
+
+static int add_label_internal( LabelScene *s, void const *text, size_t text_len, TextEncoding enc, float x, float y, float const color[4], size_t transform )
+{
+	LabelSink ls;
+	size_t old_glyphs = s->num_glyphs;
+	
+	ls.scene = s;
+	ls.x = x;
+	ls.y = y;
+	ls.color = color;
+	ls.transform = transform;
+	ls.failed = 0;
+	position_text_chunks( s->font, text, text_len, enc, -1, add_label_glyphs, &ls, NULL );
+	
+	if ( ls.failed ) {
+		s->num_glyphs = old_glyphs;
+		return 0;
+	}
+	
+	if ( transform >= s->num_transforms )
+		s->num_transforms = transform + 1;
+	s->num_labels++;
+	s->sorted = 0;
+	return 1;
+}
+
+int add_label( LabelScene *s, uint32_t const *text, size_t text_len, float x, float y, float const color[4], size_t transform ) {
+	return add_label_internal( s, text, text_len, TEXT_UTF32, x, y, color, transform );
+}
+
+int add_label_utf8( LabelScene *s, char const *text, size_t num_bytes, float x, float y, float const color[4], size_t transform ) {
+	return add_label_internal( s, text, num_bytes, TEXT_UTF8, x, y, color, transform );
+}
+
+static int reserve_counts( LabelScene *s, size_t count )
+{
+	size_t *p;
+	
+	if ( count <= s->counts_cap )
+		return 1;
+	
+	p = realloc( s->counts, count * sizeof( p[0] ) );
+	if ( !p )
+		return 0;
+	
+	s->counts = p;
+	s->counts_cap = count;
+	return 1;
+}
+
+/* Sorts the glyphs by glyph with a stable counting sort, and then by group of MAX_INSTANCE_TRANSFORMS transforms if there is more than one group
+Writes the positions and styles in that order and finds the runs */
+static int sort_glyphs( LabelScene *s )
+{
+	size_t *sorted = s->order, *c;
+	size_t n, num_glyphs = s->num_glyphs, range = s->font->num_glyphs;
+	size_t num_groups = ( s->num_transforms + MAX_INSTANCE_TRANSFORMS - 1 ) / MAX_INSTANCE_TRANSFORMS;
+	
+	if ( !reserve_counts( s, ( range > num_groups ? range : num_groups ) + 1 ) )
+		return 0;
+	c = s->counts;
+	
+	memset( c, 0, ( range + 1 ) * sizeof( c[0] ) );
+	for( n=0; n<num_glyphs; n++ )
+		c[ s->glyphs[n].glyph + 1 ]++;
+	for( n=0; n<range; n++ )
+		c[n+1] += c[n];
+	for( n=0; n<num_glyphs; n++ )
+		sorted[ c[ s->glyphs[n].glyph ]++ ] = n;
+	
+	if ( num_groups > 1 ) {
+		size_t *by_glyph = sorted;
+		sorted = s->order + s->glyphs_cap;
+		memset( c, 0, ( num_groups + 1 ) * sizeof( c[0] ) );
+		for( n=0; n<num_glyphs; n++ )
+			c[ s->glyphs[n].transform / MAX_INSTANCE_TRANSFORMS + 1 ]++;
+		for( n=0; n<num_groups; n++ )
+			c[n+1] += c[n];
+		for( n=0; n<num_glyphs; n++ )
+			sorted[ c[ s->glyphs[ by_glyph[n] ].transform / MAX_INSTANCE_TRANSFORMS ]++ ] = by_glyph[n];
+	}
+	
+	s->num_runs = 0;
+	for( n=0; n<num_glyphs; n++ )
+	{
+		SceneGlyph const *g = s->glyphs + sorted[n];
+		SceneRun *r = s->runs + s->num_runs - 1;
+		size_t group = g->transform / MAX_INSTANCE_TRANSFORMS;
+		
+		if ( !s->num_runs || r->group != group || r->glyph != g->glyph ) {
+			r++;
+			r->group = group;
+			r->glyph = g->glyph;
+			r->count = 0;
+			s->num_runs++;
+		}
+		r->count++;
+		
+		s->positions[2*n] = g->x;
+		s->positions[2*n+1] = g->y;
+		memcpy( s->styles[n].color, g->color, sizeof( g->color ) );
+		s->styles[n].transform = g->transform % MAX_INSTANCE_TRANSFORMS;
+	}
+	
+	return 1;
+}
+
+static void upload_positions( LabelScene *s )
+{
+	s->stats.buffer_reallocs += orphan_glyph_vbo( &s->vbo, &s->vbo_cap, s->num_glyphs, 2 * sizeof( GlyphCoord ) + sizeof( InstanceStyle ) );
+	if ( s->num_glyphs ) {
+		glBufferSubData( GL_ARRAY_BUFFER, 0, s->num_glyphs * 2 * sizeof( GlyphCoord ), s->positions );
+		glBufferSubData( GL_ARRAY_BUFFER, s->vbo_cap * 2 * sizeof( GlyphCoord ), s->num_glyphs * sizeof( InstanceStyle ), s->styles );
+	}
+}
+
+void draw_label_scene( LabelScene *s, float transforms[][16], int draw_flags )
+{
+	/* The transform of each instance comes from its style */
+	static float identity[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
+	size_t n, first = 0, group = (size_t) -1;
+	
+	if ( !s->sorted ) {
+		if ( !sort_glyphs( s ) )
+			return;
+		upload_positions( s );
+		s->sorted = 1;
+	}
+	
+	begin_instance_styles();
+	for( n=0; n<s->num_runs; n++ )
+	{
+		SceneRun const *r = s->runs + n;
+		
+		if ( r->group != group ) {
+			size_t first_transform = r->group * MAX_INSTANCE_TRANSFORMS, count = s->num_transforms - first_transform;
+			group = r->group;
+			set_instance_transforms( transforms + first_transform, count < MAX_INSTANCE_TRANSFORMS ? count : MAX_INSTANCE_TRANSFORMS );
+		}
+		
+		bind_glyph_positions( s->vbo, first );
+		bind_instance_styles( s->vbo, s->vbo_cap * 2 * sizeof( GlyphCoord ), first );
+		draw_glyphs( s->font, identity, r->glyph, r->count, draw_flags );
+		first += r->count;
+	}
+	end_instance_styles();
+	
+	s->stats.labels = s->num_labels;
+	s->stats.glyphs = s->num_glyphs;
+	s->stats.transforms = s->num_transforms;
+	s->stats.draw_calls = s->num_runs;
+	s->stats.frames++;
+}
+
+void get_label_scene_stats( LabelScene const *s, LabelSceneStats *stats ) {
+	*stats = s->stats;
+}
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stdint.h>
 #include <ctype.h>
@@ -6,21 +7,16 @@
 #include "gpufont_data.h"
 #include "gpufont_draw.h"
 #include "gpufont_layout.h"
+#include "utf_decode.h"
+#include "kerning.h"
+#include "substitution.h"
+#include "layout_internal.h"
 
-struct GlyphBuffer {
-	size_t batch_count; /* how many batches */
-	size_t total_glyphs;
-	GlyphCoord *positions; /* glyph position array */
-	GlyphIndex *glyph_indices; /* one glyph index per batch */
-	size_t *batch_len; /* length of each batch */
-	GLuint positions_vbo;
-};
+/* How many code points are decoded at a time into a stack buffer */
+#define DECODE_CHUNK 256
 
-typedef struct {
-	GlyphIndex glyph;
-	int32_t line_num;
-	int32_t pos_x;
-} TempChar;
+/* Glyph counters of batch_glyphs live on the stack if there are at most this many. Enough for short strings of latin text */
+#define SMALL_BUCKETS 512
 
 static void upload_positions( GlyphBuffer *buf, GLenum hint )
 {
@@ -29,170 +25,624 @@ static void upload_positions( GlyphBuffer *buf, GLenum hint )
 	glBufferData( GL_ARRAY_BUFFER, buf->total_glyphs * 2 * sizeof( buf->positions[0] ), buf->positions, hint );
 }
 
-static size_t init_glyph_positions( Font font[1], TempChar chars[], uint32_t const text[], size_t text_len, int max_line_len )
+long get_line_height( struct Font *font, float line_height_scale ) {
+	return ( ( font->horz_ascender - font->horz_descender + font->horz_linegap ) << LINEH_PREC ) * line_height_scale;
+}
+
+void cursor_newline( LayoutCursor *cur )
 {
-	int32_t pos_x = 0;
-	int32_t line = 0;
-	size_t n = 0;
-	int column = 0;
-	size_t num_out = 0;
+	cur->column = 0;
+	cur->pos_x = 0;
+	cur->line += 1;
+	cur->prev_glyph = 0;
+}
+
+int32_t kerning_after( Font const font[1], GlyphIndex prev, GlyphIndex glyph )
+{
+	KernPairs const *k = &font->kerning;
+	
+	if ( !prev || !font->use_kerning || !k->first || k->first[prev] == k->first[prev+1] )
+		return 0;
+	
+	return get_kerning( k, prev, glyph );
+}
+
+void place_glyph( LayoutCursor *cur, TempChar *out, GlyphIndex glyph, int32_t kerning, int32_t lsb, int32_t adv_width, int max_line_len )
+{
+	cur->pos_x += kerning;
+	
+	out->glyph = glyph;
+	out->pos_x = cur->pos_x - lsb;
+	out->line_num = cur->line;
+	out->text_pos = cur->text_pos;
 	
-	for( n=0; n<text_len; n++ )
+	if ( cur->column == max_line_len ) {
+		cursor_newline( cur );
+	} else {
+		cur->pos_x += adv_width;
+		cur->column++;
+		cur->prev_glyph = glyph;
+	}
+}
+
+/* Positions text[0..stop). Ligatures may use code points up to text_len. *end is set to where it stopped:
+before stop if a ligature could continue past text_len and more text follows, possibly after stop if a ligature ended there */
+static size_t position_glyphs( Font font[1], TempChar chars[], uint32_t const text[], size_t text_len, size_t stop, int max_line_len, int end_of_text, LayoutCursor *cur, size_t *end )
+{
+	LayoutCursor c = *cur; /* chars[] could alias *cur as far as the compiler knows */
+	SubstNode const *subst = font->use_subst ? font->subst.nodes : NULL;
+	size_t n = 0, num_out = 0;
+	
+	while( n < stop )
 	{
 		GlyphIndex glyph;
 		uint32_t cha = text[n];
-		int is_newline = 0;
-		int is_visible = 1;
-		
-		glyph = get_cmap_entry( font, cha );
-		chars[num_out].glyph = glyph;
-		chars[num_out].pos_x = pos_x - font->hmetrics[ glyph ].lsb;
-		chars[num_out].line_num = line;
+		size_t used = 1;
 		
 		if ( cha == '\n' ) {
-			is_newline = 1;
-			is_visible = 0;
-		} else if ( column == max_line_len ) {
-			is_newline = 1;
+			cursor_newline( &c );
+			c.text_pos++;
+			n++;
+			continue;
+		}
+		
+		glyph = get_cmap_entry( font, cha );
+		if ( subst ) {
+			if ( subst[glyph].num_edges ) {
+				glyph = substitute_glyph( font, glyph, text + n + 1, text_len - n - 1, end_of_text, &used );
+				if ( !used )
+					break;
+			} else {
+				glyph = subst[glyph].output;
+			}
 		}
 		
-		if ( is_newline ) {
-			column = 0;
-			pos_x = 0;
-			line += 1;
-		} else if ( is_visible ) {
-			pos_x += font->hmetrics[ glyph ].adv_width;
-			column++;
+		place_glyph( &c, chars + num_out++, glyph, kerning_after( font, c.prev_glyph, glyph ), font->metrics.lsb[ glyph ], font->metrics.adv_width[ glyph ], max_line_len );
+		c.text_pos += used;
+		n += used;
+	}
+	
+	cur->pos_x = c.pos_x;
+	cur->line = c.line;
+	cur->column = c.column;
+	cur->prev_glyph = c.prev_glyph;
+	cur->text_pos = c.text_pos;
+	*end = n;
+	return num_out;
+}
+
+size_t init_glyph_positions( Font font[1], TempChar chars[], uint32_t const text[], size_t text_len, int max_line_len, int end_of_text, LayoutCursor *cur )
+{
+	size_t num_out = 0, start = 0, end;
+	
+	if ( cur->num_pending )
+	{
+		/* Code points that were held back by the previous call come first. A ligature that begins with them ends within MAX_LIGATURE_LEN code points of the new text */
+		uint32_t tmp[2 * MAX_LIGATURE_LEN];
+		size_t p = cur->num_pending, m = text_len < MAX_LIGATURE_LEN ? text_len : MAX_LIGATURE_LEN;
+		
+		memcpy( tmp, cur->pending, p * sizeof( tmp[0] ) );
+		if ( m )
+			memcpy( tmp + p, text, m * sizeof( tmp[0] ) );
+		cur->num_pending = 0;
+		
+		num_out = position_glyphs( font, chars, tmp, p + m, p, max_line_len, end_of_text && m == text_len, cur, &end );
+		if ( end < p ) {
+			/* Still undecided. All of the new text is held back too */
+			assert( m == text_len );
+			cur->num_pending = p + m - end;
+			memcpy( cur->pending, tmp + end, cur->num_pending * sizeof( tmp[0] ) );
+			return num_out;
 		}
 		
-		num_out += is_visible;
+		start = end - p;
 	}
 	
+	num_out += position_glyphs( font, chars + num_out, text + start, text_len - start, text_len - start, max_line_len, end_of_text, cur, &end );
+	end += start;
+	
+	cur->num_pending = text_len - end;
+	if ( cur->num_pending )
+		memcpy( cur->pending, text + end, cur->num_pending * sizeof( text[0] ) );
+	
 	return num_out;
 }
 
-static int sort_func( const void *x, const void *y )
+/* Maps at most max_chars characters of the text to glyphs. UTF-8 and UTF-16 are decoded in chunks so that no UTF-32 copy of the whole text is ever made
+text_len is given in code units (bytes for UTF-8)
+Returns the number of visible characters written to chars[] */
+size_t map_text( Font font[1], TempChar chars[], void const *text, size_t text_len, TextEncoding enc, size_t max_chars, int max_line_len, LayoutCursor *cur, size_t *num_errors )
 {
-	TempChar const *a=x, *b=y;
-	if ( a->glyph > b->glyph )
-		return -1;
-	if ( a->glyph < b->glyph )
-		return 1;
-	return 0;
+	uint32_t buf[DECODE_CHUNK];
+	size_t in_pos = 0, num_chars = 0, num_out = 0;
+	size_t errors = 0;
+	
+	if ( enc == TEXT_UTF32 )
+		return init_glyph_positions( font, chars, text, text_len < max_chars ? text_len : max_chars, max_line_len, 1, cur );
+	
+	while( in_pos < text_len && num_chars < max_chars )
+	{
+		size_t room = max_chars - num_chars;
+		size_t used = 0, n;
+		
+		if ( room > DECODE_CHUNK )
+			room = DECODE_CHUNK;
+		
+		if ( enc == TEXT_UTF8 )
+			n = decode_utf8( buf, room, (uint8_t const*) text + in_pos, text_len - in_pos, &used, &errors );
+		else
+			n = decode_utf16( buf, room, (uint16_t const*) text + in_pos, text_len - in_pos, &used, &errors );
+		
+		in_pos += used;
+		num_chars += n;
+		num_out += init_glyph_positions( font, chars + num_out, buf, n, max_line_len, in_pos == text_len, cur );
+	}
+	
+	/* Code points that were held back for a ligature if the text was cut at max_chars */
+	if ( cur->num_pending )
+		num_out += init_glyph_positions( font, chars + num_out, buf, 0, max_line_len, 1, cur );
+	
+	if ( num_errors )
+		*num_errors += errors;
+	
+	return num_out;
+}
+
+size_t position_text_chunks( Font font[1], void const *text, size_t text_len, TextEncoding enc, int max_line_len, CharSink sink, void *state, size_t *num_errors )
+{
+	uint32_t buf[DECODE_CHUNK];
+	TempChar chars[DECODE_CHUNK + MAX_LIGATURE_LEN]; /* also the code points that were held back from the previous chunk */
+	LayoutCursor cur = {0};
+	size_t in_pos = 0, errors = 0;
+	
+	while( in_pos < text_len )
+	{
+		uint32_t const *code_points = buf;
+		size_t used, n;
+		
+		if ( enc == TEXT_UTF32 ) {
+			code_points = (uint32_t const*) text + in_pos;
+			n = used = text_len - in_pos < DECODE_CHUNK ? text_len - in_pos : DECODE_CHUNK;
+		} else if ( enc == TEXT_UTF8 ) {
+			n = decode_utf8( buf, DECODE_CHUNK, (uint8_t const*) text + in_pos, text_len - in_pos, &used, &errors );
+		} else {
+			n = decode_utf16( buf, DECODE_CHUNK, (uint16_t const*) text + in_pos, text_len - in_pos, &used, &errors );
+		}
+		
+		in_pos += used;
+		n = init_glyph_positions( font, chars, code_points, n, max_line_len, in_pos == text_len, &cur );
+		sink( font, state, chars, n );
+	}
+	
+	if ( num_errors )
+		*num_errors += errors;
+	
+	return cur.line + 1;
 }
 
-/* fields of 'output':
+/* Sorts glyphs into batches and writes their positions in batch order
+Spans are processed in parallel. Glyphs of each batch stay in text order so the result doesn't depend on how the text was split
+fields of 'output':
 "positions" MUST have been allocated to at least 2*text_len floats
 "glyph_indices" will be allocated if it hasn't been already
 "batch_len" will also be allocated if necessary, but "batch_len" must be NULL if "glyph_indices" is also NULL
 "glyph_indices" and "batch_len" must be in the same contiguous block of memory one after another
+If counters is not NULL it must have room for ( max_glyph - min_glyph + 1 ) * num_spans elements. Otherwise they are allocated if needed
 */
-static int do_simple_layout_internal( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, GlyphBuffer *output, TempChar *chars )
+int batch_glyphs( struct Font *font, TempChar const chars[], LayoutSpan spans[], size_t num_spans, float line_height_scale, GlyphBuffer *output, size_t *counters )
 {
-	const long LINEH_PREC = 10;
-	long line_height = ( ( font->horz_ascender - font->horz_descender + font->horz_linegap ) << LINEH_PREC ) * line_height_scale;
-	size_t n, num_batches, cur_batch, cur_batch_len;
-	GlyphIndex prev_glyph;
+	long line_height = get_line_height( font, line_height_scale );
+	size_t n, range, total = 0, num_batches, cur_batch, first;
+	size_t *buckets; /* per span: glyph count, later the next free slot of each glyph */
+	size_t stack_buckets[SMALL_BUCKETS];
+	GlyphIndex min_glyph = 0, max_glyph = 0, g;
+	int have_glyphs = 0;
 	
-	assert( text_len > 0 );
 	assert( output );
 	assert( output->positions );
 	assert( chars );
 	
-	/* Map character codes to glyph indices. Then compute x and y coordinates for each glyph */
-	text_len = init_glyph_positions( font, chars, text, text_len, max_line_len );
+	/* Find the range of used glyph indices */
+	#pragma omp parallel for if( num_spans > 1 )
+	for( n=0; n<num_spans; n++ )
+	{
+		TempChar const *c = chars + spans[n].first_char;
+		size_t k;
+		spans[n].min_glyph = spans[n].max_glyph = spans[n].num_chars ? c[0].glyph : 0;
+		for( k=1; k<spans[n].num_chars; k++ ) {
+			if ( c[k].glyph < spans[n].min_glyph ) spans[n].min_glyph = c[k].glyph;
+			if ( c[k].glyph > spans[n].max_glyph ) spans[n].max_glyph = c[k].glyph;
+		}
+	}
+	
+	for( n=0; n<num_spans; n++ )
+	{
+		if ( !spans[n].num_chars )
+			continue;
+		if ( !have_glyphs || spans[n].min_glyph < min_glyph ) min_glyph = spans[n].min_glyph;
+		if ( !have_glyphs || spans[n].max_glyph > max_glyph ) max_glyph = spans[n].max_glyph;
+		have_glyphs = 1;
+		total += spans[n].num_chars;
+	}
+	
+	/* Put same glyphs into the same batches with a counting sort over the range of used glyph indices */
+	range = max_glyph - min_glyph + 1;
+	if ( counters ) {
+		buckets = counters;
+		memset( buckets, 0, range * num_spans * sizeof( buckets[0] ) );
+	} else if ( range * num_spans <= SMALL_BUCKETS ) {
+		buckets = stack_buckets;
+		memset( buckets, 0, range * num_spans * sizeof( buckets[0] ) );
+	} else {
+		buckets = calloc( range * num_spans, sizeof( buckets[0] ) );
+		if ( !buckets )
+			return 0;
+	}
 	
-	/* Put same glyphs into the same batches */
-	qsort( chars, text_len, sizeof(*chars), sort_func );
+	#pragma omp parallel for if( num_spans > 1 )
+	for( n=0; n<num_spans; n++ )
+	{
+		TempChar const *c = chars + spans[n].first_char;
+		size_t *bucket = buckets + n * range;
+		size_t k;
+		for( k=0; k<spans[n].num_chars; k++ )
+			bucket[ c[k].glyph - min_glyph ]++;
+	}
 	
-	/* See out how many batches there are */
-	prev_glyph = chars[0].glyph;
-	num_batches = 1;
-	for( n=1; n<text_len; n++ )
+	num_batches = 0;
+	for( g=0; total && g<range; g++ )
 	{
-		if ( chars[n].glyph != prev_glyph ) {
-			prev_glyph = chars[n].glyph;
-			num_batches++;
+		for( n=0; n<num_spans; n++ ) {
+			if ( buckets[ n * range + g ] ) {
+				num_batches++;
+				break;
+			}
 		}
 	}
 	
 	if ( !output->glyph_indices )
 	{
-		output->glyph_indices = malloc( num_batches * ( sizeof( output->glyph_indices[0] ) + sizeof( output->batch_len ) ) );
+		output->glyph_indices = malloc( num_batches * ( sizeof( output->glyph_indices[0] ) + sizeof( output->batch_len ) ) + 1 );
 		output->batch_len = (size_t*)( output->glyph_indices + num_batches );
 		
-		if ( !output->glyph_indices )
+		if ( !output->glyph_indices ) {
+			if ( buckets != stack_buckets && buckets != counters ) free( buckets );
 			return 0;
+		}
 	}
 	
 	assert( output->batch_len );
 	output->batch_count = num_batches;
-	output->total_glyphs = text_len;
+	output->total_glyphs = total;
 	
-	/* Write batch information */
-	prev_glyph = chars[0].glyph;
-	cur_batch = cur_batch_len = 0;
-	for( n=0; n<text_len; n++ )
+	/* Write batch information. Batches go in descending glyph order. Within a batch, earlier spans come first */
+	cur_batch = first = 0;
+	for( g=range; num_batches && g-- > 0; )
 	{
-		GlyphCoord *p = output->positions + 2 * n;
-		p[0] = chars[n].pos_x;
-		p[1] = chars[n].line_num * line_height >> LINEH_PREC;
-		
-		if ( chars[n].glyph != prev_glyph )
-		{
-			output->batch_len[ cur_batch ] = cur_batch_len;
-			output->glyph_indices[ cur_batch ] = prev_glyph;
+		size_t batch_first = first;
+		for( n=0; n<num_spans; n++ ) {
+			size_t count = buckets[ n * range + g ];
+			buckets[ n * range + g ] = first;
+			first += count;
+		}
+		if ( first != batch_first ) {
+			output->glyph_indices[ cur_batch ] = min_glyph + g;
+			output->batch_len[ cur_batch ] = first - batch_first;
 			cur_batch++;
-			
-			cur_batch_len = 0;
-			prev_glyph = chars[n].glyph;
 		}
-		
-		cur_batch_len++;
 	}
 	
-	/* Initialize the final batch */
-	output->batch_len[ cur_batch ] = cur_batch_len;
-	output->glyph_indices[ cur_batch ] = prev_glyph;
+	/* Scatter positions straight into batch order. Characters keep their text order within a batch */
+	#pragma omp parallel for if( num_spans > 1 )
+	for( n=0; n<num_spans; n++ )
+	{
+		TempChar const *c = chars + spans[n].first_char;
+		size_t *bucket = buckets + n * range;
+		size_t k;
+		for( k=0; k<spans[n].num_chars; k++ )
+		{
+			GlyphCoord *p = output->positions + 2 * bucket[ c[k].glyph - min_glyph ]++;
+			p[0] = c[k].pos_x;
+			p[1] = ( c[k].line_num + spans[n].first_line ) * line_height >> LINEH_PREC;
+		}
+	}
 	
+	if ( buckets != stack_buckets && buckets != counters ) free( buckets );
 	return 1;
 }
 
+/* Sets *num_lines (if not NULL) to the number of lines */
+static int do_simple_layout_internal( struct Font *font, void const *text, size_t text_len, TextEncoding enc, size_t max_chars, int max_line_len, float line_height_scale, GlyphBuffer *output, TempChar *chars, size_t *num_lines, size_t *num_errors )
+{
+	LayoutCursor cur = {0};
+	LayoutSpan span;
+	
+	assert( text_len > 0 );
+	
+	/* Map character codes to glyph indices. Then compute x and y coordinates for each glyph */
+	memset( &span, 0, sizeof( span ) );
+	span.num_chars = map_text( font, chars, text, text_len, enc, max_chars, max_line_len, &cur, num_errors );
+	if ( num_lines )
+		*num_lines = cur.line + 1;
+	
+	return batch_glyphs( font, chars, &span, 1, line_height_scale, output, NULL );
+}
+
+typedef struct {
+	TempChar *chars;
+	size_t num_chars, max_chars;
+} CopyState;
+
+/* Appends positioned characters to caller-owned memory. Counts but doesn't write the ones that don't fit */
+static void copy_sink( struct Font *font, void *state, TempChar const chars[], size_t num_chars )
+{
+	CopyState *st = state;
+	(void) font;
+	if ( st->num_chars + num_chars <= st->max_chars )
+		memcpy( st->chars + st->num_chars, chars, num_chars * sizeof( chars[0] ) );
+	st->num_chars += num_chars;
+}
+
+static int layout_into_internal( struct Font *font, void const *text, size_t text_len, TextEncoding enc, int max_line_len, float line_height_scale, LayoutSize const *size, LayoutOutput *out, size_t *num_errors )
+{
+	size_t *counters = out->scratch;
+	size_t range = size->max_glyph - size->min_glyph + 1;
+	LayoutSpan span;
+	GlyphBuffer b;
+	CopyState st;
+	size_t n, num_batches = 0;
+	
+	if ( !size->num_glyphs )
+		return 1;
+	
+	st.chars = (TempChar*)( counters + range );
+	st.num_chars = 0;
+	st.max_chars = size->num_glyphs;
+	position_text_chunks( font, text, text_len, enc, max_line_len, copy_sink, &st, num_errors );
+	
+	/* The text must be the one that was measured */
+	if ( st.num_chars != size->num_glyphs )
+		return 0;
+	for( n=0; n<st.num_chars; n++ ) {
+		if ( st.chars[n].glyph < size->min_glyph || st.chars[n].glyph > size->max_glyph )
+			return 0;
+	}
+	
+	/* Same number of glyphs in the same range can still make more batches than glyph_indices and batch_len have room for */
+	memset( counters, 0, range * sizeof( counters[0] ) );
+	for( n=0; n<st.num_chars; n++ )
+		num_batches += !counters[ st.chars[n].glyph - size->min_glyph ]++;
+	if ( num_batches != size->num_batches )
+		return 0;
+	
+	memset( &span, 0, sizeof( span ) );
+	span.num_chars = st.num_chars;
+	
+	b.positions = out->positions;
+	b.glyph_indices = out->glyph_indices;
+	b.batch_len = out->batch_len;
+	b.batch_count = 0;
+	b.positions_vbo = 0;
+	
+	return batch_glyphs( font, st.chars, &span, 1, line_height_scale, &b, counters );
+}
+
+int layout_into( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, LayoutSize const *size, LayoutOutput *out ) {
+	return layout_into_internal( font, text, text_len, TEXT_UTF32, max_line_len, line_height_scale, size, out, NULL );
+}
+
+int layout_into_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, LayoutSize const *size, LayoutOutput *out, size_t *num_errors ) {
+	return layout_into_internal( font, text, num_bytes, TEXT_UTF8, max_line_len, line_height_scale, size, out, num_errors );
+}
+
+int orphan_glyph_vbo( GLuint *vbo, size_t *cap, size_t num_glyphs, size_t glyph_size )
+{
+	int grown = 0;
+	
+	if ( !*vbo )
+		glGenBuffers( 1, vbo );
+	glBindBuffer( GL_ARRAY_BUFFER, *vbo );
+	
+	if ( num_glyphs > *cap ) {
+		*cap = num_glyphs + num_glyphs / 2;
+		if ( *cap < MIN_VBO_GLYPHS )
+			*cap = MIN_VBO_GLYPHS;
+		grown = 1;
+	}
+	
+	glBufferData( GL_ARRAY_BUFFER, *cap * glyph_size, NULL, GL_DYNAMIC_DRAW );
+	return grown;
+}
+
+void draw_batches( struct Font *font, GlyphBuffer const *buf, GLuint vbo, size_t first, float global_transform[16], int draw_flags )
+{
+	size_t b, num_batches = buf->batch_count;
+	for( b=0; b<num_batches; b++ )
+	{
+		bind_glyph_positions( vbo, first );
+		draw_glyphs( font, global_transform, buf->glyph_indices[b], buf->batch_len[b], draw_flags );
+		first += buf->batch_len[b];
+	}
+}
+
+/* Strings up to this many code units are laid out in stack buffers. Longer strings use live_scratch */
 #define MAX_LIVE_LEN 200
-void draw_text_live( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags )
+
+/* Size of the live text ring buffer in glyphs. Grows if a single string doesn't fit */
+#define LIVE_RING_GLYPHS 65536
+
+/* One VBO that all draw_text_live calls write their positions into, one after another
+When the end is reached the buffer is orphaned and writing starts over from the beginning. The driver keeps the old storage alive until the GPU is done with it
+Nothing that has been written since the last orphaning is overwritten, so the writes can be unsynchronized */
+static struct {
+	GLuint vbo;
+	size_t cap; /* in glyphs */
+	size_t head; /* next free glyph */
+} live_ring = {0,0,0};
+
+/* Scratch memory for strings longer than MAX_LIVE_LEN. Only grows */
+static struct {
+	TempChar *chars;
+	GlyphIndex *glyph_indices;
+	size_t *batch_len;
+	size_t cap; /* in code units */
+} live_scratch = {NULL,NULL,NULL,0};
+
+static int reserve_live_scratch( size_t len )
+{
+	TempChar *chars;
+	GlyphIndex *glyph_indices;
+	size_t *batch_len;
+	
+	if ( len <= live_scratch.cap )
+		return 1;
+	
+	len += len / 2;
+	chars = realloc( live_scratch.chars, len * sizeof( chars[0] ) );
+	if ( chars ) live_scratch.chars = chars;
+	glyph_indices = realloc( live_scratch.glyph_indices, len * sizeof( glyph_indices[0] ) );
+	if ( glyph_indices ) live_scratch.glyph_indices = glyph_indices;
+	batch_len = realloc( live_scratch.batch_len, len * sizeof( batch_len[0] ) );
+	if ( batch_len ) live_scratch.batch_len = batch_len;
+	
+	if ( !chars || !glyph_indices || !batch_len )
+		return 0;
+	
+	live_scratch.cap = len;
+	return 1;
+}
+
+/* Maps space for at most max_glyphs glyphs at the head of the ring buffer. Sets *first to the glyph offset of the mapped range
+Returns NULL if the buffer can't be mapped. The buffer stays bound to GL_ARRAY_BUFFER until unmap_live_ring */
+static GlyphCoord *map_live_ring( size_t max_glyphs, size_t *first )
+{
+	size_t const vec_size = 2 * sizeof( GlyphCoord );
+	
+	if ( !live_ring.vbo )
+	{
+		glGenBuffers( 1, &live_ring.vbo );
+		if ( !live_ring.vbo )
+			return NULL;
+		live_ring.cap = 0;
+	}
+	
+	glBindBuffer( GL_ARRAY_BUFFER, live_ring.vbo );
+	
+	if ( live_ring.head + max_glyphs > live_ring.cap )
+	{
+		/* Orphan the old storage */
+		if ( max_glyphs > live_ring.cap )
+			live_ring.cap = max_glyphs > LIVE_RING_GLYPHS ? max_glyphs : LIVE_RING_GLYPHS;
+		glBufferData( GL_ARRAY_BUFFER, live_ring.cap * vec_size, NULL, GL_STREAM_DRAW );
+		live_ring.head = 0;
+	}
+	
+	*first = live_ring.head;
+	return glMapBufferRange( GL_ARRAY_BUFFER, live_ring.head * vec_size, max_glyphs * vec_size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT );
+}
+
+/* Flushes the first num_glyphs glyphs of the mapped range and moves the head past them */
+static void unmap_live_ring( size_t num_glyphs )
+{
+	if ( num_glyphs )
+		glFlushMappedBufferRange( GL_ARRAY_BUFFER, 0, num_glyphs * 2 * sizeof( GlyphCoord ) );
+	glUnmapBuffer( GL_ARRAY_BUFFER );
+	live_ring.head += num_glyphs;
+}
+
+void release_live_text_buffers( void )
+{
+	if ( live_ring.vbo )
+		glDeleteBuffers( 1, &live_ring.vbo );
+	live_ring.vbo = 0;
+	live_ring.cap = live_ring.head = 0;
+	
+	free( live_scratch.chars );
+	free( live_scratch.glyph_indices );
+	free( live_scratch.batch_len );
+	memset( &live_scratch, 0, sizeof( live_scratch ) );
+}
+
+static void draw_text_live_internal( struct Font *font, void const *text, size_t text_len, TextEncoding enc, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags, size_t *num_errors )
 {
 	GlyphBuffer batch;
 	GlyphIndex glyph_indices[MAX_LIVE_LEN];
 	size_t batch_len[MAX_LIVE_LEN];
-	GlyphCoord positions[2*MAX_LIVE_LEN];
-	TempChar chars[MAX_LIVE_LEN];
+	TempChar chars_buf[MAX_LIVE_LEN];
+	TempChar *chars = chars_buf;
+	size_t first;
+	int ok;
 	
 	if ( !text_len )
 		return;
 	
-	if ( text_len > MAX_LIVE_LEN )
-		text_len = MAX_LIVE_LEN;
-	
-	batch.positions = positions;
 	batch.glyph_indices = glyph_indices;
 	batch.batch_len = batch_len;
 	batch.batch_count = 0;
+	batch.total_glyphs = 0;
 	
-	do_simple_layout_internal( font, text, text_len, max_line_len, line_height_scale, &batch, chars );
-	upload_positions( &batch, GL_STREAM_DRAW );
-	draw_glyph_buffer( font, &batch, global_transform, draw_flags );
-	glDeleteBuffers( 1, &batch.positions_vbo );
+	if ( text_len > MAX_LIVE_LEN )
+	{
+		if ( !reserve_live_scratch( text_len ) )
+			return;
+		chars = live_scratch.chars;
+		batch.glyph_indices = live_scratch.glyph_indices;
+		batch.batch_len = live_scratch.batch_len;
+	}
+	
+	/* Every code unit makes at most one glyph. Positions are written straight into the mapped buffer */
+	batch.positions = map_live_ring( text_len, &first );
+	if ( !batch.positions )
+		return;
+	
+	ok = do_simple_layout_internal( font, text, text_len, enc, text_len, max_line_len, line_height_scale, &batch, chars, NULL, num_errors );
+	unmap_live_ring( ok ? batch.total_glyphs : 0 );
+	
+	if ( ok )
+		draw_batches( font, &batch, live_ring.vbo, first, global_transform, draw_flags );
+}
+
+void draw_text_live( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags ) {
+	draw_text_live_internal( font, text, text_len, TEXT_UTF32, max_line_len, line_height_scale, global_transform, draw_flags, NULL );
+}
+
+void draw_text_live_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags, size_t *num_errors ) {
+	draw_text_live_internal( font, text, num_bytes, TEXT_UTF8, max_line_len, line_height_scale, global_transform, draw_flags, num_errors );
+}
+
+void draw_text_live_utf16( struct Font *font, uint16_t const *text, size_t num_units, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags, size_t *num_errors ) {
+	draw_text_live_internal( font, text, num_units, TEXT_UTF16, max_line_len, line_height_scale, global_transform, draw_flags, num_errors );
 }
 
-static GlyphBuffer THE_EMPTY_BUFFER = {
-	0, 0, NULL, NULL, NULL, 0
+GlyphBuffer THE_EMPTY_BUFFER = {
+	0, 0, NULL, NULL, NULL, 0, NULL, NULL
 };
 
-GlyphBuffer *do_simple_layout( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale )
+/* Lays out without wrapping and then wraps each line to max_line_width. pen must have room for text_len + 1 elements */
+static int do_width_layout_internal( struct Font *font, void const *text, size_t text_len, TextEncoding enc, int32_t max_line_width, float line_height_scale, GlyphBuffer *output, TempChar *chars, int32_t *pen, size_t *num_errors )
+{
+	LayoutCursor cur = {0};
+	LayoutSpan span;
+	
+	memset( &span, 0, sizeof( span ) );
+	span.num_chars = map_text( font, chars, text, text_len, enc, text_len, -1, &cur, num_errors );
+	wrap_to_width( font, chars, span.num_chars, max_line_width, pen );
+	
+	return batch_glyphs( font, chars, &span, 1, line_height_scale, output, NULL );
+}
+
+/* text_len is in code units. There can't be more characters than code units
+Wraps to max_line_width font units if it is positive, otherwise every max_line_len characters
+Tiles the glyphs if tile_size >= 0 and builds a hit test index if hit_index is nonzero */
+static GlyphBuffer *do_layout( struct Font *font, void const *text, size_t text_len, TextEncoding enc, int max_line_len, int32_t max_line_width, float line_height_scale, int32_t tile_size, int hit_index, size_t *num_errors )
 {
 	GlyphBuffer *b = NULL;
 	TempChar *chars = NULL;
 	GlyphCoord *positions = NULL;
+	int32_t *pen = NULL;
+	size_t *moved_to = NULL, num_lines = 0;
+	int ok;
 	
 	if ( !text_len )
 		return &THE_EMPTY_BUFFER;
@@ -200,23 +650,51 @@ GlyphBuffer *do_simple_layout( struct Font *font, uint32_t const *text, size_t t
 	b = malloc( sizeof(*b) );
 	chars = malloc( text_len * sizeof(*chars) );
 	positions = malloc( text_len * sizeof(*positions) * 2 );
+	if ( max_line_width > 0 )
+		pen = malloc( ( text_len + 1 ) * sizeof(*pen) );
 	
-	if ( !chars || !b || !positions )
+	if ( !chars || !b || !positions || ( max_line_width > 0 && !pen ) )
 		goto error_handler;
 	
 	b->positions = positions;
 	b->glyph_indices = NULL;
 	b->batch_len = NULL;
 	b->batch_count = 0;
+	b->tiles = NULL;
+	b->hits = NULL;
 	
-	if ( !do_simple_layout_internal( font, text, text_len, max_line_len, line_height_scale, b, chars ) )
+	if ( max_line_width > 0 )
+		ok = do_width_layout_internal( font, text, text_len, enc, max_line_width, line_height_scale, b, chars, pen, num_errors );
+	else
+		ok = do_simple_layout_internal( font, text, text_len, enc, text_len, max_line_len, line_height_scale, b, chars, &num_lines, num_errors );
+	
+	/* The index must know where tiling moved each instance */
+	if ( ok && tile_size >= 0 ) {
+		if ( hit_index ) {
+			moved_to = malloc( b->total_glyphs * sizeof( moved_to[0] ) + 1 );
+			ok = moved_to != NULL;
+		}
+		ok = ok && build_glyph_tiles( font, b, tile_size, moved_to );
+	}
+	
+	if ( ok && hit_index )
+		ok = build_hit_index( font, b, text, text_len, enc, chars, num_lines, line_height_scale, moved_to );
+	
+	if ( moved_to )
+		free( moved_to );
+	
+	if ( !ok ) {
+		if ( b->glyph_indices ) free( b->glyph_indices );
+		if ( b->tiles ) delete_glyph_tiles( b->tiles );
 		goto error_handler;
+	}
 	
 	upload_positions( b, GL_STATIC_DRAW );
 	
 	free( chars );
 	free( b->positions );
 	b->positions = NULL;
+	if ( pen ) free( pen );
 	
 	/* Success */
 	return b;
@@ -225,19 +703,393 @@ error_handler:;
 	if ( b ) free( b );
 	if ( chars ) free( chars );
 	if ( positions ) free( positions );
+	if ( pen ) free( pen );
 	return NULL;
 }
 
-void draw_glyph_buffer( struct Font *font, GlyphBuffer *buf, float global_transform[16], int draw_flags )
+GlyphBuffer *do_simple_layout( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale ) {
+	return do_layout( font, text, text_len, TEXT_UTF32, max_line_len, 0, line_height_scale, -1, 0, NULL );
+}
+
+GlyphBuffer *do_simple_layout_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, size_t *num_errors ) {
+	return do_layout( font, text, num_bytes, TEXT_UTF8, max_line_len, 0, line_height_scale, -1, 0, num_errors );
+}
+
+GlyphBuffer *do_simple_layout_utf16( struct Font *font, uint16_t const *text, size_t num_units, int max_line_len, float line_height_scale, size_t *num_errors ) {
+	return do_layout( font, text, num_units, TEXT_UTF16, max_line_len, 0, line_height_scale, -1, 0, num_errors );
+}
+
+GlyphBuffer *do_tiled_layout( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, int32_t tile_size ) {
+	return do_layout( font, text, text_len, TEXT_UTF32, max_line_len, 0, line_height_scale, tile_size > 0 ? tile_size : 0, 0, NULL );
+}
+
+GlyphBuffer *do_tiled_layout_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, int32_t tile_size, size_t *num_errors ) {
+	return do_layout( font, text, num_bytes, TEXT_UTF8, max_line_len, 0, line_height_scale, tile_size > 0 ? tile_size : 0, 0, num_errors );
+}
+
+GlyphBuffer *do_indexed_layout( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, int tiled, int32_t tile_size ) {
+	return do_layout( font, text, text_len, TEXT_UTF32, max_line_len, 0, line_height_scale, !tiled ? -1 : tile_size > 0 ? tile_size : 0, 1, NULL );
+}
+
+GlyphBuffer *do_indexed_layout_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, int tiled, int32_t tile_size, size_t *num_errors ) {
+	return do_layout( font, text, num_bytes, TEXT_UTF8, max_line_len, 0, line_height_scale, !tiled ? -1 : tile_size > 0 ? tile_size : 0, 1, num_errors );
+}
+
+GlyphBuffer *do_wrapped_layout( struct Font *font, uint32_t const *text, size_t text_len, int32_t max_line_width, float line_height_scale ) {
+	return do_layout( font, text, text_len, TEXT_UTF32, -1, max_line_width, line_height_scale, -1, 0, NULL );
+}
+
+GlyphBuffer *do_wrapped_layout_utf8( struct Font *font, char const *text, size_t num_bytes, int32_t max_line_width, float line_height_scale, size_t *num_errors ) {
+	return do_layout( font, text, num_bytes, TEXT_UTF8, -1, max_line_width, line_height_scale, -1, 0, num_errors );
+}
+
+/* Shorter texts aren't worth splitting */
+#define MIN_PARALLEL_LEN 16384
+
+static size_t code_unit_size( TextEncoding enc ) {
+	return enc == TEXT_UTF32 ? 4 : ( enc == TEXT_UTF16 ? 2 : 1 );
+}
+
+/* Finds the first newline at or after 'pos'. Returns text_len if there is none
+A newline code unit is never part of a multi-unit sequence in any of the encodings */
+static size_t find_newline( void const *text, size_t text_len, TextEncoding enc, size_t pos )
 {
-	size_t b, num_batches = buf->batch_count;
-	size_t first = 0;
-	for( b=0; b<num_batches; b++ )
+	if ( enc == TEXT_UTF8 ) {
+		char const *nl = memchr( (char const*) text + pos, '\n', text_len - pos );
+		return nl ? (size_t)( nl - (char const*) text ) : text_len;
+	} else if ( enc == TEXT_UTF16 ) {
+		uint16_t const *t = text;
+		while( pos < text_len && t[pos] != '\n' ) pos++;
+	} else {
+		uint32_t const *t = text;
+		while( pos < text_len && t[pos] != '\n' ) pos++;
+	}
+	return pos;
+}
+
+/* Splits the text into at most max_spans pieces of roughly equal length. Every piece except the first begins right after a newline */
+static size_t split_at_newlines( void const *text, size_t text_len, TextEncoding enc, LayoutSpan spans[], size_t max_spans )
+{
+	size_t n, begin = 0, num_spans = 0;
+	
+	for( n=1; n<=max_spans && begin < text_len; n++ )
 	{
-		bind_glyph_positions( buf->positions_vbo, first );
-		draw_glyphs( font, global_transform, buf->glyph_indices[b], buf->batch_len[b], draw_flags );
-		first += buf->batch_len[b];
+		size_t end = text_len;
+		
+		if ( n < max_spans ) {
+			size_t target = text_len / max_spans * n;
+			end = find_newline( text, text_len, enc, target > begin ? target : begin );
+			if ( end < text_len )
+				end++;
+		}
+		
+		memset( spans + num_spans, 0, sizeof( spans[0] ) );
+		spans[num_spans].text_begin = begin;
+		spans[num_spans].text_end = end;
+		num_spans++;
+		begin = end;
 	}
+	
+	return num_spans;
+}
+
+/* Lays out spans of the text on separate threads. Line numbers are fixed afterwards with a prefix sum over the line counts of the spans */
+static GlyphBuffer *do_layout_parallel( struct Font *font, void const *text, size_t text_len, TextEncoding enc, int max_line_len, float line_height_scale, int num_threads, size_t *num_errors )
+{
+	extern unsigned omp_get_num_procs( void );
+	GlyphBuffer *b = NULL;
+	TempChar *chars = NULL;
+	GlyphCoord *positions = NULL;
+	LayoutSpan *spans = NULL;
+	size_t n, num_spans, unit_size = code_unit_size( enc );
+	int32_t line = 0;
+	
+	if ( num_threads <= 0 )
+		num_threads = omp_get_num_procs();
+	
+	if ( num_threads == 1 || text_len < MIN_PARALLEL_LEN )
+		return do_layout( font, text, text_len, enc, max_line_len, 0, line_height_scale, -1, 0, num_errors );
+	
+	b = malloc( sizeof(*b) );
+	chars = malloc( text_len * sizeof(*chars) );
+	positions = malloc( text_len * sizeof(*positions) * 2 );
+	spans = malloc( num_threads * sizeof(*spans) );
+	
+	if ( !chars || !b || !positions || !spans )
+		goto error_handler;
+	
+	num_spans = split_at_newlines( text, text_len, enc, spans, num_threads );
+	
+	/* Each span starts at the beginning of a line. Its glyphs go to chars[] at the same offset as its text */
+	#pragma omp parallel for num_threads( num_threads )
+	for( n=0; n<num_spans; n++ )
+	{
+		LayoutSpan *sp = spans + n;
+		LayoutCursor cur = {0};
+		size_t len = sp->text_end - sp->text_begin;
+		sp->first_char = sp->text_begin;
+		sp->num_chars = map_text( font, chars + sp->first_char, (char const*) text + sp->text_begin * unit_size, len, enc, len, max_line_len, &cur, &sp->num_errors );
+		sp->num_lines = cur.line;
+	}
+	
+	for( n=0; n<num_spans; n++ ) {
+		spans[n].first_line = line;
+		line += spans[n].num_lines;
+		if ( num_errors )
+			*num_errors += spans[n].num_errors;
+	}
+	
+	b->positions = positions;
+	b->glyph_indices = NULL;
+	b->batch_len = NULL;
+	b->batch_count = 0;
+	b->tiles = NULL;
+	b->hits = NULL;
+	
+	if ( !batch_glyphs( font, chars, spans, num_spans, line_height_scale, b, NULL ) )
+		goto error_handler;
+	
+	upload_positions( b, GL_STATIC_DRAW );
+	
+	free( spans );
+	free( chars );
+	free( b->positions );
+	b->positions = NULL;
+	return b;
+	
+error_handler:;
+	if ( b ) free( b );
+	if ( chars ) free( chars );
+	if ( positions ) free( positions );
+	if ( spans ) free( spans );
+	return NULL;
+}
+
+GlyphBuffer *do_simple_layout_parallel( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, int num_threads ) {
+	return do_layout_parallel( font, text, text_len, TEXT_UTF32, max_line_len, line_height_scale, num_threads, NULL );
+}
+
+GlyphBuffer *do_simple_layout_parallel_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, int num_threads, size_t *num_errors ) {
+	return do_layout_parallel( font, text, num_bytes, TEXT_UTF8, max_line_len, line_height_scale, num_threads, num_errors );
+}
+
+struct LayoutStream {
+	Font *font;
+	LayoutCursor cur;
+	int max_line_len;
+	float line_height_scale;
+	size_t page_size; /* max glyphs per page */
+	size_t num_chars; /* glyphs waiting in chars[] */
+	TempChar *chars;
+	GlyphCoord *positions; /* reused by every page until it has been uploaded */
+	LayoutPageFunc page_func;
+	void *user_data;
+	uint8_t pending[4]; /* beginning of a UTF-8 sequence that continues in the next chunk */
+	size_t num_pending;
+	size_t num_errors;
+	int failed;
+};
+
+LayoutStream *begin_layout_stream( struct Font *font, int max_line_len, float line_height_scale, size_t page_size, LayoutPageFunc page_func, void *user_data )
+{
+	LayoutStream *s;
+	
+	if ( !page_size )
+		return NULL;
+	
+	s = calloc( 1, sizeof(*s) );
+	if ( !s )
+		return NULL;
+	
+	s->font = font;
+	s->max_line_len = max_line_len;
+	s->line_height_scale = line_height_scale;
+	s->page_size = page_size;
+	s->page_func = page_func;
+	s->user_data = user_data;
+	/* Pages smaller than MAX_LIGATURE_LEN may overflow by the code points that were held back for a ligature */
+	s->chars = malloc( ( page_size + MAX_LIGATURE_LEN ) * sizeof( s->chars[0] ) );
+	s->positions = malloc( ( page_size + MAX_LIGATURE_LEN ) * sizeof( s->positions[0] ) * 2 );
+	
+	if ( !s->chars || !s->positions ) {
+		if ( s->chars ) free( s->chars );
+		if ( s->positions ) free( s->positions );
+		free( s );
+		return NULL;
+	}
+	
+	return s;
+}
+
+/* Turns the glyphs collected so far into a page and hands it over to page_func */
+static int flush_layout_page( LayoutStream *s )
+{
+	GlyphBuffer *b;
+	LayoutSpan span;
+	
+	if ( !s->num_chars )
+		return 1;
+	
+	b = malloc( sizeof(*b) );
+	if ( !b )
+		return 0;
+	
+	b->positions = s->positions;
+	b->glyph_indices = NULL;
+	b->batch_len = NULL;
+	b->batch_count = 0;
+	b->tiles = NULL;
+	b->hits = NULL;
+	
+	memset( &span, 0, sizeof( span ) );
+	span.num_chars = s->num_chars;
+	
+	if ( !batch_glyphs( s->font, s->chars, &span, 1, s->line_height_scale, b, NULL ) ) {
+		free( b );
+		return 0;
+	}
+	
+	upload_positions( b, GL_STATIC_DRAW );
+	b->positions = NULL;
+	s->num_chars = 0;
+	
+	s->page_func( b, s->user_data );
+	return 1;
+}
+
+/* Lays out decoded code points. Flushes pages as they fill up */
+static int stream_code_points( LayoutStream *s, uint32_t const *text, size_t text_len )
+{
+	while( text_len )
+	{
+		/* Every code point gives at most one glyph. So does every code point that was held back for a ligature */
+		size_t room = s->page_size - s->num_chars, n;
+		
+		if ( room <= s->cur.num_pending && s->num_chars ) {
+			if ( !flush_layout_page( s ) )
+				return 0;
+			continue;
+		}
+		
+		n = room > s->cur.num_pending ? room - s->cur.num_pending : 1;
+		if ( n > text_len )
+			n = text_len;
+		
+		s->num_chars += init_glyph_positions( s->font, s->chars + s->num_chars, text, n, s->max_line_len, 0, &s->cur );
+		text += n;
+		text_len -= n;
+		
+		if ( s->num_chars >= s->page_size && !flush_layout_page( s ) )
+			return 0;
+	}
+	return 1;
+}
+
+int feed_layout_stream_utf32( LayoutStream *s, uint32_t const *text, size_t text_len )
+{
+	if ( s->failed || !stream_code_points( s, text, text_len ) ) {
+		s->failed = 1;
+		return 0;
+	}
+	return 1;
+}
+
+int feed_layout_stream_utf8( LayoutStream *s, char const *text_p, size_t num_bytes )
+{
+	uint8_t const *text = (uint8_t const*) text_p;
+	uint32_t buf[DECODE_CHUNK];
+	size_t tail, n, used;
+	
+	if ( s->failed )
+		return 0;
+	
+	/* Finish the sequence that was split by the end of the previous chunk */
+	if ( s->num_pending )
+	{
+		uint8_t tmp[8];
+		size_t k = 4 - s->num_pending, tmp_len;
+		
+		if ( k > num_bytes )
+			k = num_bytes;
+		
+		memcpy( tmp, s->pending, s->num_pending );
+		memcpy( tmp + s->num_pending, text, k );
+		tmp_len = s->num_pending + k;
+		
+		if ( utf8_incomplete_tail( tmp, tmp_len ) == tmp_len ) {
+			/* Still incomplete. Need more bytes */
+			memcpy( s->pending, tmp, tmp_len );
+			s->num_pending = tmp_len;
+			return 1;
+		}
+		
+		/* The pending bytes are a valid prefix so the sequence ends in the new chunk */
+		n = decode_utf8( buf, 1, tmp, tmp_len, &used, &s->num_errors );
+		text += used - s->num_pending;
+		num_bytes -= used - s->num_pending;
+		s->num_pending = 0;
+		
+		if ( !stream_code_points( s, buf, n ) ) {
+			s->failed = 1;
+			return 0;
+		}
+	}
+	
+	tail = utf8_incomplete_tail( text, num_bytes );
+	num_bytes -= tail;
+	memcpy( s->pending, text + num_bytes, tail );
+	s->num_pending = tail;
+	
+	while( num_bytes )
+	{
+		n = decode_utf8( buf, DECODE_CHUNK, text, num_bytes, &used, &s->num_errors );
+		text += used;
+		num_bytes -= used;
+		
+		if ( !stream_code_points( s, buf, n ) ) {
+			s->failed = 1;
+			return 0;
+		}
+	}
+	
+	return 1;
+}
+
+int end_layout_stream( LayoutStream *s, size_t *num_errors )
+{
+	int ok = !s->failed;
+	
+	if ( ok && s->num_pending ) {
+		/* The text ended in the middle of a sequence */
+		uint32_t c = UTF_REPLACEMENT_CHAR;
+		s->num_errors += 1;
+		ok = stream_code_points( s, &c, 1 );
+	}
+	
+	if ( ok && s->cur.num_pending ) {
+		/* Code points that were held back for a ligature */
+		uint32_t none = 0;
+		s->num_chars += init_glyph_positions( s->font, s->chars + s->num_chars, &none, 0, s->max_line_len, 1, &s->cur );
+	}
+	
+	if ( ok )
+		ok = flush_layout_page( s );
+	
+	if ( num_errors )
+		*num_errors += s->num_errors;
+	
+	free( s->chars );
+	free( s->positions );
+	free( s );
+	return ok;
+}
+
+void draw_glyph_buffer( struct Font *font, GlyphBuffer *buf, float global_transform[16], int draw_flags )
+{
+	if ( buf->tiles )
+		draw_tiled_batches( font, buf, global_transform, draw_flags );
+	else
+		draw_batches( font, buf, buf->positions_vbo, 0, global_transform, draw_flags );
 }
 
 void delete_glyph_buffer( GlyphBuffer *buf )
@@ -247,6 +1099,8 @@ void delete_glyph_buffer( GlyphBuffer *buf )
 		if ( buf->positions_vbo ) glDeleteBuffers( 1, &buf->positions_vbo );
 		if ( buf->positions ) free( buf->positions );
 		if ( buf->glyph_indices ) free( buf->glyph_indices );
+		if ( buf->tiles ) delete_glyph_tiles( buf->tiles );
+		if ( buf->hits ) delete_hit_index( buf->hits );
 		free( buf );
 	}
 }
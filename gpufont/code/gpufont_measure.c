@@ -0,0 +1,210 @@
+#include <string.h>
+#include <assert.h>
+#include "gpufont_data.h"
+#include "gpufont_layout.h"
+#include "utf_decode.h"
+#include "layout_internal.h"
+
+/* Text measurement and the size query of the two-phase layout. Uses the same positioning code as the layout functions but only keeps extents, so it needs no GL and no heap memory */
+
+typedef struct {
+	long line_height;
+	int have_box;
+	TextExtents *ext;
+	int32_t *line_widths;
+	size_t max_lines;
+	int32_t lines_cleared; /* line_widths[] has been zeroed up to this line */
+} MeasureState;
+
+static void clear_lines( MeasureState *m, int32_t end_line )
+{
+	size_t end = end_line < 0 ? 0 : (size_t) end_line;
+	if ( end > m->max_lines )
+		end = m->max_lines;
+	while( (size_t) m->lines_cleared < end )
+		m->line_widths[ m->lines_cleared++ ] = 0;
+}
+
+static void measure_chars( Font *font, MeasureState *m, TempChar const chars[], size_t num_chars )
+{
+	GlyphMetrics const *gm = &font->metrics;
+	TextExtents *ext = m->ext;
+	size_t n;
+	
+	for( n=0; n<num_chars; n++ )
+	{
+		GlyphIndex g = chars[n].glyph;
+		int32_t line = chars[n].line_num;
+		int32_t pen = chars[n].pos_x + gm->lsb[g] + gm->adv_width[g];
+		
+		if ( pen > ext->max_width )
+			ext->max_width = pen;
+		
+		if ( m->line_widths ) {
+			clear_lines( m, line + 1 );
+			if ( (size_t) line < m->max_lines && pen > m->line_widths[line] )
+				m->line_widths[line] = pen;
+		}
+		
+		if ( gm->xmin[g] != gm->xmax[g] )
+		{
+			int32_t y = line * m->line_height >> LINEH_PREC;
+			int32_t x0 = chars[n].pos_x + gm->xmin[g], x1 = chars[n].pos_x + gm->xmax[g];
+			int32_t y0 = y + gm->ymin[g], y1 = y + gm->ymax[g];
+			
+			if ( !m->have_box ) {
+				ext->xmin = x0; ext->xmax = x1;
+				ext->ymin = y0; ext->ymax = y1;
+				m->have_box = 1;
+			} else {
+				if ( x0 < ext->xmin ) ext->xmin = x0;
+				if ( x1 > ext->xmax ) ext->xmax = x1;
+				if ( y0 < ext->ymin ) ext->ymin = y0;
+				if ( y1 > ext->ymax ) ext->ymax = y1;
+			}
+		}
+	}
+}
+
+static void measure_sink( struct Font *font, void *state, TempChar const chars[], size_t num_chars ) {
+	measure_chars( font, state, chars, num_chars );
+}
+
+static void measure_internal( Font *font, void const *text, size_t text_len, TextEncoding enc, int max_line_len, float line_height_scale, TextExtents *ext, int32_t line_widths[], size_t max_lines, size_t *num_errors )
+{
+	MeasureState m;
+	
+	memset( ext, 0, sizeof(*ext) );
+	m.line_height = get_line_height( font, line_height_scale );
+	m.have_box = 0;
+	m.ext = ext;
+	m.line_widths = line_widths;
+	m.max_lines = line_widths ? max_lines : 0;
+	m.lines_cleared = 0;
+	
+	ext->num_lines = position_text_chunks( font, text, text_len, enc, max_line_len, measure_sink, &m, num_errors );
+	if ( line_widths )
+		clear_lines( &m, ext->num_lines );
+}
+
+void measure_text( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, TextExtents *ext, int32_t line_widths[], size_t max_lines ) {
+	measure_internal( font, text, text_len, TEXT_UTF32, max_line_len, line_height_scale, ext, line_widths, max_lines, NULL );
+}
+
+void measure_text_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, TextExtents *ext, int32_t line_widths[], size_t max_lines, size_t *num_errors ) {
+	measure_internal( font, text, num_bytes, TEXT_UTF8, max_line_len, line_height_scale, ext, line_widths, max_lines, num_errors );
+}
+
+/* Batches that are smaller than this are measured on the calling thread */
+#define MIN_PARALLEL_TEXTS 256
+
+void measure_texts( struct Font *font, uint32_t const *const texts[], size_t const text_lens[], size_t num_texts, int max_line_len, float line_height_scale, TextExtents ext[] )
+{
+	size_t n;
+	#pragma omp parallel for if( num_texts >= MIN_PARALLEL_TEXTS )
+	for( n=0; n<num_texts; n++ )
+		measure_internal( font, texts[n], text_lens[n], TEXT_UTF32, max_line_len, line_height_scale, ext + n, NULL, 0, NULL );
+}
+
+void measure_texts_utf8( struct Font *font, char const *const texts[], size_t const text_lens[], size_t num_texts, int max_line_len, float line_height_scale, TextExtents ext[] )
+{
+	size_t n;
+	#pragma omp parallel for if( num_texts >= MIN_PARALLEL_TEXTS )
+	for( n=0; n<num_texts; n++ )
+		measure_internal( font, texts[n], text_lens[n], TEXT_UTF8, max_line_len, line_height_scale, ext + n, NULL, 0, NULL );
+}
+
+/* How many code points get_layout_size decodes at a time */
+#define SIZE_CHUNK 256
+
+/* TrueType fonts have at most this many glyphs */
+#define MAX_TTF_GLYPHS 65536
+
+typedef struct {
+	LayoutSize *size;
+	uint32_t seen[ MAX_TTF_GLYPHS / 32 ]; /* one bit per glyph */
+} SizeState;
+
+/* Counts the glyphs that the code points map to. Wrapping doesn't change which glyphs are used so nothing needs to be positioned
+Returns how many code points were counted. Code points at the end that may begin a ligature are left for the next call unless end_of_text is set */
+static size_t count_glyphs( Font *font, SizeState *st, uint32_t const text[], size_t text_len, int end_of_text )
+{
+	LayoutSize *size = st->size;
+	SubstNode const *subst = font->use_subst ? font->subst.nodes : NULL;
+	size_t n = 0;
+	
+	while( n < text_len )
+	{
+		GlyphIndex g;
+		uint32_t bit;
+		size_t used = 1;
+		
+		if ( text[n] == '\n' ) {
+			n++;
+			continue;
+		}
+		
+		g = get_cmap_entry( font, text[n] );
+		if ( subst ) {
+			if ( subst[g].num_edges ) {
+				g = substitute_glyph( font, g, text + n + 1, text_len - n - 1, end_of_text, &used );
+				if ( !used )
+					break;
+			} else {
+				g = subst[g].output;
+			}
+		}
+		
+		bit = (uint32_t) 1 << ( g & 31 );
+		
+		if ( !size->num_glyphs || g < size->min_glyph ) size->min_glyph = g;
+		if ( !size->num_glyphs || g > size->max_glyph ) size->max_glyph = g;
+		size->num_glyphs++;
+		
+		if ( !( st->seen[ g >> 5 ] & bit ) ) {
+			st->seen[ g >> 5 ] |= bit;
+			size->num_batches++;
+		}
+		
+		n += used;
+	}
+	
+	return n;
+}
+
+static void get_layout_size_internal( Font *font, void const *text, size_t text_len, TextEncoding enc, LayoutSize *size )
+{
+	SizeState st;
+	
+	assert( font->num_glyphs <= MAX_TTF_GLYPHS );
+	
+	memset( size, 0, sizeof(*size) );
+	memset( st.seen, 0, sizeof( st.seen ) );
+	st.size = size;
+	
+	if ( enc == TEXT_UTF32 ) {
+		count_glyphs( font, &st, text, text_len, 1 );
+	} else {
+		/* Code points that may begin a ligature are moved to the front of the buffer and counted with the next chunk */
+		uint32_t buf[SIZE_CHUNK + MAX_LIGATURE_LEN];
+		size_t in_pos = 0, errors = 0, kept = 0;
+		while( in_pos < text_len ) {
+			size_t used, n = kept + decode_utf8( buf + kept, SIZE_CHUNK, (uint8_t const*) text + in_pos, text_len - in_pos, &used, &errors );
+			in_pos += used;
+			used = count_glyphs( font, &st, buf, n, in_pos == text_len );
+			kept = n - used;
+			memmove( buf, buf + used, kept * sizeof( buf[0] ) );
+		}
+	}
+	
+	/* Glyph counters of batch_glyphs followed by the positioned characters */
+	size->scratch_bytes = ( size->max_glyph - size->min_glyph + 1 ) * sizeof( size_t ) + size->num_glyphs * sizeof( TempChar );
+}
+
+void get_layout_size( struct Font *font, uint32_t const *text, size_t text_len, LayoutSize *size ) {
+	get_layout_size_internal( font, text, text_len, TEXT_UTF32, size );
+}
+
+void get_layout_size_utf8( struct Font *font, char const *text, size_t num_bytes, LayoutSize *size ) {
+	get_layout_size_internal( font, text, num_bytes, TEXT_UTF8, size );
+}
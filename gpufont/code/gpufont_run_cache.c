@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+#include "opengl.h"
+#include "gpufont_data.h"
+#include "gpufont_layout.h"
+#include "gpufont_run_cache.h"
+#include "layout_internal.h"
+
+/* Smallest hash table (number of chains) */
+#define MIN_RUN_CHAINS 64
+
+typedef struct RunEntry {
+	struct RunEntry *hash_next; /* next entry in the same chain */
+	struct RunEntry *newer, *older; /* LRU list */
+	uint32_t hash;
+	Font *font;
+	TextEncoding enc;
+	int layout_flags; /* font->use_kerning and font->use_subst when the run was laid out */
+	int max_line_len;
+	float line_height_scale;
+	size_t text_bytes;
+	char const *text; /* copy of the key text. Stored after the entry in the same block */
+	GlyphBuffer *run;
+	size_t num_errors; /* malformed UTF-8 sequences in the text */
+	size_t bytes;
+} RunEntry;
+
+struct RunCache {
+	RunEntry **chains;
+	size_t num_chains; /* power of 2 */
+	RunEntry *newest, *oldest;
+	size_t budget;
+	RunCacheStats stats;
+};
+
+static uint32_t hash_bytes( uint32_t h, void const *p, size_t n )
+{
+	uint8_t const *b = p;
+	while( n-- )
+		h = ( h ^ *b++ ) * 16777619u; /* FNV-1a */
+	return h;
+}
+
+/* Runs laid out with kerning or substitution switched differently are different keys */
+static int get_layout_flags( Font const *font ) {
+	return ( font->use_kerning != 0 ) | ( font->use_subst != 0 ) << 1;
+}
+
+static uint32_t hash_key( Font const *font, void const *text, size_t text_bytes, TextEncoding enc, int layout_flags, int max_line_len, float line_height_scale )
+{
+	uint32_t h = 2166136261u;
+	h = hash_bytes( h, &font, sizeof( font ) );
+	h = hash_bytes( h, &enc, sizeof( enc ) );
+	h = hash_bytes( h, &layout_flags, sizeof( layout_flags ) );
+	h = hash_bytes( h, &max_line_len, sizeof( max_line_len ) );
+	h = hash_bytes( h, &line_height_scale, sizeof( line_height_scale ) );
+	return hash_bytes( h, text, text_bytes );
+}
+
+/* CPU and GPU memory used by one run */
+static size_t run_bytes( GlyphBuffer const *b, size_t text_bytes )
+{
+	return sizeof( RunEntry ) + text_bytes + sizeof( *b )
+		+ b->batch_count * ( sizeof( b->glyph_indices[0] ) + sizeof( b->batch_len[0] ) )
+		+ b->total_glyphs * 2 * sizeof( GlyphCoord );
+}
+
+static void unlink_lru( RunCache *c, RunEntry *e )
+{
+	if ( e->newer ) e->newer->older = e->older; else c->newest = e->older;
+	if ( e->older ) e->older->newer = e->newer; else c->oldest = e->newer;
+	e->newer = e->older = NULL;
+}
+
+static void link_newest( RunCache *c, RunEntry *e )
+{
+	e->newer = NULL;
+	e->older = c->newest;
+	if ( c->newest ) c->newest->newer = e; else c->oldest = e;
+	c->newest = e;
+}
+
+static void remove_entry( RunCache *c, RunEntry *e )
+{
+	RunEntry **p = c->chains + ( e->hash & ( c->num_chains - 1 ) );
+	while( *p != e )
+		p = &(*p)->hash_next;
+	*p = e->hash_next;
+	
+	unlink_lru( c, e );
+	c->stats.num_runs--;
+	c->stats.bytes_used -= e->bytes;
+	delete_glyph_buffer( e->run );
+	free( e );
+}
+
+/* Doubles the number of chains when there are more runs than chains. Failure only makes the chains longer */
+static void grow_chains( RunCache *c )
+{
+	RunEntry **chains;
+	size_t n, num_chains = c->num_chains * 2;
+	
+	if ( c->stats.num_runs < c->num_chains )
+		return;
+	
+	chains = calloc( num_chains, sizeof( chains[0] ) );
+	if ( !chains )
+		return;
+	
+	for( n=0; n<c->num_chains; n++ )
+	{
+		RunEntry *e = c->chains[n], *next;
+		for( ; e; e=next ) {
+			RunEntry **dst = chains + ( e->hash & ( num_chains - 1 ) );
+			next = e->hash_next;
+			e->hash_next = *dst;
+			*dst = e;
+		}
+	}
+	
+	free( c->chains );
+	c->chains = chains;
+	c->num_chains = num_chains;
+}
+
+RunCache *create_run_cache( size_t memory_budget )
+{
+	RunCache *c = calloc( 1, sizeof(*c) );
+	
+	if ( !c )
+		return NULL;
+	
+	c->num_chains = MIN_RUN_CHAINS;
+	c->chains = calloc( c->num_chains, sizeof( c->chains[0] ) );
+	c->budget = memory_budget;
+	
+	if ( !c->chains ) {
+		free( c );
+		return NULL;
+	}
+	
+	return c;
+}
+
+void clear_run_cache( RunCache *c )
+{
+	while( c->oldest )
+		remove_entry( c, c->oldest );
+}
+
+void delete_run_cache( RunCache *c )
+{
+	clear_run_cache( c );
+	free( c->chains );
+	free( c );
+}
+
+/* Returns the cached run or lays out and caches a new one
+If the run is too big for the cache, *uncached is set and the caller must delete the run after drawing it. Returns NULL if out of memory */
+static GlyphBuffer *get_run( RunCache *c, Font *font, void const *text, size_t text_bytes, TextEncoding enc, int max_line_len, float line_height_scale, size_t *num_errors, int *uncached )
+{
+	int layout_flags = get_layout_flags( font );
+	uint32_t hash = hash_key( font, text, text_bytes, enc, layout_flags, max_line_len, line_height_scale );
+	RunEntry *e;
+	GlyphBuffer *run;
+	size_t errors = 0, bytes;
+	
+	*uncached = 0;
+	
+	for( e = c->chains[ hash & ( c->num_chains - 1 ) ]; e; e = e->hash_next )
+	{
+		if ( e->hash == hash && e->font == font && e->enc == enc && e->layout_flags == layout_flags && e->max_line_len == max_line_len
+		&& e->line_height_scale == line_height_scale && e->text_bytes == text_bytes && !memcmp( e->text, text, text_bytes ) )
+		{
+			c->stats.hits++;
+			unlink_lru( c, e );
+			link_newest( c, e );
+			if ( num_errors )
+				*num_errors += e->num_errors;
+			return e->run;
+		}
+	}
+	
+	c->stats.misses++;
+	
+	if ( enc == TEXT_UTF8 )
+		run = do_simple_layout_utf8( font, text, text_bytes, max_line_len, line_height_scale, &errors );
+	else
+		run = do_simple_layout( font, text, text_bytes / sizeof( uint32_t ), max_line_len, line_height_scale );
+	
+	if ( !run )
+		return NULL;
+	
+	if ( num_errors )
+		*num_errors += errors;
+	
+	bytes = run_bytes( run, text_bytes );
+	e = bytes <= c->budget ? malloc( sizeof(*e) + text_bytes ) : NULL;
+	if ( !e ) {
+		*uncached = 1;
+		return run;
+	}
+	
+	while( c->stats.bytes_used + bytes > c->budget ) {
+		remove_entry( c, c->oldest );
+		c->stats.evictions++;
+	}
+	
+	memcpy( e + 1, text, text_bytes );
+	e->text = (char const*)( e + 1 );
+	e->text_bytes = text_bytes;
+	e->hash = hash;
+	e->font = font;
+	e->enc = enc;
+	e->layout_flags = layout_flags;
+	e->max_line_len = max_line_len;
+	e->line_height_scale = line_height_scale;
+	e->run = run;
+	e->num_errors = errors;
+	e->bytes = bytes;
+	
+	grow_chains( c );
+	e->hash_next = c->chains[ hash & ( c->num_chains - 1 ) ];
+	c->chains[ hash & ( c->num_chains - 1 ) ] = e;
+	link_newest( c, e );
+	c->stats.num_runs++;
+	c->stats.bytes_used += bytes;
+	
+	return run;
+}
+
+static void draw_cached( RunCache *c, Font *font, void const *text, size_t text_bytes, TextEncoding enc, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags, size_t *num_errors )
+{
+	GlyphBuffer *run;
+	int uncached;
+	
+	if ( !text_bytes )
+		return;
+	
+	run = get_run( c, font, text, text_bytes, enc, max_line_len, line_height_scale, num_errors, &uncached );
+	if ( !run )
+		return;
+	
+	draw_glyph_buffer( font, run, global_transform, draw_flags );
+	if ( uncached )
+		delete_glyph_buffer( run );
+}
+
+void draw_text_cached( RunCache *c, struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags ) {
+	draw_cached( c, font, text, text_len * sizeof( text[0] ), TEXT_UTF32, max_line_len, line_height_scale, global_transform, draw_flags, NULL );
+}
+
+void draw_text_cached_utf8( RunCache *c, struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags, size_t *num_errors ) {
+	draw_cached( c, font, text, num_bytes, TEXT_UTF8, max_line_len, line_height_scale, global_transform, draw_flags, num_errors );
+}
+
+void get_run_cache_stats( RunCache const *c, RunCacheStats *stats ) {
+	*stats = c->stats;
+}
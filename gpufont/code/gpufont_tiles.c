@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "opengl.h"
+#include "gpufont_data.h"
+#include "gpufont_draw.h"
+#include "gpufont_layout.h"
+#include "layout_internal.h"
+
+/* Tile size in EMs when the caller doesn't give one */
+#define DEFAULT_TILE_EMS 8
+
+/* Tiles are made larger until the grid has at most this many cells per glyph (plus a few) */
+#define MAX_CELLS_PER_GLYPH 4
+
+/* Consecutive instances of a batch that are in the same tile */
+typedef struct {
+	uint32_t tile;
+	uint32_t count;
+} TileRun;
+
+struct GlyphTiles {
+	size_t num_tiles; /* cells of the grid */
+	float *bounds; /* xmin, ymin, xmax, ymax of the glyphs of each tile in font units. xmin > xmax if the tile has nothing to draw */
+	uint8_t *visible; /* one per tile. Scratch memory of draw_tiled_batches */
+	size_t *batch_runs; /* the runs of batch b are runs[ batch_runs[b] .. batch_runs[b+1]-1 ] in instance order */
+	TileRun *runs;
+	TileCullStats stats;
+};
+
+void delete_glyph_tiles( GlyphTiles *t )
+{
+	if ( t ) {
+		free( t->bounds );
+		free( t->batch_runs );
+		free( t->runs );
+		free( t );
+	}
+}
+
+static long tile_coord( GlyphCoord x, double tile_size ) {
+	return (long) floor( x / tile_size );
+}
+
+/* Glyphs without an outline have an all-zero bounding box */
+static int has_outline( Font const *font, GlyphIndex g ) {
+	return font->metrics.xmin[g] < font->metrics.xmax[g] && font->metrics.ymin[g] < font->metrics.ymax[g];
+}
+
+int build_glyph_tiles( struct Font *font, GlyphBuffer *b, int32_t tile_size, size_t moved_to[] )
+{
+	size_t n, total = b->total_glyphs, num_tiles, num_runs, first, bt;
+	long x0, y0, gw, gh;
+	GlyphCoord xmin, xmax, ymin, ymax;
+	uint32_t *cell = NULL, *batch_of = NULL, *new_cell = NULL;
+	size_t *start = NULL, *order = NULL;
+	GlyphCoord *new_pos = NULL;
+	GlyphTiles *t = NULL;
+	double size = tile_size > 0 ? tile_size : (double) DEFAULT_TILE_EMS * font->units_per_em;
+	
+	if ( !total )
+		return 1;
+	
+	xmin = xmax = b->positions[0];
+	ymin = ymax = b->positions[1];
+	for( n=1; n<total; n++ ) {
+		GlyphCoord x = b->positions[2*n], y = b->positions[2*n+1];
+		if ( x < xmin ) xmin = x;
+		if ( x > xmax ) xmax = x;
+		if ( y < ymin ) ymin = y;
+		if ( y > ymax ) ymax = y;
+	}
+	
+	/* Sparse text would make a huge grid of mostly empty cells */
+	for( ;; ) {
+		x0 = tile_coord( xmin, size );
+		y0 = tile_coord( ymin, size );
+		gw = tile_coord( xmax, size ) - x0 + 1;
+		gh = tile_coord( ymax, size ) - y0 + 1;
+		if ( (double) gw * gh <= MAX_CELLS_PER_GLYPH * (double) total + 64 )
+			break;
+		size *= 2;
+	}
+	num_tiles = gw * gh;
+	
+	t = calloc( 1, sizeof( *t ) );
+	cell = malloc( total * 3 * sizeof( cell[0] ) );
+	order = malloc( total * sizeof( order[0] ) );
+	start = calloc( num_tiles + b->batch_count + 1, sizeof( start[0] ) );
+	new_pos = malloc( total * 2 * sizeof( new_pos[0] ) );
+	if ( !t || !cell || !order || !start || !new_pos )
+		goto error_handler;
+	batch_of = cell + total;
+	new_cell = batch_of + total;
+	
+	for( n=first=0; n<b->batch_count; n++ ) {
+		size_t k;
+		for( k=0; k<b->batch_len[n]; k++ )
+			batch_of[first+k] = n;
+		first += b->batch_len[n];
+	}
+	
+	/* Stable counting sort of the instances by tile */
+	for( n=0; n<total; n++ ) {
+		long tx = tile_coord( b->positions[2*n], size ) - x0;
+		long ty = tile_coord( b->positions[2*n+1], size ) - y0;
+		cell[n] = ty * gw + tx;
+		start[ cell[n] + 1 ]++;
+	}
+	for( n=0; n<num_tiles; n++ )
+		start[n+1] += start[n];
+	for( n=0; n<total; n++ )
+		order[ start[ cell[n] ]++ ] = n;
+	
+	/* Put the instances back into their batches in tile order. Instances of the same tile keep their text order */
+	{
+		size_t *next = start + num_tiles + 1;
+		for( n=first=0; n<b->batch_count; n++ ) {
+			next[n] = first;
+			first += b->batch_len[n];
+		}
+		for( n=0; n<total; n++ ) {
+			size_t src = order[n], dst = next[ batch_of[src] ]++;
+			new_pos[2*dst] = b->positions[2*src];
+			new_pos[2*dst+1] = b->positions[2*src+1];
+			new_cell[dst] = cell[src];
+			if ( moved_to )
+				moved_to[src] = dst;
+		}
+	}
+	memcpy( b->positions, new_pos, total * 2 * sizeof( new_pos[0] ) );
+	
+	num_runs = 0;
+	for( n=0; n<total; n++ )
+		num_runs += !n || batch_of[n] != batch_of[n-1] || new_cell[n] != new_cell[n-1];
+	
+	t->num_tiles = num_tiles;
+	t->bounds = malloc( num_tiles * ( 4 * sizeof( t->bounds[0] ) + sizeof( t->visible[0] ) ) );
+	t->batch_runs = malloc( ( b->batch_count + 1 ) * sizeof( t->batch_runs[0] ) );
+	t->runs = malloc( num_runs * sizeof( t->runs[0] ) );
+	if ( !t->bounds || !t->batch_runs || !t->runs )
+		goto error_handler;
+	t->visible = (uint8_t*)( t->bounds + 4 * num_tiles );
+	
+	for( n=0; n<num_tiles; n++ ) {
+		t->bounds[4*n] = t->bounds[4*n+1] = 1;
+		t->bounds[4*n+2] = t->bounds[4*n+3] = 0;
+	}
+	
+	num_runs = 0;
+	for( bt=first=0; bt<b->batch_count; bt++ )
+	{
+		GlyphIndex g = b->glyph_indices[bt];
+		int draws = has_outline( font, g );
+		size_t k;
+		
+		t->batch_runs[bt] = num_runs;
+		for( k=first; k<first+b->batch_len[bt]; k++ )
+		{
+			float *box = t->bounds + 4 * new_cell[k];
+			
+			if ( k == first || new_cell[k] != new_cell[k-1] ) {
+				t->runs[num_runs].tile = new_cell[k];
+				t->runs[num_runs].count = 0;
+				num_runs++;
+			}
+			t->runs[num_runs-1].count++;
+			
+			if ( draws ) {
+				float x = new_pos[2*k], y = new_pos[2*k+1];
+				float bx0 = x + font->metrics.xmin[g], by0 = y + font->metrics.ymin[g];
+				float bx1 = x + font->metrics.xmax[g], by1 = y + font->metrics.ymax[g];
+				if ( box[0] > box[2] ) {
+					box[0] = bx0;
+					box[1] = by0;
+					box[2] = bx1;
+					box[3] = by1;
+				} else {
+					if ( bx0 < box[0] ) box[0] = bx0;
+					if ( by0 < box[1] ) box[1] = by0;
+					if ( bx1 > box[2] ) box[2] = bx1;
+					if ( by1 > box[3] ) box[3] = by1;
+				}
+			}
+		}
+		first += b->batch_len[bt];
+	}
+	t->batch_runs[b->batch_count] = num_runs;
+	
+	free( cell );
+	free( order );
+	free( start );
+	free( new_pos );
+	b->tiles = t;
+	return 1;
+
+error_handler:;
+	delete_glyph_tiles( t );
+	if ( cell ) free( cell );
+	if ( order ) free( order );
+	if ( start ) free( start );
+	if ( new_pos ) free( new_pos );
+	return 0;
+}
+
+/* Transforms the corners of a box (in font units) the way the vertex shader does and tests them against the clip volume -w <= x,y,z <= w
+The box is outside if all corners are outside the same plane. This also works for corners that are behind the camera */
+static int box_visible( float const m[16], float const box[4], float scale )
+{
+	unsigned all_out = 0x3F;
+	int k;
+	
+	for( k=0; k<4; k++ )
+	{
+		float x = box[ k & 1 ? 2 : 0 ] * scale;
+		float y = box[ k & 2 ? 3 : 1 ] * scale;
+		float cx = m[0] * x + m[4] * y + m[12];
+		float cy = m[1] * x + m[5] * y + m[13];
+		float cz = m[2] * x + m[6] * y + m[14];
+		float cw = m[3] * x + m[7] * y + m[15];
+		
+		all_out &= ( cx < -cw ) | ( cx > cw ) << 1 | ( cy < -cw ) << 2 | ( cy > cw ) << 3 | ( cz < -cw ) << 4 | ( cz > cw ) << 5;
+	}
+	
+	return !all_out;
+}
+
+void draw_tiled_batches( struct Font *font, GlyphBuffer *buf, float global_transform[16], int draw_flags )
+{
+	GlyphTiles *t = buf->tiles;
+	float scale = 1.0f / font->units_per_em;
+	size_t n, bt, first = 0;
+	
+	for( n=0; n<t->num_tiles; n++ )
+	{
+		float const *box = t->bounds + 4 * n;
+		t->visible[n] = 0;
+		if ( box[0] <= box[2] ) {
+			t->visible[n] = box_visible( global_transform, box, scale );
+			t->stats.tiles_tested++;
+			t->stats.tiles_culled += !t->visible[n];
+		}
+	}
+	
+	/* Neighbouring runs that are visible are drawn with one call */
+	for( bt=0; bt<buf->batch_count; bt++ )
+	{
+		size_t r, draw_first = first, draw_len = 0;
+		
+		for( r=t->batch_runs[bt]; r<=t->batch_runs[bt+1]; r++ )
+		{
+			int vis = r < t->batch_runs[bt+1] && t->visible[ t->runs[r].tile ];
+			
+			if ( vis ) {
+				if ( !draw_len )
+					draw_first = first;
+				draw_len += t->runs[r].count;
+			} else if ( draw_len ) {
+				bind_glyph_positions( buf->positions_vbo, draw_first );
+				draw_glyphs( font, global_transform, buf->glyph_indices[bt], draw_len, draw_flags );
+				t->stats.draw_calls++;
+				t->stats.instances_drawn += draw_len;
+				draw_len = 0;
+			}
+			
+			if ( r < t->batch_runs[bt+1] ) {
+				if ( !vis )
+					t->stats.instances_culled += t->runs[r].count;
+				first += t->runs[r].count;
+			}
+		}
+	}
+	
+	t->stats.draws++;
+}
+
+int get_tile_cull_stats( GlyphBuffer const *b, TileCullStats *stats )
+{
+	if ( !b->tiles ) {
+		memset( stats, 0, sizeof( *stats ) );
+		return 0;
+	}
+	*stats = b->tiles->stats;
+	return 1;
+}
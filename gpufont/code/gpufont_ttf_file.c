@@ -7,6 +7,12 @@
 #include "gpufont_ttf_file.h"
 #include "ttf_defs.h"
 #include "triangulate.h"
+#include "vcache.h"
+#include "kerning.h"
+#include "substitution.h"
+#include "coverage.h"
+#include "subset.h"
+#include "utf_decode.h"
 
 #pragma pack(1)
 
@@ -30,6 +36,13 @@ enum {
 - proper TTC support
 */
 
+/* Which glyphs of the file are loaded. Glyph n of the font is glyph old_index[n] of the file */
+typedef struct {
+	uint32 num_file_glyphs;
+	GlyphIndex *old_index; /* NULL if every glyph is loaded */
+	GlyphIndex *remap; /* new index of each glyph of the file, or num_file_glyphs if the glyph isn't loaded. NULL if every glyph is loaded */
+} GlyphSelection;
+
 static int read_shorts( FILE *fp, uint16 x[], uint32 count )
 {
 	uint32 n;
@@ -42,7 +55,7 @@ static int read_shorts( FILE *fp, uint16 x[], uint32 count )
 
 #if ENABLE_COMPOSITE_GLYPHS
 /* Used by read_glyph */
-static void *read_composite_glyph( FILE *fp, float units_per_em, Font font[1], FontStatus status[1] )
+static void *read_composite_glyph( FILE *fp, float units_per_em, Font font[1], GlyphSelection const sel[1], FontStatus status[1] )
 {
 	/* SubGlyphHeader */
 	struct {
@@ -89,8 +102,10 @@ static void *read_composite_glyph( FILE *fp, float units_per_em, Font font[1], F
 			goto error_handler;
 		}
 		
-		if ( sgh.glyph_index >= font->num_glyphs )
+		if ( sgh.glyph_index >= sel->num_file_glyphs )
 			sgh.glyph_index = 0;
+		else if ( sel->remap )
+			sgh.glyph_index = sel->remap[ sgh.glyph_index ]; /* the parts are always loaded too */
 		
 		sg_indices[ num ] = sgh.glyph_index;
 		
@@ -346,7 +361,7 @@ error_handler:;
 	return glyph;
 }
 
-static FontStatus read_glyph( FILE *fp, Font font[1], uint32 glyph_index, uint32 glyph_file_pos, unsigned glyph_counts[2] )
+static FontStatus read_glyph( FILE *fp, Font font[1], uint32 glyph_index, uint32 glyph_file_pos, GlyphSelection const sel[1], unsigned glyph_counts[2] )
 {
 	/* GlyphHeader */
 	struct {
@@ -361,16 +376,22 @@ static FontStatus read_glyph( FILE *fp, Font font[1], uint32 glyph_index, uint32
 	if ( read_shorts( fp, &header.num_contours, 5 ) )
 		return F_FAIL_EOF;
 	
+	font->metrics.xmin[ glyph_index ] = header.xmin;
+	font->metrics.ymin[ glyph_index ] = header.ymin;
+	font->metrics.xmax[ glyph_index ] = header.xmax;
+	font->metrics.ymax[ glyph_index ] = header.ymax;
+	
 	if ( header.num_contours >= 0x1000 )
 	{
 		#if ENABLE_COMPOSITE_GLYPHS
-		font->glyphs[ glyph_index ] = read_composite_glyph( fp, units_per_em, font, &status );
+		font->glyphs[ glyph_index ] = read_composite_glyph( fp, units_per_em, font, sel, &status );
 		glyph_counts[1] += ( status == F_SUCCESS );
 		
 		if ( DEBUG_DUMP2 && font->glyphs[ glyph_index ] ) {
 			printf( "Glyph %u is a composite glyph. Has %u components\n", (uint) glyph_index, (uint) font->glyphs[ glyph_index ]->num_parts );
 		}
 		#else
+		(void) sel;
 		status = F_SUCCESS;
 		#endif
 	}
@@ -383,85 +404,78 @@ static FontStatus read_glyph( FILE *fp, Font font[1], uint32 glyph_index, uint32
 	return status;
 }
 
-/* Reads both 'loca' and 'glyf' tables */
-static FontStatus read_all_glyphs( FILE *fp, Font font[1], int16 format, uint32 glyph_base_offset )
+/* Reads the 'loca' table as num_glyphs+1 byte offsets into the 'glyf' table. Glyph n has an outline if loca[n+1] > loca[n] */
+static FontStatus read_loca( FILE *fp, uint32 num_glyphs, int16 format, uint32 *loca_out[1] )
 {
-	void *loca_p;
-	uint32 n = 0;
-	FontStatus status;
-	unsigned glyph_counts[2] = {0,0};
+	uint32 *loca, n, count = num_glyphs + 1;
+	FontStatus status = F_SUCCESS;
 	
 	if ( DEBUG_DUMP )
 		printf( "loca format %u (%s)\n", format, format ? "32-bit" : "16-bit" );
 	
+	loca = malloc( count * sizeof( loca[0] ) );
+	if ( !loca )
+		return F_FAIL_ALLOC;
+	
 	if ( format == 0 )
 	{
-		/* 16-bit glyph location table */
-		
-		uint16 *loca, prev_loc;
-		loca = loca_p = calloc( font->num_glyphs, 2 );
-		
-		if ( !loca )
-			return F_FAIL_ALLOC;
+		/* 16-bit glyph location table. The offsets are stored divided by 2 */
+		uint16 *half = malloc( count * sizeof( half[0] ) );
 		
-		if ( read_shorts( fp, loca, font->num_glyphs ) )
+		if ( !half )
+			status = F_FAIL_ALLOC;
+		else if ( read_shorts( fp, half, count ) )
 			status = F_FAIL_EOF;
-		else
-		{
-			prev_loc = loca[1];
-			status = F_FAIL_INCOMPLETE;
-			
-			for( n=0; n<font->num_glyphs; n++ )
-			{
-				uint32 loc = loca[n];
-				
-				if ( loc == prev_loc ) {
-					/* This glyph has no outline and can be left as NULL */
-					continue;
-				}
-				
-				if ( DEBUG_DUMP2 )
-					printf( "Reading glyph %u out of %u\n", (uint) n, (uint) font->num_glyphs );
-				
-				prev_loc = loc;
-				status = read_glyph( fp, font, n, (uint32) loc * 2 + glyph_base_offset, glyph_counts );
-				
-				if ( status != F_SUCCESS )
-					break;
-			}
+		else {
+			for( n=0; n<count; n++ )
+				loca[n] = (uint32) half[n] * 2;
 		}
+		
+		if ( half ) free( half );
 	}
 	else
 	{
 		/* 32-bit glyph location table */
+		if ( fread( loca, 4, count, fp ) != count )
+			status = F_FAIL_EOF;
+		else {
+			for( n=0; n<count; n++ )
+				loca[n] = ntohl( loca[n] );
+		}
+	}
+	
+	if ( status != F_SUCCESS ) {
+		free( loca );
+		return status;
+	}
+	
+	*loca_out = loca;
+	return F_SUCCESS;
+}
+
+/* Reads the outlines of the selected glyphs from the 'glyf' table */
+static FontStatus read_all_glyphs( FILE *fp, Font font[1], uint32 const loca[], uint32 glyph_base_offset, GlyphSelection const sel[1] )
+{
+	uint32 n = 0;
+	FontStatus status = F_SUCCESS;
+	unsigned glyph_counts[2] = {0,0};
+	
+	for( n=0; n<font->num_glyphs; n++ )
+	{
+		uint32 g = sel->old_index ? sel->old_index[n] : n;
 		
-		uint32 *loca, prev_loc;
-		loca = loca_p = calloc( font->num_glyphs, 4 );
+		if ( loca[g+1] <= loca[g] ) {
+			/* This glyph has no outline and can be left as NULL */
+			continue;
+		}
 		
-		if ( !loca )
-			return F_FAIL_ALLOC;
+		if ( DEBUG_DUMP2 )
+			printf( "Reading glyph %u out of %u\n", (uint) g, (uint) sel->num_file_glyphs );
 		
-		if ( fread( loca, 4, font->num_glyphs, fp ) != font->num_glyphs ) {
-			status = F_FAIL_EOF;
-		} else {
-			prev_loc = loca[1];
-			status = F_FAIL_INCOMPLETE;
-			
-			for( n=0; n<font->num_glyphs; n++ )
-			{
-				if ( loca[n] == prev_loc )
-					continue;
-				
-				if ( DEBUG_DUMP2 )
-					printf( "Reading glyph %u out of %u\n", (uint) n, (uint) font->num_glyphs );
-				
-				prev_loc = loca[n];
-				status = read_glyph( fp, font, n, ntohl( loca[n] ) + glyph_base_offset, glyph_counts );
-				
-				if ( status != F_SUCCESS )
-					break;
-			}
-		}
+		status = read_glyph( fp, font, n, loca[g] + glyph_base_offset, sel, glyph_counts );
+		
+		if ( status != F_SUCCESS )
+			break;
 	}
 	
 	if ( DEBUG_DUMP )
@@ -474,10 +488,113 @@ static FontStatus read_all_glyphs( FILE *fp, Font font[1], int16 format, uint32
 			glyph_counts[0], glyph_counts[1] );
 	}
 	
-	free( loca_p );
 	return status;
 }
 
+/* Marks the glyphs that the marked composite glyphs are made of. keep[g] is 1 for glyphs that haven't been looked at yet and 2 for the ones that have
+Malformed composite glyphs are skipped here and reported when the glyphs are read. Returns 1 if any new glyphs were marked */
+static int keep_composite_parts( FILE *fp, Font const font[1], uint32 const loca[], uint32 glyph_base_offset, uint8 keep[] )
+{
+	size_t g;
+	int added = 0;
+	
+	for( g=0; g<font->num_glyphs; g++ )
+	{
+		uint16 num_contours, sgh[2];
+		
+		if ( keep[g] != 1 )
+			continue;
+		
+		keep[g] = 2;
+		
+		if ( loca[g+1] <= loca[g] )
+			continue;
+		if ( fseek( fp, loca[g] + glyph_base_offset, SEEK_SET ) < 0 || read_shorts( fp, &num_contours, 1 ) )
+			continue;
+		if ( num_contours < 0x1000 || fseek( fp, 4*2, SEEK_CUR ) < 0 )
+			continue;
+		
+		/* SubGlyphHeader, arguments and scale of each part */
+		do {
+			long skip;
+			
+			if ( read_shorts( fp, sgh, 2 ) )
+				break;
+			
+			if ( sgh[1] < font->num_glyphs && !keep[ sgh[1] ] ) {
+				keep[ sgh[1] ] = 1;
+				added = 1;
+			}
+			
+			skip = ( sgh[0] & COM_ARGS_ARE_WORDS ) ? 4 : 2;
+			if ( sgh[0] & COM_HAVE_A_SCALE )
+				skip += 2;
+			else if ( sgh[0] & COM_HAVE_X_AND_Y_SCALE )
+				skip += 4;
+			else if ( sgh[0] & COM_HAVE_MATRIX )
+				skip += 8;
+			
+			if ( fseek( fp, skip, SEEK_CUR ) < 0 )
+				break;
+		} while( sgh[0] & COM_MORE_COMPONENTS );
+	}
+	
+	return added;
+}
+
+/* Picks the glyphs that the code points need, renumbers them and drops every other glyph from what has been read so far */
+static FontStatus select_glyph_subset( FILE *fp, Font font[1], uint32 const loca[], uint32 glyph_base_offset, uint32 const codes[], size_t num_codes, GlyphSelection sel[1] )
+{
+	uint8 *keep;
+	size_t n, count = 0;
+	int added;
+	
+	keep = calloc( font->num_glyphs + 1, 1 );
+	sel->remap = malloc( font->num_glyphs * sizeof( sel->remap[0] ) + 1 );
+	if ( !keep || !sel->remap ) {
+		if ( keep ) free( keep );
+		return F_FAIL_ALLOC;
+	}
+	
+	/* Glyph 0 is drawn for the characters that the font doesn't have */
+	keep[0] = 1;
+	for( n=0; n<num_codes; n++ ) {
+		uint32 g = get_cmap_entry( font, codes[n] );
+		if ( g < font->num_glyphs )
+			keep[g] = 1;
+	}
+	
+	/* Composite glyphs need their parts and substitutions can produce glyphs that no code point maps to */
+	do {
+		added = keep_composite_parts( fp, font, loca, glyph_base_offset, keep );
+		added |= add_substituted_glyphs( font, keep );
+	} while( added );
+	
+	for( n=0; n<font->num_glyphs; n++ )
+		sel->remap[n] = keep[n] ? count++ : font->num_glyphs;
+	
+	sel->old_index = malloc( count * sizeof( sel->old_index[0] ) );
+	if ( !sel->old_index ) {
+		free( keep );
+		return F_FAIL_ALLOC;
+	}
+	
+	for( n=0; n<font->num_glyphs; n++ ) {
+		if ( keep[n] )
+			sel->old_index[ sel->remap[n] ] = n;
+	}
+	
+	if ( DEBUG_DUMP )
+		printf( "Subset of %u code points needs %u out of %u glyphs\n", (uint) num_codes, (uint) count, (uint) font->num_glyphs );
+	
+	free( keep );
+	
+	if ( !subset_font_glyphs( font, sel->remap, count ) )
+		return F_FAIL_ALLOC;
+	
+	return F_SUCCESS;
+}
+
 static FontStatus read_cmap_format4( FILE *fp, Font font[1], uint32 total_length )
 {
 	uint16 *whole_table;
@@ -631,10 +748,136 @@ FontStatus read_cmap( FILE *fp, Font *font )
 			return F_FAIL_IMPOSSIBLE;
 	}
 	
+	/* Coverage bitmaps and the glyph to code point index */
+	if ( status == F_SUCCESS && !build_cmap_coverage( font ) )
+		return F_FAIL_ALLOC;
+	
 	return status;
 }
 
-static TrError triangulate_glyphs( Font font[1], size_t first_glyph, size_t last_glyph )
+/* Hash of a simple glyph's outline. Coordinates are taken relative to the bounding box so that translated copies hash the same */
+static uint32 hash_outline( Font const font[1], GlyphIndex glyph_index )
+{
+	GlyphTriangles const *t = &font->glyphs[ glyph_index ]->tris;
+	int32 x0 = font->metrics.xmin[ glyph_index ];
+	int32 y0 = font->metrics.ymin[ glyph_index ];
+	uint32 h = 2166136261u; /* FNV-1a */
+	size_t n;
+	
+	#define HASH_WORD(w) ( h = ( h ^ (uint32)(w) ) * 16777619u )
+	HASH_WORD( t->num_contours );
+	for( n=0; n<t->num_contours; n++ )
+		HASH_WORD( t->end_points[n] );
+	for( n=0; n<t->num_points_orig; n++ ) {
+		HASH_WORD( t->flags[n] );
+		HASH_WORD( (int32) t->points[2*n] - x0 );
+		HASH_WORD( (int32) t->points[2*n+1] - y0 );
+	}
+	#undef HASH_WORD
+	
+	return h;
+}
+
+/* Returns 1 if glyph b is a translated copy of glyph a and the translation fits in GlyphDesc.offset */
+static int same_outline( Font const font[1], GlyphIndex a, GlyphIndex b )
+{
+	GlyphTriangles const *ta = &font->glyphs[a]->tris;
+	GlyphTriangles const *tb = &font->glyphs[b]->tris;
+	int32 dx = font->metrics.xmin[b] - font->metrics.xmin[a];
+	int32 dy = font->metrics.ymin[b] - font->metrics.ymin[a];
+	size_t n;
+	
+	if ( dx < -32768 || dx > 32767 || dy < -32768 || dy > 32767 )
+		return 0;
+	if ( ta->num_points_orig != tb->num_points_orig || ta->num_contours != tb->num_contours )
+		return 0;
+	if ( memcmp( ta->end_points, tb->end_points, ta->num_contours * sizeof( ta->end_points[0] ) ) )
+		return 0;
+	if ( memcmp( ta->flags, tb->flags, ta->num_points_orig * sizeof( ta->flags[0] ) ) )
+		return 0;
+	
+	for( n=0; n<ta->num_points_orig; n++ ) {
+		if ( (int32) ta->points[2*n] + dx != (int32) tb->points[2*n]
+		|| (int32) ta->points[2*n+1] + dy != (int32) tb->points[2*n+1] )
+			return 0;
+	}
+	
+	return 1;
+}
+
+/* Finds simple glyphs that have the same outline as an earlier glyph (up to translation)
+Duplicates are freed before triangulation and recorded in font->glyph_alias so that merge_glyph_data can share the geometry */
+static FontStatus find_duplicate_glyphs( Font font[1] )
+{
+	uint32 *table; /* open addressing hash table of glyph_index+1. zero means empty slot */
+	uint32 *hashes;
+	size_t table_size = 16, mask, n;
+	size_t num_dups = 0;
+	
+	/* Without glyph_alias merge_glyph_data doesn't share any geometry */
+	if ( !font->num_glyphs )
+		return F_SUCCESS;
+	
+	while( table_size < 2 * (size_t) font->num_glyphs )
+		table_size *= 2;
+	mask = table_size - 1;
+	
+	font->glyph_alias = malloc( font->num_glyphs * sizeof( font->glyph_alias[0] ) );
+	table = calloc( table_size, sizeof( table[0] ) );
+	hashes = malloc( font->num_glyphs * sizeof( hashes[0] ) );
+	
+	if ( !font->glyph_alias || !table || !hashes ) {
+		/* merge_glyph_data still runs after a failure and would read the uninitialised aliases */
+		if ( font->glyph_alias ) free( font->glyph_alias );
+		font->glyph_alias = NULL;
+		if ( table ) free( table );
+		if ( hashes ) free( hashes );
+		return F_FAIL_ALLOC;
+	}
+	
+	for( n=0; n<font->num_glyphs; n++ )
+	{
+		SimpleGlyph *g = font->glyphs[n];
+		size_t slot;
+		
+		font->glyph_alias[n] = n;
+		
+		if ( !g || !IS_SIMPLE_GLYPH( g ) )
+			continue;
+		
+		hashes[n] = hash_outline( font, n );
+		
+		for( slot = hashes[n] & mask; table[slot]; slot = ( slot + 1 ) & mask )
+		{
+			GlyphIndex other = table[slot] - 1;
+			if ( hashes[other] == hashes[n] && same_outline( font, other, n ) ) {
+				font->glyph_alias[n] = other;
+				break;
+			}
+		}
+		
+		if ( font->glyph_alias[n] == n ) {
+			table[slot] = n + 1;
+		} else {
+			/* Only the original gets triangulated */
+			free( g->tris.end_points );
+			free( g->tris.points );
+			free( g->tris.flags );
+			free( g );
+			font->glyphs[n] = NULL;
+			num_dups++;
+		}
+	}
+	
+	if ( DEBUG_DUMP )
+		printf( "%u glyphs share their outline with another glyph\n", (uint) num_dups );
+	
+	free( table );
+	free( hashes );
+	return F_SUCCESS;
+}
+
+static TrError triangulate_glyphs( Font font[1], size_t first_glyph, size_t last_glyph, int flags )
 {
 	size_t n;
 	TrError err = TR_SUCCESS;
@@ -665,6 +908,10 @@ static TrError triangulate_glyphs( Font font[1], size_t first_glyph, size_t last
 			free( glyph->tris.end_points );
 			glyph->tris.end_points = NULL;
 			glyph->tris.num_contours = 0;
+			
+			/* Failure only means that the glyph keeps its original order */
+			if ( flags & LOAD_OPTIMIZE_INDICES )
+				optimize_vertex_cache( &glyph->tris, flags & LOAD_RENUMBER_VERTICES );
 		}
 	}
 	
@@ -672,7 +919,7 @@ static TrError triangulate_glyphs( Font font[1], size_t first_glyph, size_t last
 	return err;
 }
 
-static TrError triangulate_all_glyphs( Font font[1] )
+static TrError triangulate_all_glyphs( Font font[1], int flags )
 {
 	if ( !font->num_glyphs )
 		return TR_SUCCESS;
@@ -696,20 +943,21 @@ static TrError triangulate_all_glyphs( Font font[1] )
 			if ( omp_get_thread_num() == numt - 1 )
 				end = font->num_glyphs - 1;
 			
-			triangulate_glyphs( font, start, end );
+			triangulate_glyphs( font, start, end, flags );
 		}
 		
 		/* errors ignored when using openmp */
 		return TR_SUCCESS;
 	}
 	
-	return triangulate_glyphs( font, 0, font->num_glyphs - 1 );
+	return triangulate_glyphs( font, 0, font->num_glyphs - 1, flags );
 }
 
 static FontStatus read_hmtx( FILE *fp, Font font[1], unsigned num_hmetrics )
 {
 	LongHorzMetrics *hmetrics = NULL;
 	FontStatus status;
+	size_t n;
 	
 	int size_test[ sizeof(*hmetrics) == 4 ];
 	(void) size_test;
@@ -728,7 +976,7 @@ static FontStatus read_hmtx( FILE *fp, Font font[1], unsigned num_hmetrics )
 	if ( num_hmetrics < font->num_glyphs )
 	{
 		uint16 last_adv_x = hmetrics[ num_hmetrics - 1 ].adv_width;
-		size_t n, num_lsb, end;
+		size_t num_lsb, end;
 		
 		num_lsb = font->num_glyphs - num_hmetrics;
 		end = num_hmetrics + num_lsb;
@@ -744,6 +992,13 @@ static FontStatus read_hmtx( FILE *fp, Font font[1], unsigned num_hmetrics )
 		}
 	}
 	
+	/* Same metrics again in SoA form */
+	for( n=0; n<font->num_glyphs; n++ )
+	{
+		font->metrics.adv_width[n] = hmetrics[n].adv_width;
+		font->metrics.lsb[n] = hmetrics[n].lsb;
+	}
+	
 	font->hmetrics = hmetrics;
 	return F_SUCCESS;
 	
@@ -752,8 +1007,9 @@ error_handler:;
 	return status;
 }
 
-/* Assumes that the file is positioned after the very first field of Offset Table (sfnt version) */
-static FontStatus read_offset_table( FILE *fp, Font font[1] )
+/* Assumes that the file is positioned after the very first field of Offset Table (sfnt version)
+If subset_codes isn't NULL, only the glyphs of those code points are loaded */
+static FontStatus read_offset_table( FILE *fp, Font font[1], int flags, uint32 const subset_codes[], size_t num_subset_codes )
 {
 	/* Indices of the tables we are interested in.
 	table_pos and table_len are accessed with these  */
@@ -769,14 +1025,22 @@ static FontStatus read_offset_table( FILE *fp, Font font[1] )
 		TAB_VHEA,
 		TAB_VMTX,
 	*/
-		NUM_USED_TABLES
+		NUM_USED_TABLES,
+		/* Optional tables */
+		TAB_KERN=NUM_USED_TABLES,
+		TAB_GPOS,
+		TAB_GSUB,
+		NUM_TABLES
 	};
 	
-	uint32 table_pos[NUM_USED_TABLES] = {0};
+	uint32 table_pos[NUM_TABLES] = {0};
+	uint32 table_len[NUM_TABLES] = {0};
 	uint16 n, num_tables, num_glyphs;
 	HeadTable head = {0};
 	MaxProTableOne maxp = {0};
 	HorzHeaderTable hhea = {0};
+	GlyphSelection sel;
+	uint32 *loca = NULL;
 	int status;
 	
 	if ( read_shorts( fp, &num_tables, 1 ) )
@@ -809,6 +1073,9 @@ static FontStatus read_offset_table( FILE *fp, Font font[1] )
 			case 0x636d6170: tab_num = TAB_CMAP; break;
 			case 0x68686561: tab_num = TAB_HHEA; break;
 			case 0x686d7478: tab_num = TAB_HMTX; break;
+			case 0x6b65726e: tab_num = TAB_KERN; break;
+			case 0x47504f53: tab_num = TAB_GPOS; break;
+			case 0x47535542: tab_num = TAB_GSUB; break;
 			default:
 				if ( DEBUG_DUMP )
 				{
@@ -819,7 +1086,7 @@ static FontStatus read_offset_table( FILE *fp, Font font[1] )
 		}
 		
 		table_pos[ tab_num ] = ntohl( rec.file_offset );
-		/* table_len[ tab_num ] = ntohl( rec.length ); */
+		table_len[ tab_num ] = ntohl( rec.length );
 		/* todo: verify checksum */
 	}
 	
@@ -889,14 +1156,7 @@ static FontStatus read_offset_table( FILE *fp, Font font[1] )
 	
 	font->num_glyphs = num_glyphs;
 	if (( ( font->glyphs = calloc( num_glyphs, sizeof( font->glyphs[0] ) ) ) == NULL )) return F_FAIL_ALLOC;
-	
-	if ( fseek( fp, table_pos[TAB_LOCA], SEEK_SET ) < 0 )
-		return F_FAIL_CORRUPT;
-	
-	/* Read glyph contours using tables "loca" and "glyf" */
-	status = read_all_glyphs( fp, font, head.index_to_loc_format, table_pos[TAB_GLYF] );
-	if ( status != F_SUCCESS )
-		return status;
+	if ( !init_glyph_metrics( font ) ) return F_FAIL_ALLOC;
 	
 	/* Read table "cmap" */
 	if ( fseek( fp, table_pos[TAB_CMAP], SEEK_SET ) < 0 )
@@ -926,6 +1186,36 @@ static FontStatus read_offset_table( FILE *fp, Font font[1] )
 	if ( status != F_SUCCESS )
 		return status;
 	
+	/* Read pair kerning from tables "GPOS" and "kern" (both optional) */
+	if ( !read_kerning( fp, font, table_pos[TAB_GPOS], table_len[TAB_GPOS], table_pos[TAB_KERN], table_len[TAB_KERN] ) )
+		return F_FAIL_ALLOC;
+	
+	/* Read glyph substitutions from table "GSUB" (optional) */
+	if ( !read_substitutions( fp, font, table_pos[TAB_GSUB], table_len[TAB_GSUB], flags & LOAD_VERTICAL_FORMS ) )
+		return F_FAIL_ALLOC;
+	
+	/* Read table "loca". The outlines are read last so that a subset can leave out the glyphs it doesn't need */
+	if ( fseek( fp, table_pos[TAB_LOCA], SEEK_SET ) < 0 )
+		return F_FAIL_CORRUPT;
+	status = read_loca( fp, num_glyphs, head.index_to_loc_format, &loca );
+	if ( status != F_SUCCESS )
+		return status;
+	
+	memset( &sel, 0, sizeof( sel ) );
+	sel.num_file_glyphs = num_glyphs;
+	if ( subset_codes )
+		status = select_glyph_subset( fp, font, loca, table_pos[TAB_GLYF], subset_codes, num_subset_codes, &sel );
+	
+	/* Read glyph contours from table "glyf" */
+	if ( status == F_SUCCESS )
+		status = read_all_glyphs( fp, font, loca, table_pos[TAB_GLYF], &sel );
+	
+	free( loca );
+	if ( sel.old_index ) free( sel.old_index );
+	if ( sel.remap ) free( sel.remap );
+	if ( status != F_SUCCESS )
+		return status;
+	
 	/* todo:
 	
 	handle errors properly
@@ -956,7 +1246,7 @@ static FontStatus read_offset_table( FILE *fp, Font font[1] )
 	return F_SUCCESS;
 }
 
-static FontStatus read_ttc( FILE *fp, Font font[1] )
+static FontStatus read_ttc( FILE *fp, Font font[1], int flags, uint32 const subset_codes[], size_t num_subset_codes )
 {
 	/* the tag "ttcf" has been already consumed */
 	uint32 h[3];
@@ -982,10 +1272,14 @@ static FontStatus read_ttc( FILE *fp, Font font[1] )
 		return F_FAIL_CORRUPT;
 	}
 	
-	return read_offset_table( fp, font );
+	return read_offset_table( fp, font, flags, subset_codes, num_subset_codes );
+}
+
+FontStatus load_ttf_file( struct Font *font, const char filename[] ) {
+	return load_ttf_file_ex( font, filename, 0 );
 }
 
-FontStatus load_ttf_file( struct Font *font, const char filename[] )
+static FontStatus load_font_file( Font font[1], const char filename[], int flags, uint32 const subset_codes[], size_t num_subset_codes )
 {
 	FILE *fp = NULL;
 	uint32 file_ident;
@@ -1009,10 +1303,10 @@ FontStatus load_ttf_file( struct Font *font, const char filename[] )
 		if ( file_ident == htonl( 0x10000 ) ) {
 			/* This is a TrueType font file (sfnt version 1.0)
 			todo: handle other identifiers ("true", "typ1", "OTTO") */
-			status = read_offset_table( fp, font );
+			status = read_offset_table( fp, font, flags, subset_codes, num_subset_codes );
 		} else if ( file_ident == *(uint32*)"ttcf" ) {
 			/* Is a TrueType Collection */
-			status = read_ttc( fp, font );
+			status = read_ttc( fp, font, flags, subset_codes, num_subset_codes );
 		} else {
 			/* Unsupported file format */
 			status = F_FAIL_UNK_FILEF;
@@ -1025,10 +1319,14 @@ FontStatus load_ttf_file( struct Font *font, const char filename[] )
 			printf( "File I/O took %u milliseconds\n", (unsigned) t );
 			#endif
 			
-			if ( triangulate_all_glyphs( font ) != TR_SUCCESS )
+			if ( !( flags & LOAD_NO_DEDUP ) )
+				status = find_duplicate_glyphs( font );
+			
+			if ( status == F_SUCCESS && triangulate_all_glyphs( font, flags ) != TR_SUCCESS )
 				status = F_FAIL_TRIANGULATE;
 			
 			/* Merges contour points, indices and glyph data into large contiguous blocks of memory */
+			font->vertex_layout = ( flags & LOAD_FLOAT_VERTICES ) ? VERTEX_FLOAT : VERTEX_PACKED;
 			if ( !merge_glyph_data( font ) )
 				status = F_FAIL_ALLOC;
 		}
@@ -1037,3 +1335,31 @@ FontStatus load_ttf_file( struct Font *font, const char filename[] )
 	fclose( fp );
 	return status;
 }
+
+FontStatus load_ttf_file_ex( struct Font *font, const char filename[], int flags ) {
+	return load_font_file( font, filename, flags, NULL, 0 );
+}
+
+FontStatus load_ttf_subset( struct Font *font, const char filename[], int flags, uint32_t const code_points[], size_t num_code_points ) {
+	return load_font_file( font, filename, flags, code_points, num_code_points );
+}
+
+FontStatus load_ttf_subset_utf8( struct Font *font, const char filename[], int flags, char const *sample_text, size_t num_bytes )
+{
+	uint32 *codes;
+	size_t used, errors = 0, len;
+	FontStatus status;
+	
+	/* There can't be more code points than bytes */
+	codes = malloc( num_bytes * sizeof( codes[0] ) + 1 );
+	if ( !codes ) {
+		memset( font, 0, sizeof(*font) );
+		return F_FAIL_ALLOC;
+	}
+	
+	len = decode_utf8( codes, num_bytes, (uint8 const*) sample_text, num_bytes, &used, &errors );
+	status = load_font_file( font, filename, flags, codes, len );
+	
+	free( codes );
+	return status;
+}
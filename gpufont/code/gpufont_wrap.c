@@ -0,0 +1,133 @@
+#include "gpufont_data.h"
+#include "layout_internal.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Wrapping to a width in font units. Advances of a line are turned into pen positions with a prefix sum
+and each line break is found with a binary search over the pen positions instead of testing every character */
+
+/* In-place inclusive prefix sum */
+static void prefix_sum( int32_t x[], size_t n )
+{
+	size_t i = 0;
+	int32_t sum = 0;
+	
+	#ifdef __SSE2__
+	__m128i carry = _mm_setzero_si128();
+	for( ; i + 4 <= n; i += 4 )
+	{
+		__m128i v = _mm_loadu_si128( (__m128i const*)( x + i ) );
+		v = _mm_add_epi32( v, _mm_slli_si128( v, 4 ) );
+		v = _mm_add_epi32( v, _mm_slli_si128( v, 8 ) );
+		v = _mm_add_epi32( v, carry );
+		_mm_storeu_si128( (__m128i*)( x + i ), v );
+		carry = _mm_shuffle_epi32( v, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+	}
+	sum = _mm_cvtsi128_si32( carry );
+	#endif
+	
+	for( ; i<n; i++ )
+		x[i] = sum += x[i];
+}
+
+/* Returns the largest e in [lo, hi] with pen[e] <= limit. pen[lo] must be <= limit */
+static size_t find_break( int32_t const pen[], size_t lo, size_t hi, int32_t limit )
+{
+	while( lo < hi ) {
+		size_t mid = lo + ( hi - lo + 1 ) / 2;
+		if ( pen[mid] <= limit )
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/* Kerning between characters k and k+1 of a line of n characters. The same as the layout adds */
+static int32_t kern_after( Font const font[1], TempChar const c[], size_t k, size_t n ) {
+	return k + 1 < n ? kerning_after( font, c[k].glyph, c[k+1].glyph ) : 0;
+}
+
+static int is_break_glyph( GlyphIndex const spaces[], GlyphIndex g ) {
+	return g && ( g == spaces[0] || g == spaces[1] || g == spaces[2] );
+}
+
+void wrap_to_width( Font font[1], TempChar chars[], size_t num_chars, int32_t max_width, int32_t pen[] )
+{
+	GlyphIndex spaces[3];
+	int kern = font->use_kerning && font->kerning.first;
+	int32_t extra_lines = 0; /* rows added by wrapping so far */
+	size_t s = 0;
+	
+	spaces[0] = get_cmap_entry( font, ' ' );
+	spaces[1] = get_cmap_entry( font, '\t' );
+	spaces[2] = get_cmap_entry( font, 0x3000 ); /* ideographic space */
+	
+	while( s < num_chars )
+	{
+		TempChar *c = chars + s;
+		int32_t hard_line = c[0].line_num;
+		size_t n = 1, r = 0, k;
+		
+		while( s + n < num_chars && c[n].line_num == hard_line )
+			n++;
+		
+		/* pen[k] is the pen position before character k of the line. pen[n] is the width of the whole line */
+		pen[0] = 0;
+		for( k=0; k<n; k++ )
+			pen[k+1] = font->metrics.adv_width[ c[k].glyph ];
+		if ( kern ) {
+			/* Kerning is part of the advance of the left glyph */
+			for( k=0; k+1<n; k++ )
+				pen[k+1] += kern_after( font, c, k, n );
+		}
+		prefix_sum( pen + 1, n );
+		
+		while( r < n )
+		{
+			int32_t limit = pen[r] + max_width;
+			size_t e = find_break( pen, r, n, limit ), next;
+			
+			if ( kern ) {
+				/* pen[e] includes the kerning between characters e-1 and e, which doesn't count if the row ends at e */
+				while( e < n && pen[e+1] - kern_after( font, c, e, n ) <= limit )
+					e++;
+				while( e > r && pen[e] - kern_after( font, c, e-1, n ) > limit )
+					e--;
+			}
+			
+			if ( e == n ) {
+				next = n;
+			} else if ( e == r ) {
+				/* A single character that is wider than the line */
+				next = r + 1;
+			} else if ( is_break_glyph( spaces, c[e].glyph ) ) {
+				/* Spaces at the break hang past the end of the line */
+				next = e;
+				while( next < n && is_break_glyph( spaces, c[next].glyph ) )
+					next++;
+			} else {
+				/* Break after the last space that fits. Words longer than the line are broken anywhere */
+				next = e;
+				for( k=e-1; k>r; k-- ) {
+					if ( is_break_glyph( spaces, c[k].glyph ) ) {
+						next = k + 1;
+						break;
+					}
+				}
+			}
+			
+			for( k=r; k<next; k++ ) {
+				c[k].pos_x = pen[k] - pen[r] - font->metrics.lsb[ c[k].glyph ];
+				c[k].line_num = hard_line + extra_lines;
+			}
+			
+			extra_lines += next < n;
+			r = next;
+		}
+		
+		s += n;
+	}
+}
@@ -0,0 +1,437 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gpufont_data.h"
+#include "opentype.h"
+#include "kerning.h"
+
+/* Class based pairs can expand into a pair for every two glyphs. More pairs than this are dropped */
+#define MAX_KERN_PAIRS ( 1 << 21 )
+
+typedef struct {
+	uint16_t left, right;
+	int32_t value;
+	uint32_t order; /* pairs that were read earlier have priority within one GPOS lookup */
+} RawPair;
+
+typedef struct {
+	RawPair *pairs;
+	size_t count, cap;
+	size_t num_glyphs;
+	uint32_t next_order;
+	int out_of_memory;
+} PairList;
+
+static void add_pair( PairList *p, unsigned left, unsigned right, int value )
+{
+	RawPair *r;
+	
+	if ( !value || left >= p->num_glyphs || right >= p->num_glyphs || p->count >= MAX_KERN_PAIRS )
+		return;
+	
+	if ( p->count == p->cap )
+	{
+		size_t cap = p->cap ? p->cap * 2 : 1024;
+		RawPair *pairs = realloc( p->pairs, cap * sizeof( pairs[0] ) );
+		if ( !pairs ) {
+			p->out_of_memory = 1;
+			return;
+		}
+		p->pairs = pairs;
+		p->cap = cap;
+	}
+	
+	r = p->pairs + p->count++;
+	r->left = left;
+	r->right = right;
+	r->value = value;
+	r->order = p->next_order++;
+}
+
+static int compare_pairs( void const *a, void const *b )
+{
+	RawPair const *x = a, *y = b;
+	if ( x->left != y->left ) return x->left < y->left ? -1 : 1;
+	if ( x->right != y->right ) return x->right < y->right ? -1 : 1;
+	if ( x->order != y->order ) return x->order < y->order ? -1 : 1;
+	return 0;
+}
+
+/* Sorts pairs[first..count-1] and merges duplicates. Keeps the first pair if sum is zero, otherwise adds the values together */
+static void merge_duplicates( PairList *p, size_t first, int sum )
+{
+	size_t n, out = first;
+	
+	if ( p->count - first < 2 )
+		return;
+	
+	qsort( p->pairs + first, p->count - first, sizeof( p->pairs[0] ), compare_pairs );
+	
+	for( n=first; n<p->count; n++ )
+	{
+		RawPair *prev = p->pairs + out - 1;
+		if ( out > first && prev->left == p->pairs[n].left && prev->right == p->pairs[n].right ) {
+			if ( sum )
+				prev->value += p->pairs[n].value;
+		} else {
+			p->pairs[out++] = p->pairs[n];
+		}
+	}
+	
+	p->count = out;
+}
+
+/* Fills classes[] (num_glyphs elements, already zeroed) from a class definition table */
+static void read_class_def( OTTable *t, size_t pos, uint16_t classes[], size_t num_glyphs )
+{
+	unsigned format = ot_u16( t, pos );
+	size_t n;
+	
+	if ( format == 1 )
+	{
+		unsigned start = ot_u16( t, pos + 2 ), count = ot_u16( t, pos + 4 );
+		for( n=0; n<count && start + n < num_glyphs; n++ )
+			classes[ start + n ] = ot_u16( t, pos + 6 + 2 * n );
+	}
+	else if ( format == 2 )
+	{
+		unsigned count = ot_u16( t, pos + 2 );
+		for( n=0; n<count; n++ )
+		{
+			size_t rec = pos + 4 + 6 * n;
+			unsigned start = ot_u16( t, rec ), end = ot_u16( t, rec + 2 ), c = ot_u16( t, rec + 4 ), g;
+			for( g=start; g<=end && g<num_glyphs; g++ )
+				classes[g] = c;
+		}
+	}
+	else
+	{
+		t->bad = 1;
+	}
+}
+
+/* Size of a GPOS ValueRecord and the offset of its XAdvance field (or -1 if it has none) */
+static size_t value_record_size( unsigned format )
+{
+	size_t size = 0;
+	for( ; format; format >>= 1 )
+		size += 2 * ( format & 1 );
+	return size;
+}
+
+static long x_advance_offset( unsigned format )
+{
+	if ( !( format & 4 ) )
+		return -1;
+	return value_record_size( format & 3 );
+}
+
+/* Pair adjustment subtable (GPOS lookup type 2). Only the XAdvance of the first glyph is used */
+static void read_pair_pos( OTTable *t, size_t pos, PairList *p )
+{
+	unsigned format = ot_u16( t, pos );
+	unsigned vf1 = ot_u16( t, pos + 4 ), vf2 = ot_u16( t, pos + 6 );
+	size_t rec_size = value_record_size( vf1 ) + value_record_size( vf2 );
+	long xadv = x_advance_offset( vf1 );
+	uint16_t *coverage;
+	size_t num_covered, n, k;
+	
+	if ( xadv < 0 || t->bad )
+		return;
+	
+	num_covered = ot_coverage( t, pos + ot_u16( t, pos + 2 ), NULL );
+	coverage = malloc( ( num_covered + 1 ) * sizeof( coverage[0] ) );
+	if ( !coverage ) {
+		p->out_of_memory = 1;
+		return;
+	}
+	ot_coverage( t, pos + ot_u16( t, pos + 2 ), coverage );
+	
+	if ( format == 1 )
+	{
+		unsigned num_sets = ot_u16( t, pos + 8 );
+		for( n=0; n<num_sets && n<num_covered && !t->bad; n++ )
+		{
+			size_t set = pos + ot_u16( t, pos + 10 + 2 * n );
+			unsigned count = ot_u16( t, set );
+			for( k=0; k<count && !t->bad; k++ ) {
+				size_t rec = set + 2 + k * ( 2 + rec_size );
+				add_pair( p, coverage[n], ot_u16( t, rec ), (int16_t) ot_u16( t, rec + 2 + xadv ) );
+			}
+		}
+	}
+	else if ( format == 2 )
+	{
+		size_t class_def1 = pos + ot_u16( t, pos + 8 ), class_def2 = pos + ot_u16( t, pos + 10 );
+		unsigned num_class1 = ot_u16( t, pos + 12 ), num_class2 = ot_u16( t, pos + 14 ), c1, c2;
+		size_t num_glyphs = p->num_glyphs;
+		/* classes of both class definitions, then the glyphs of each class 2 and where they begin, then the covered glyphs by class 1 and where they begin */
+		uint16_t *classes = calloc( 2 * num_glyphs + 1, sizeof( classes[0] ) );
+		size_t *mem = malloc( ( num_glyphs + num_class2 + 1 + num_covered + num_class1 + 1 ) * sizeof( mem[0] ) );
+		size_t *glyphs2, *first2, *covered1, *first1;
+		
+		if ( !classes || !mem ) {
+			p->out_of_memory = 1;
+			if ( classes ) free( classes );
+			if ( mem ) free( mem );
+			free( coverage );
+			return;
+		}
+		glyphs2 = mem;
+		first2 = glyphs2 + num_glyphs;
+		covered1 = first2 + num_class2 + 1;
+		first1 = covered1 + num_covered;
+		
+		read_class_def( t, class_def1, classes, num_glyphs );
+		read_class_def( t, class_def2, classes + num_glyphs, num_glyphs );
+		
+		/* Group the glyphs by class 2 and the covered glyphs by class 1 (counting sorts)
+		Then each row of values is read once and only the nonzero values are expanded into glyph pairs */
+		memset( first2, 0, ( num_class2 + 1 ) * sizeof( first2[0] ) );
+		for( k=0; k<num_glyphs; k++ ) {
+			if ( classes[ num_glyphs + k ] < num_class2 )
+				first2[ classes[ num_glyphs + k ] + 1 ]++;
+		}
+		for( c2=0; c2<num_class2; c2++ )
+			first2[c2+1] += first2[c2];
+		for( k=0; k<num_glyphs; k++ ) {
+			if ( classes[ num_glyphs + k ] < num_class2 )
+				glyphs2[ first2[ classes[ num_glyphs + k ] ]++ ] = k;
+		}
+		
+		memset( first1, 0, ( num_class1 + 1 ) * sizeof( first1[0] ) );
+		for( n=0; n<num_covered; n++ ) {
+			if ( coverage[n] < num_glyphs && classes[ coverage[n] ] < num_class1 )
+				first1[ classes[ coverage[n] ] + 1 ]++;
+		}
+		for( c1=0; c1<num_class1; c1++ )
+			first1[c1+1] += first1[c1];
+		for( n=0; n<num_covered; n++ ) {
+			if ( coverage[n] < num_glyphs && classes[ coverage[n] ] < num_class1 )
+				covered1[ first1[ classes[ coverage[n] ] ]++ ] = n;
+		}
+		
+		/* The fill loops left first2[c] and first1[c] where class c ends */
+		for( c1=0; c1<num_class1 && !t->bad && p->count < MAX_KERN_PAIRS; c1++ )
+		{
+			size_t row = pos + 16 + (size_t) c1 * num_class2 * rec_size;
+			size_t begin1 = c1 ? first1[c1-1] : 0;
+			
+			if ( begin1 == first1[c1] )
+				continue;
+			
+			for( c2=0; c2<num_class2 && !t->bad && p->count < MAX_KERN_PAIRS; c2++ )
+			{
+				size_t begin2 = c2 ? first2[c2-1] : 0, g1, g2;
+				int value = (int16_t) ot_u16( t, row + c2 * rec_size + xadv );
+				
+				if ( !value )
+					continue;
+				
+				for( g1=begin1; g1<first1[c1] && p->count < MAX_KERN_PAIRS; g1++ ) {
+					for( g2=begin2; g2<first2[c2]; g2++ )
+						add_pair( p, coverage[ covered1[g1] ], glyphs2[g2], value );
+				}
+			}
+		}
+		
+		free( classes );
+		free( mem );
+	}
+	
+	free( coverage );
+}
+
+/* Reads the pair adjustment lookups of all 'kern' features */
+static void read_gpos( OTTable *t, PairList *p )
+{
+	static char const *const tags[] = { "kern" };
+	size_t lookup_list = ot_u16( t, 8 ), n, k;
+	unsigned num_lookups;
+	uint8_t *used;
+	
+	if ( ot_u16( t, 0 ) != 1 )
+		return;
+	
+	used = ot_feature_lookups( t, tags, 1, &num_lookups );
+	if ( !used ) {
+		p->out_of_memory = 1;
+		return;
+	}
+	
+	/* Lookups are applied in lookup list order and their adjustments add up. Within a lookup the first subtable that has the pair wins */
+	for( n=0; n<num_lookups && !t->bad; n++ )
+	{
+		size_t lookup = lookup_list + ot_u16( t, lookup_list + 2 + 2 * n );
+		unsigned num_subtables = ot_u16( t, lookup + 4 );
+		size_t first = p->count;
+		
+		if ( !used[n] )
+			continue;
+		
+		for( k=0; k<num_subtables; k++ )
+		{
+			unsigned type;
+			size_t sub = ot_subtable( t, lookup, k, 9, &type );
+			if ( type == 2 && !t->bad )
+				read_pair_pos( t, sub, p );
+		}
+		
+		merge_duplicates( p, first, 0 );
+	}
+	
+	free( used );
+}
+
+/* Reads the format 0 subtables of a Microsoft 'kern' table (version 0) */
+static void read_kern( OTTable *t, PairList *p )
+{
+	unsigned num_subtables, n, k;
+	size_t pos = 4;
+	
+	if ( ot_u16( t, 0 ) != 0 )
+		return;
+	
+	num_subtables = ot_u16( t, 2 );
+	for( n=0; n<num_subtables && !t->bad; n++ )
+	{
+		unsigned length = ot_u16( t, pos + 2 ), coverage = ot_u16( t, pos + 4 );
+		
+		/* Format 0, horizontal, not minimum values, not cross-stream */
+		if ( ( coverage >> 8 ) == 0 && ( coverage & 7 ) == 1 )
+		{
+			unsigned num_pairs = ot_u16( t, pos + 6 );
+			for( k=0; k<num_pairs && !t->bad; k++ ) {
+				size_t rec = pos + 14 + 6 * k;
+				add_pair( p, ot_u16( t, rec ), ot_u16( t, rec + 2 ), (int16_t) ot_u16( t, rec + 4 ) );
+			}
+		}
+		
+		pos += length;
+	}
+}
+
+/* Converts the sorted pair list to KernPairs */
+static int build_kern_pairs( PairList *p, KernPairs *k )
+{
+	size_t n, num_glyphs = p->num_glyphs;
+	
+	k->first = malloc( ( num_glyphs + 1 ) * sizeof( k->first[0] ) + p->count * ( sizeof( k->right[0] ) + sizeof( k->value[0] ) ) );
+	if ( !k->first )
+		return 0;
+	
+	k->right = (uint16_t*)( k->first + num_glyphs + 1 );
+	k->value = (int16_t*)( k->right + p->count );
+	k->num_pairs = p->count;
+	
+	memset( k->first, 0, ( num_glyphs + 1 ) * sizeof( k->first[0] ) );
+	for( n=0; n<p->count; n++ ) {
+		k->first[ p->pairs[n].left + 1 ]++;
+		k->right[n] = p->pairs[n].right;
+		k->value[n] = p->pairs[n].value < -32768 ? -32768 : ( p->pairs[n].value > 32767 ? 32767 : p->pairs[n].value );
+	}
+	for( n=0; n<num_glyphs; n++ )
+		k->first[n+1] += k->first[n];
+	
+	return 1;
+}
+
+int read_kerning( FILE *fp, Font font[1], uint32_t gpos_pos, uint32_t gpos_len, uint32_t kern_pos, uint32_t kern_len )
+{
+	PairList p;
+	OTTable t;
+	size_t n, out;
+	int ok = 1;
+	
+	memset( &p, 0, sizeof( p ) );
+	memset( &font->kerning, 0, sizeof( font->kerning ) );
+	font->use_kerning = 1;
+	p.num_glyphs = font->num_glyphs;
+	
+	if ( gpos_pos ) {
+		if ( !load_ot_table( fp, gpos_pos, gpos_len, &t ) )
+			return 0;
+		read_gpos( &t, &p );
+		free( t.data );
+	}
+	
+	if ( kern_pos && !p.count && !p.out_of_memory ) {
+		if ( !load_ot_table( fp, kern_pos, kern_len, &t ) )
+			return 0;
+		read_kern( &t, &p );
+		free( t.data );
+	}
+	
+	if ( p.out_of_memory ) {
+		free( p.pairs );
+		return 0;
+	}
+	
+	/* Adjustments of the same pair from different lookups (or 'kern' subtables) add up. Pairs that cancel out are dropped */
+	merge_duplicates( &p, 0, 1 );
+	for( n=out=0; n<p.count; n++ ) {
+		if ( p.pairs[n].value )
+			p.pairs[out++] = p.pairs[n];
+	}
+	p.count = out;
+	
+	if ( p.count )
+		ok = build_kern_pairs( &p, &font->kerning );
+	
+	free( p.pairs );
+	return ok;
+}
+
+int subset_kerning( KernPairs *k, size_t num_glyphs, GlyphIndex const remap[], size_t new_num_glyphs )
+{
+	PairList p;
+	size_t left, n;
+	int ok = 1;
+	
+	if ( !k->first )
+		return 1;
+	
+	memset( &p, 0, sizeof( p ) );
+	p.num_glyphs = new_num_glyphs;
+	
+	/* The remapping keeps the order of the glyphs, so the pairs stay sorted */
+	for( left=0; left<num_glyphs && !p.out_of_memory; left++ )
+	{
+		if ( remap[left] >= new_num_glyphs )
+			continue;
+		for( n=k->first[left]; n<k->first[left+1]; n++ ) {
+			if ( remap[ k->right[n] ] < new_num_glyphs )
+				add_pair( &p, remap[left], remap[ k->right[n] ], k->value[n] );
+		}
+	}
+	
+	if ( p.out_of_memory ) {
+		free( p.pairs );
+		return 0;
+	}
+	
+	free( k->first );
+	memset( k, 0, sizeof( *k ) );
+	
+	if ( p.count )
+		ok = build_kern_pairs( &p, k );
+	
+	free( p.pairs );
+	return ok;
+}
+
+int get_kerning( KernPairs const *k, GlyphIndex left, GlyphIndex right )
+{
+	uint32_t lo = k->first[left], hi = k->first[left+1];
+	
+	while( lo < hi ) {
+		uint32_t mid = lo + ( hi - lo ) / 2;
+		if ( k->right[mid] < right )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	if ( lo < k->first[left+1] && k->right[lo] == right )
+		return k->value[lo];
+	return 0;
+}
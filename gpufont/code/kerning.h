@@ -0,0 +1,23 @@
+#ifndef _KERNING_H
+#define _KERNING_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "gpufont_data.h"
+
+/* Pair kerning from the 'GPOS' and 'kern' tables (used by ttf_file.c and the layout code) */
+
+/* Reads pair kerning into font->kerning. Either table may be missing (position 0)
+GPOS pair adjustment lookups of the 'kern' feature are used if there are any, otherwise the 'kern' table
+Class based pairs are expanded into glyph pairs. Pairs past MAX_KERN_PAIRS (see kerning.c) are dropped
+Reading stops at the first malformed subtable. Returns 0 only if out of memory */
+int read_kerning( FILE *fp, Font font[1], uint32_t gpos_pos, uint32_t gpos_len, uint32_t kern_pos, uint32_t kern_len );
+
+/* Drops the pairs of glyphs that aren't kept and renumbers the rest. remap[g] is the new index of glyph g, or new_num_glyphs or more if g is dropped
+The new indices must be in the same order as the old ones. Returns 0 only if out of memory */
+int subset_kerning( KernPairs *k, size_t num_glyphs, GlyphIndex const remap[], size_t new_num_glyphs );
+
+/* Kerning between two glyphs in EM units. The layout code checks font->kerning.first for an empty range before calling this */
+int get_kerning( KernPairs const *k, GlyphIndex left, GlyphIndex right );
+
+#endif
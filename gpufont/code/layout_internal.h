@@ -0,0 +1,126 @@
+#ifndef _LAYOUT_INTERNAL_H
+#define _LAYOUT_INTERNAL_H
+#include <stddef.h>
+#include <stdint.h>
+#include "opengl.h"
+#include "gpufont_data.h"
+#include "gpufont_layout.h"
+#include "substitution.h"
+
+/* Building blocks of gpufont_layout.c that are shared with the other layout modules */
+
+typedef struct GlyphTiles GlyphTiles;
+typedef struct HitIndex HitIndex;
+
+struct GlyphBuffer {
+	size_t batch_count; /* how many batches */
+	size_t total_glyphs;
+	GlyphCoord *positions; /* glyph position array */
+	GlyphIndex *glyph_indices; /* one glyph index per batch */
+	size_t *batch_len; /* length of each batch */
+	GLuint positions_vbo;
+	GlyphTiles *tiles; /* NULL unless the buffer was laid out with do_tiled_layout or tiled by do_indexed_layout */
+	HitIndex *hits; /* NULL unless the buffer was laid out with do_indexed_layout */
+};
+
+/* Line heights are fixed point numbers with this many fractional bits */
+#define LINEH_PREC 10
+
+typedef struct {
+	GlyphIndex glyph;
+	int32_t line_num;
+	int32_t pos_x;
+	uint32_t text_pos; /* code point index of the first character of the glyph, counted from where the cursor started (modulo 2^32) */
+} TempChar;
+
+typedef enum {
+	TEXT_UTF32,
+	TEXT_UTF8,
+	TEXT_UTF16
+} TextEncoding;
+
+/* Where the next character goes. Carried over from one chunk of text to the next */
+typedef struct {
+	int32_t pos_x;
+	int32_t line;
+	int column;
+	GlyphIndex prev_glyph; /* kerned against the next character. 0 at the beginning of a line */
+	uint32_t text_pos; /* code points consumed so far, including newlines */
+	uint32_t pending[MAX_LIGATURE_LEN]; /* code points at the end of the previous piece of text that may be the beginning of a ligature */
+	size_t num_pending;
+} LayoutCursor;
+
+/* A piece of text that was laid out independently of the others. Parallel layout splits the text into spans that begin right after a newline */
+typedef struct {
+	size_t text_begin, text_end; /* code units */
+	size_t first_char; /* where the glyphs of this span are in chars[] */
+	size_t num_chars;
+	int32_t first_line; /* added to line numbers of the span */
+	int32_t num_lines; /* newlines and wraps inside the span */
+	size_t num_errors;
+	GlyphIndex min_glyph, max_glyph;
+} LayoutSpan;
+
+/* Returned by the layout functions for empty text. delete_glyph_buffer doesn't free it */
+extern GlyphBuffer THE_EMPTY_BUFFER;
+
+/* Smallest position VBO (in glyphs) of the modules that keep one VBO and grow it */
+#define MIN_VBO_GLYPHS 1024
+
+/* Binds *vbo to GL_ARRAY_BUFFER, creating it if it is 0, and orphans its storage before new data is uploaded with glBufferSubData
+Orphaning lets the driver keep drawing from the old storage. If num_glyphs doesn't fit in *cap, *cap grows to 1.5 times num_glyphs (at least MIN_VBO_GLYPHS)
+glyph_size is the number of bytes per glyph. Returns 1 if the buffer was grown */
+int orphan_glyph_vbo( GLuint *vbo, size_t *cap, size_t num_glyphs, size_t glyph_size );
+
+/* Draws every batch of buf. The positions of the first batch begin at glyph 'first' of vbo */
+void draw_batches( struct Font *font, GlyphBuffer const *buf, GLuint vbo, size_t first, float global_transform[16], int draw_flags );
+
+/* Line height in font units (fixed point, see LINEH_PREC). The y coordinate of line n is n * line_height >> LINEH_PREC */
+long get_line_height( struct Font *font, float line_height_scale );
+
+/* The steps of positioning one character, shared by all layout code so that they can't drift apart
+cursor_newline moves the cursor to the beginning of the next line (after a newline character or a wrap)
+kerning_after is the kerning between the previous glyph and the next one in units of the font. It is 0 if kerning is off or prev is 0 (beginning of a line)
+place_glyph adds the kerning, writes the glyph at the cursor and advances the cursor, or wraps if the line already has max_line_len characters
+Its lengths are in layout units. The glyph is also what the next character is kerned against
+Both leave cur->text_pos alone. The caller adds the code points of the newline or the glyph to it */
+void cursor_newline( LayoutCursor *cur );
+int32_t kerning_after( Font const font[1], GlyphIndex prev, GlyphIndex glyph );
+void place_glyph( LayoutCursor *cur, TempChar *out, GlyphIndex glyph, int32_t kerning, int32_t lsb, int32_t adv_width, int max_line_len );
+
+/* Maps code points to glyphs, applies glyph substitution and computes the position of each visible glyph relative to the cursor. Advances the cursor
+If end_of_text is 0, code points at the end that may begin a ligature are held back in the cursor and positioned by the next call
+Returns the number of glyphs written to chars[] (newlines don't produce glyphs, a ligature is one glyph). This can be up to MAX_LIGATURE_LEN - 1 more than text_len because of held back code points */
+size_t init_glyph_positions( Font font[1], TempChar chars[], uint32_t const text[], size_t text_len, int max_line_len, int end_of_text, LayoutCursor *cur );
+
+/* Same as init_glyph_positions but decodes the text first. Processes at most max_chars code points */
+size_t map_text( Font font[1], TempChar chars[], void const *text, size_t text_len, TextEncoding enc, size_t max_chars, int max_line_len, LayoutCursor *cur, size_t *num_errors );
+
+/* Rewraps characters that were positioned without wrapping (line_num is the number of the hard line) so that no line is wider than max_width font units
+Changes pos_x and line_num in place. pen is scratch memory for num_chars + 1 elements */
+void wrap_to_width( Font font[1], TempChar chars[], size_t num_chars, int32_t max_width, int32_t pen[] );
+
+/* Called with the glyphs of each chunk of text */
+typedef void (*CharSink)( struct Font *font, void *state, TempChar const chars[], size_t num_chars );
+
+/* Positions the text in chunks that fit in stack buffers and passes each chunk to sink. Returns the number of lines */
+size_t position_text_chunks( Font font[1], void const *text, size_t text_len, TextEncoding enc, int max_line_len, CharSink sink, void *state, size_t *num_errors );
+
+/* Sorts the glyphs of the spans into batches (see gpufont_layout.c). counters may be NULL */
+int batch_glyphs( struct Font *font, TempChar const chars[], LayoutSpan spans[], size_t num_spans, float line_height_scale, GlyphBuffer *output, size_t *counters );
+
+/* Reorders the positions of each batch by tile and sets b->tiles (gpufont_tiles.c). Must be called before the positions are uploaded
+tile_size is in font units. 0 picks a default. If moved_to is not NULL, moved_to[n] is set to where the instance at n went. Returns 0 if out of memory */
+int build_glyph_tiles( struct Font *font, GlyphBuffer *b, int32_t tile_size, size_t moved_to[] );
+void delete_glyph_tiles( GlyphTiles *t );
+
+/* Draws the batches of a tiled buffer, skipping the tiles that global_transform puts outside the clip volume */
+void draw_tiled_batches( struct Font *font, GlyphBuffer *buf, float global_transform[16], int draw_flags );
+
+/* Builds b->hits from the glyphs of the text in text order (gpufont_hit_index.c). chars[] are the b->total_glyphs glyphs that b was batched from
+and num_lines is the line count of the layout (cursor line + 1). Their text_pos must count from the beginning of the text
+moved_to is NULL or tells where build_glyph_tiles moved each instance. Returns 0 if out of memory or if chars[] don't match the text */
+int build_hit_index( struct Font *font, GlyphBuffer *b, void const *text, size_t text_len, TextEncoding enc, TempChar const chars[], size_t num_lines, float line_height_scale, size_t const moved_to[] );
+void delete_hit_index( HitIndex *h );
+
+#endif
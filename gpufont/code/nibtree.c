@@ -102,3 +102,25 @@ NibValue nibtree_get( NibTree tree[1], NibValue key )
 	
 	return node[ key & 0xF ];
 }
+
+static void walk_node( NibTree tree[1], NibValue offset, NibValue key, NibValue nibble_pos, NibWalkFunc func, void *user_data )
+{
+	NibValue const *node = tree->data + offset;
+	NibValue n;
+	
+	for( n=0; n<16; n++ )
+	{
+		if ( !node[n] )
+			continue;
+		if ( nibble_pos )
+			walk_node( tree, node[n], key | n << nibble_pos, nibble_pos - 4, func, user_data );
+		else
+			func( user_data, key | n, node[n] );
+	}
+}
+
+void nibtree_walk( NibTree tree[1], NibWalkFunc func, void *user_data )
+{
+	if ( tree->data )
+		walk_node( tree, 0, 0, 28, func, user_data );
+}
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <string.h>
+#include "opentype.h"
+
+int load_ot_table( FILE *fp, uint32_t pos, uint32_t len, OTTable *t )
+{
+	t->bad = 0;
+	t->len = len;
+	t->data = malloc( len + 1 );
+	if ( !t->data )
+		return 0;
+	if ( fseek( fp, pos, SEEK_SET ) < 0 || fread( t->data, 1, len, fp ) != len )
+		t->len = 0;
+	return 1;
+}
+
+unsigned ot_u16( OTTable *t, size_t pos )
+{
+	if ( pos + 2 > t->len ) {
+		t->bad = 1;
+		return 0;
+	}
+	return t->data[pos] << 8 | t->data[pos+1];
+}
+
+uint32_t ot_u32( OTTable *t, size_t pos ) {
+	return (uint32_t) ot_u16( t, pos ) << 16 | ot_u16( t, pos + 2 );
+}
+
+size_t ot_coverage( OTTable *t, size_t pos, uint16_t glyphs[] )
+{
+	unsigned format = ot_u16( t, pos );
+	unsigned count = ot_u16( t, pos + 2 );
+	size_t n, total = 0;
+	
+	if ( format == 1 ) {
+		if ( glyphs ) {
+			for( n=0; n<count; n++ )
+				glyphs[n] = ot_u16( t, pos + 4 + 2 * n );
+		}
+		return count;
+	}
+	
+	if ( format == 2 ) {
+		/* Ranges must be sorted and must not overlap. Otherwise a few bytes could cover billions of glyphs */
+		long prev_end = -1;
+		for( n=0; n<count; n++ )
+		{
+			size_t rec = pos + 4 + 6 * n;
+			unsigned start = ot_u16( t, rec ), end = ot_u16( t, rec + 2 ), g;
+			if ( t->bad )
+				break;
+			if ( end < start || (long) start <= prev_end ) {
+				t->bad = 1;
+				break;
+			}
+			prev_end = end;
+			for( g=start; g<=end; g++ ) {
+				if ( glyphs )
+					glyphs[total] = g;
+				total++;
+			}
+		}
+		return total;
+	}
+	
+	t->bad = 1;
+	return 0;
+}
+
+uint8_t *ot_feature_lookups( OTTable *t, char const *const tags[], size_t num_tags, unsigned *num_lookups )
+{
+	size_t feature_list = ot_u16( t, 6 ), lookup_list = ot_u16( t, 8 ), n, k;
+	unsigned num_features = ot_u16( t, feature_list );
+	uint8_t *used;
+	
+	*num_lookups = ot_u16( t, lookup_list );
+	used = calloc( *num_lookups + 1, 1 );
+	if ( !used )
+		return NULL;
+	
+	/* The same feature may be listed once per script. Each of its lookups is applied once */
+	for( n=0; n<num_features && !t->bad; n++ )
+	{
+		size_t rec = feature_list + 2 + 6 * n, feature;
+		unsigned count;
+		
+		if ( rec + 6 > t->len )
+			break;
+		
+		for( k=0; k<num_tags && memcmp( t->data + rec, tags[k], 4 ); k++ ) {}
+		if ( k == num_tags )
+			continue;
+		
+		feature = feature_list + ot_u16( t, rec + 4 );
+		count = ot_u16( t, feature + 2 );
+		for( k=0; k<count; k++ ) {
+			unsigned index = ot_u16( t, feature + 4 + 2 * k );
+			if ( index < *num_lookups )
+				used[index] = 1;
+		}
+	}
+	
+	return used;
+}
+
+size_t ot_subtable( OTTable *t, size_t lookup, unsigned k, unsigned ext_type, unsigned *type )
+{
+	size_t sub = lookup + ot_u16( t, lookup + 6 + 2 * k );
+	
+	*type = ot_u16( t, lookup );
+	if ( *type == ext_type ) {
+		*type = ot_u16( t, sub + 2 );
+		sub += ot_u32( t, sub + 4 );
+	}
+	
+	return sub;
+}
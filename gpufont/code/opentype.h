@@ -0,0 +1,32 @@
+#ifndef _OPENTYPE_H
+#define _OPENTYPE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Reading of the OpenType layout tables (GPOS and GSUB) that are used by kerning.c and substitution.c */
+
+/* A whole table in memory. Reads are big endian and bounds checked: reading past the end gives 0 and sets 'bad' */
+typedef struct {
+	uint8_t *data;
+	size_t len;
+	int bad;
+} OTTable;
+
+/* Reads a table into memory. A table that can't be read is left empty. Returns 0 only if out of memory */
+int load_ot_table( FILE *fp, uint32_t pos, uint32_t len, OTTable *t );
+
+unsigned ot_u16( OTTable *t, size_t pos );
+uint32_t ot_u32( OTTable *t, size_t pos );
+
+/* Returns the number of glyphs in a coverage table and writes them to glyphs[] (if not NULL) in coverage index order */
+size_t ot_coverage( OTTable *t, size_t pos, uint16_t glyphs[] );
+
+/* Finds the lookups of the features that have one of the given tags, in any script
+Returns an array of num_lookups flags (1 = used) or NULL if out of memory */
+uint8_t *ot_feature_lookups( OTTable *t, char const *const tags[], size_t num_tags, unsigned *num_lookups );
+
+/* Position of subtable k of a lookup and its lookup type. Subtables of extension lookups (ext_type) are resolved to the real subtable */
+size_t ot_subtable( OTTable *t, size_t lookup, unsigned k, unsigned ext_type, unsigned *type );
+
+#endif
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gpufont_data.h"
+#include "kerning.h"
+#include "substitution.h"
+#include "coverage.h"
+#include "subset.h"
+
+typedef struct {
+	NibTree cmap;
+	GlyphIndex const *remap;
+	size_t num_glyphs;
+	size_t new_num_glyphs;
+	int out_of_memory;
+} CmapSubset;
+
+static void add_cmap_entry( void *p, NibValue code, NibValue glyph )
+{
+	CmapSubset *c = p;
+	
+	/* Characters of dropped glyphs become characters that the font doesn't have */
+	if ( glyph >= c->num_glyphs || c->remap[glyph] >= c->new_num_glyphs || !c->remap[glyph] )
+		return;
+	
+	if ( !nibtree_set( &c->cmap, code, c->remap[glyph] ) )
+		c->out_of_memory = 1;
+}
+
+static int subset_cmap( Font font[1], GlyphIndex const remap[], size_t new_num_glyphs )
+{
+	CmapSubset c;
+	
+	memset( &c, 0, sizeof( c ) );
+	c.remap = remap;
+	c.num_glyphs = font->num_glyphs;
+	c.new_num_glyphs = new_num_glyphs;
+	
+	nibtree_walk( &font->cmap, add_cmap_entry, &c );
+	if ( c.out_of_memory ) {
+		free( c.cmap.data );
+		return 0;
+	}
+	
+	free( font->cmap.data );
+	font->cmap = c.cmap;
+	return 1;
+}
+
+int subset_font_glyphs( Font font[1], GlyphIndex const remap[], size_t new_num_glyphs )
+{
+	GlyphMetrics old = font->metrics;
+	size_t n, num_glyphs = font->num_glyphs;
+	
+	if ( !subset_kerning( &font->kerning, num_glyphs, remap, new_num_glyphs ) )
+		return 0;
+	if ( !subset_substitutions( &font->subst, num_glyphs, remap, new_num_glyphs ) )
+		return 0;
+	if ( !subset_cmap( font, remap, new_num_glyphs ) )
+		return 0;
+	
+	font->num_glyphs = new_num_glyphs;
+	if ( !init_glyph_metrics( font ) ) {
+		font->metrics = old;
+		font->num_glyphs = num_glyphs;
+		return 0;
+	}
+	
+	/* New indices are never larger than the old ones, so hmetrics can be compacted in place */
+	for( n=0; n<num_glyphs; n++ )
+	{
+		GlyphIndex g = remap[n];
+		
+		if ( g >= new_num_glyphs )
+			continue;
+		
+		font->metrics.adv_width[g] = old.adv_width[n];
+		font->metrics.lsb[g] = old.lsb[n];
+		font->metrics.xmin[g] = old.xmin[n];
+		font->metrics.ymin[g] = old.ymin[n];
+		font->metrics.xmax[g] = old.xmax[n];
+		font->metrics.ymax[g] = old.ymax[n];
+		if ( font->hmetrics )
+			font->hmetrics[g] = font->hmetrics[n];
+	}
+	free( old.adv_width );
+	
+	/* The reverse index has one entry per glyph */
+	free( font->coverage.bits );
+	free( font->coverage.glyph_first );
+	return build_cmap_coverage( font );
+}
@@ -0,0 +1,13 @@
+#ifndef _SUBSET_H
+#define _SUBSET_H
+#include <stddef.h>
+#include "gpufont_data.h"
+
+/* Glyph subsetting while loading (used by ttf_file.c) */
+
+/* Renumbers the kept glyphs densely and drops the others from the metrics, cmap, coverage, kerning and substitutions
+remap[g] is the new index of glyph g, or new_num_glyphs or more if g is dropped. The new indices must be in the same order as the old ones and glyph 0 must be kept
+Call before any outlines have been read. Sets font->num_glyphs to new_num_glyphs. Returns 0 if out of memory */
+int subset_font_glyphs( Font font[1], GlyphIndex const remap[], size_t new_num_glyphs );
+
+#endif
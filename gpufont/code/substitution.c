@@ -0,0 +1,551 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gpufont_data.h"
+#include "opentype.h"
+#include "substitution.h"
+
+/* Trie node while compiling. Children are linked lists, 0 means none (node 0 is a start state so it can't be a child) */
+typedef struct {
+	GlyphIndex glyph;
+	GlyphIndex output;
+	uint32_t first_child, next_sibling;
+	uint32_t first_edge, num_edges;
+} BuildNode;
+
+typedef struct {
+	BuildNode *nodes;
+	size_t num_nodes, cap;
+	size_t num_glyphs;
+	size_t num_ligatures;
+	GlyphIndex *single; /* glyph after all single substitutions */
+	int out_of_memory;
+} Compiler;
+
+static uint32_t add_node( Compiler *c, GlyphIndex glyph )
+{
+	BuildNode *n;
+	
+	if ( c->num_nodes == c->cap )
+	{
+		size_t cap = c->cap * 2;
+		BuildNode *nodes = realloc( c->nodes, cap * sizeof( nodes[0] ) );
+		if ( !nodes ) {
+			c->out_of_memory = 1;
+			return 0;
+		}
+		c->nodes = nodes;
+		c->cap = cap;
+	}
+	
+	n = c->nodes + c->num_nodes;
+	memset( n, 0, sizeof(*n) );
+	n->glyph = glyph;
+	return c->num_nodes++;
+}
+
+/* Adds a ligature. If the same sequence was added before, the earlier ligature is kept (earlier lookups and subtables win) */
+static void add_ligature( Compiler *c, GlyphIndex const comps[], size_t len, GlyphIndex output )
+{
+	uint32_t node = comps[0];
+	size_t k;
+	
+	for( k=1; k<len; k++ )
+	{
+		uint32_t child = c->nodes[node].first_child;
+		
+		while( child && c->nodes[child].glyph != comps[k] )
+			child = c->nodes[child].next_sibling;
+		
+		if ( !child ) {
+			child = add_node( c, comps[k] );
+			if ( !child )
+				return;
+			c->nodes[child].next_sibling = c->nodes[node].first_child;
+			c->nodes[node].first_child = child;
+		}
+		
+		node = child;
+	}
+	
+	if ( !c->nodes[node].output ) {
+		c->nodes[node].output = output;
+		c->num_ligatures++;
+	}
+}
+
+/* Single substitution subtable. sub[] starts as identity. Only glyphs that no earlier subtable of the lookup covered are changed */
+static void read_single_subst( OTTable *t, size_t pos, Compiler *c, GlyphIndex sub[], uint8_t done[] )
+{
+	unsigned format = ot_u16( t, pos );
+	size_t num_covered = ot_coverage( t, pos + ot_u16( t, pos + 2 ), NULL ), n;
+	uint16_t *coverage = malloc( ( num_covered + 1 ) * sizeof( coverage[0] ) );
+	
+	if ( !coverage ) {
+		c->out_of_memory = 1;
+		return;
+	}
+	ot_coverage( t, pos + ot_u16( t, pos + 2 ), coverage );
+	
+	for( n=0; n<num_covered && !t->bad; n++ )
+	{
+		GlyphIndex g = coverage[n], s;
+		
+		if ( format == 1 ) {
+			s = ( g + ot_u16( t, pos + 4 ) ) & 0xFFFF; /* delta modulo 65536 */
+		} else if ( format == 2 ) {
+			if ( n >= ot_u16( t, pos + 4 ) )
+				break;
+			s = ot_u16( t, pos + 6 + 2 * n );
+		} else {
+			break;
+		}
+		
+		if ( g < c->num_glyphs && s < c->num_glyphs && !done[g] ) {
+			sub[g] = s;
+			done[g] = 1;
+		}
+	}
+	
+	free( coverage );
+}
+
+/* Ligature substitution subtable */
+static void read_ligature_subst( OTTable *t, size_t pos, Compiler *c )
+{
+	size_t num_covered = ot_coverage( t, pos + ot_u16( t, pos + 2 ), NULL ), n, k, j;
+	unsigned num_sets = ot_u16( t, pos + 4 );
+	uint16_t *coverage;
+	
+	if ( ot_u16( t, pos ) != 1 )
+		return;
+	
+	coverage = malloc( ( num_covered + 1 ) * sizeof( coverage[0] ) );
+	if ( !coverage ) {
+		c->out_of_memory = 1;
+		return;
+	}
+	ot_coverage( t, pos + ot_u16( t, pos + 2 ), coverage );
+	
+	for( n=0; n<num_sets && n<num_covered && !t->bad; n++ )
+	{
+		size_t set = pos + ot_u16( t, pos + 6 + 2 * n );
+		unsigned count = ot_u16( t, set );
+		
+		for( k=0; k<count && !t->bad && !c->out_of_memory; k++ )
+		{
+			size_t lig = set + ot_u16( t, set + 2 + 2 * k );
+			GlyphIndex output = ot_u16( t, lig ), comps[MAX_LIGATURE_LEN];
+			unsigned len = ot_u16( t, lig + 2 );
+			int ok = len >= 2 && len <= MAX_LIGATURE_LEN && output && output < c->num_glyphs;
+			
+			comps[0] = coverage[n];
+			for( j=1; ok && j<len; j++ )
+				comps[j] = ot_u16( t, lig + 4 + 2 * ( j - 1 ) );
+			for( j=0; ok && j<len; j++ )
+				ok = comps[j] < c->num_glyphs;
+			
+			if ( ok )
+				add_ligature( c, comps, len, output );
+		}
+	}
+	
+	free( coverage );
+}
+
+static int compare_edges( void const *a, void const *b )
+{
+	GlyphIndex x = ((GlyphIndex const*) a)[0], y = ((GlyphIndex const*) b)[0];
+	return x < y ? -1 : x > y;
+}
+
+/* Converts the linked trie into font->subst */
+static int flatten_trie( Compiler *c, GlyphSubst *s )
+{
+	size_t num_nodes = c->num_nodes, num_edges = num_nodes - c->num_glyphs, n;
+	GlyphIndex (*tmp)[2];
+	
+	s->nodes = malloc( num_nodes * sizeof( s->nodes[0] ) + num_edges * ( sizeof( s->edge_glyph[0] ) + sizeof( s->edge_node[0] ) ) + 1 );
+	tmp = malloc( ( num_edges + 1 ) * sizeof( tmp[0] ) );
+	if ( !s->nodes || !tmp ) {
+		free( s->nodes );
+		free( tmp );
+		s->nodes = NULL;
+		return 0;
+	}
+	
+	s->edge_glyph = (GlyphIndex*)( s->nodes + num_nodes );
+	s->edge_node = s->edge_glyph + num_edges;
+	s->num_nodes = num_nodes;
+	s->num_edges = 0;
+	s->num_ligatures = c->num_ligatures;
+	
+	for( n=0; n<num_nodes; n++ )
+	{
+		BuildNode *b = c->nodes + n;
+		uint32_t child;
+		size_t count = 0, k;
+		
+		for( child=b->first_child; child; child=c->nodes[child].next_sibling ) {
+			tmp[count][0] = c->nodes[child].glyph;
+			tmp[count][1] = child;
+			count++;
+		}
+		
+		qsort( tmp, count, sizeof( tmp[0] ), compare_edges );
+		
+		b->first_edge = s->num_edges;
+		b->num_edges = count;
+		for( k=0; k<count; k++ ) {
+			s->edge_glyph[ s->num_edges ] = tmp[k][0];
+			s->edge_node[ s->num_edges ] = tmp[k][1];
+			s->num_edges++;
+		}
+	}
+	
+	/* Start state g continues like the ligatures that begin with the glyph that g is substituted with */
+	for( n=0; n<num_nodes; n++ )
+	{
+		BuildNode *b = c->nodes + ( n < c->num_glyphs ? c->single[n] : n );
+		s->nodes[n].output = n < c->num_glyphs ? c->single[n] : c->nodes[n].output;
+		s->nodes[n].first_edge = b->first_edge;
+		s->nodes[n].num_edges = b->num_edges;
+	}
+	
+	free( tmp );
+	return 1;
+}
+
+static void compile_lookups( OTTable *t, Compiler *c, uint8_t const used[], unsigned num_lookups )
+{
+	size_t lookup_list = ot_u16( t, 8 ), n, g;
+	GlyphIndex *sub = malloc( c->num_glyphs * sizeof( sub[0] ) + 1 );
+	uint8_t *done = malloc( c->num_glyphs + 1 );
+	
+	if ( !sub || !done ) {
+		c->out_of_memory = 1;
+		free( sub );
+		free( done );
+		return;
+	}
+	
+	/* Lookups are applied in lookup list order. Consecutive single substitutions are composed into one glyph map
+	Ligatures are matched against glyphs that have already been through all single substitutions */
+	for( n=0; n<num_lookups && !t->bad && !c->out_of_memory; n++ )
+	{
+		size_t lookup = lookup_list + ot_u16( t, lookup_list + 2 + 2 * n );
+		unsigned num_subtables = ot_u16( t, lookup + 4 ), k, type;
+		
+		if ( !used[n] )
+			continue;
+		
+		/* Type of the lookup (also if it is an extension lookup) */
+		ot_subtable( t, lookup, 0, 7, &type );
+		
+		if ( type == 1 )
+		{
+			for( g=0; g<c->num_glyphs; g++ ) {
+				sub[g] = g;
+				done[g] = 0;
+			}
+			
+			for( k=0; k<num_subtables; k++ ) {
+				size_t s = ot_subtable( t, lookup, k, 7, &type );
+				if ( type == 1 && !t->bad )
+					read_single_subst( t, s, c, sub, done );
+			}
+			
+			for( g=0; g<c->num_glyphs; g++ )
+				c->single[g] = sub[ c->single[g] ];
+		}
+		else if ( type == 4 )
+		{
+			for( k=0; k<num_subtables; k++ ) {
+				size_t s = ot_subtable( t, lookup, k, 7, &type );
+				if ( type == 4 && !t->bad )
+					read_ligature_subst( t, s, c );
+			}
+		}
+	}
+	
+	free( sub );
+	free( done );
+}
+
+int read_substitutions( FILE *fp, Font font[1], uint32_t gsub_pos, uint32_t gsub_len, int vertical )
+{
+	static char const *const tags[] = { "ccmp", "liga", "clig", "vert", "vrt2" };
+	Compiler c;
+	OTTable t;
+	uint8_t *used;
+	unsigned num_lookups;
+	size_t n;
+	int ok = 1, changed = 0;
+	
+	memset( &font->subst, 0, sizeof( font->subst ) );
+	font->use_subst = 1;
+	
+	if ( !gsub_pos || !font->num_glyphs )
+		return 1;
+	
+	if ( !load_ot_table( fp, gsub_pos, gsub_len, &t ) )
+		return 0;
+	
+	if ( ot_u16( &t, 0 ) != 1 ) {
+		free( t.data );
+		return 1;
+	}
+	
+	used = ot_feature_lookups( &t, tags, vertical ? 5 : 3, &num_lookups );
+	
+	memset( &c, 0, sizeof( c ) );
+	c.num_glyphs = font->num_glyphs;
+	c.cap = c.num_glyphs * 2;
+	c.nodes = calloc( c.cap, sizeof( c.nodes[0] ) );
+	c.single = malloc( c.num_glyphs * sizeof( c.single[0] ) );
+	c.num_nodes = c.num_glyphs;
+	
+	if ( used && c.nodes && c.single )
+	{
+		for( n=0; n<c.num_glyphs; n++ ) {
+			c.nodes[n].glyph = n;
+			c.single[n] = n;
+		}
+		
+		compile_lookups( &t, &c, used, num_lookups );
+		
+		for( n=0; n<c.num_glyphs; n++ )
+			changed |= c.single[n] != n;
+		
+		if ( c.out_of_memory )
+			ok = 0;
+		else if ( changed || c.num_ligatures )
+			ok = flatten_trie( &c, &font->subst );
+	}
+	else
+	{
+		ok = 0;
+	}
+	
+	free( used );
+	free( c.nodes );
+	free( c.single );
+	free( t.data );
+	return ok;
+}
+
+/* Marks the ligatures that can be formed after the glyphs matched up to the node. Returns 1 if any new glyphs were marked */
+static int keep_ligatures( GlyphSubst const *s, SubstNode const *node, uint8_t keep[] )
+{
+	uint32_t e;
+	int added = 0;
+	
+	for( e=node->first_edge; e<node->first_edge+node->num_edges; e++ )
+	{
+		SubstNode const *next = s->nodes + s->edge_node[e];
+		
+		if ( !keep[ s->edge_glyph[e] ] )
+			continue;
+		
+		if ( next->output && !keep[ next->output ] ) {
+			keep[ next->output ] = 1;
+			added = 1;
+		}
+		
+		added |= keep_ligatures( s, next, keep );
+	}
+	
+	return added;
+}
+
+int add_substituted_glyphs( Font const font[1], uint8_t keep[] )
+{
+	GlyphSubst const *s = &font->subst;
+	size_t g;
+	int added = 0;
+	
+	if ( !s->nodes )
+		return 0;
+	
+	for( g=0; g<font->num_glyphs; g++ )
+	{
+		SubstNode const *start = s->nodes + g;
+		
+		if ( !keep[g] )
+			continue;
+		
+		if ( !keep[ start->output ] ) {
+			keep[ start->output ] = 1;
+			added = 1;
+		}
+		
+		added |= keep_ligatures( s, start, keep );
+	}
+	
+	return added;
+}
+
+/* Node map values while subsetting */
+#define DROPPED_NODE 0xFFFFFFFF
+#define REACHED_NODE 0xFFFFFFFE
+
+/* Marks the nodes that can be reached from the node through glyphs that are kept */
+static void mark_reachable( GlyphSubst const *s, uint32_t node, GlyphIndex const remap[], size_t new_num_glyphs, uint32_t node_map[] )
+{
+	SubstNode const *n = s->nodes + node;
+	uint32_t e;
+	
+	for( e=n->first_edge; e<n->first_edge+n->num_edges; e++ )
+	{
+		uint32_t next = s->edge_node[e];
+		if ( remap[ s->edge_glyph[e] ] < new_num_glyphs && node_map[next] == DROPPED_NODE ) {
+			node_map[next] = REACHED_NODE;
+			mark_reachable( s, next, remap, new_num_glyphs, node_map );
+		}
+	}
+}
+
+int subset_substitutions( GlyphSubst *s, size_t num_glyphs, GlyphIndex const remap[], size_t new_num_glyphs )
+{
+	GlyphSubst out;
+	uint32_t *node_map, *range_first, *range_len;
+	size_t n, num_nodes = new_num_glyphs;
+	int changed = 0;
+	
+	if ( !s->nodes )
+		return 1;
+	
+	/* Start states share edge ranges, so the new edges of each old range are remembered (by the first old edge) */
+	node_map = malloc( ( s->num_nodes + 2 * s->num_edges ) * sizeof( node_map[0] ) + 1 );
+	if ( !node_map )
+		return 0;
+	range_first = node_map + s->num_nodes;
+	range_len = range_first + s->num_edges;
+	
+	for( n=0; n<s->num_nodes; n++ )
+		node_map[n] = n < num_glyphs && remap[n] < new_num_glyphs ? remap[n] : DROPPED_NODE;
+	for( n=0; n<s->num_edges; n++ )
+		range_first[n] = DROPPED_NODE;
+	
+	for( n=0; n<num_glyphs; n++ ) {
+		if ( node_map[n] != DROPPED_NODE )
+			mark_reachable( s, n, remap, new_num_glyphs, node_map );
+	}
+	
+	/* Every node except the start states is the target of exactly one edge, so there is one edge per kept node */
+	for( n=num_glyphs; n<s->num_nodes; n++ ) {
+		if ( node_map[n] != DROPPED_NODE )
+			node_map[n] = num_nodes++;
+	}
+	
+	memset( &out, 0, sizeof( out ) );
+	out.num_nodes = num_nodes;
+	out.nodes = malloc( num_nodes * sizeof( out.nodes[0] ) + ( num_nodes - new_num_glyphs ) * ( sizeof( out.edge_glyph[0] ) + sizeof( out.edge_node[0] ) ) + 1 );
+	if ( !out.nodes ) {
+		free( node_map );
+		return 0;
+	}
+	out.edge_glyph = (GlyphIndex*)( out.nodes + num_nodes );
+	out.edge_node = out.edge_glyph + ( num_nodes - new_num_glyphs );
+	
+	/* Old nodes in ascending order are new nodes in ascending order */
+	for( n=0; n<s->num_nodes; n++ )
+	{
+		SubstNode const *old = s->nodes + n;
+		SubstNode *node;
+		uint32_t e;
+		
+		if ( node_map[n] == DROPPED_NODE )
+			continue;
+		
+		node = out.nodes + node_map[n];
+		if ( n < num_glyphs ) {
+			node->output = remap[ old->output ] < new_num_glyphs ? remap[ old->output ] : node_map[n];
+			changed |= node->output != node_map[n];
+		} else {
+			node->output = old->output && remap[ old->output ] < new_num_glyphs ? remap[ old->output ] : 0;
+			out.num_ligatures += node->output != 0;
+		}
+		
+		if ( !old->num_edges ) {
+			node->first_edge = 0;
+			node->num_edges = 0;
+			continue;
+		}
+		
+		if ( range_first[ old->first_edge ] == DROPPED_NODE )
+		{
+			range_first[ old->first_edge ] = out.num_edges;
+			for( e=old->first_edge; e<old->first_edge+old->num_edges; e++ ) {
+				if ( remap[ s->edge_glyph[e] ] < new_num_glyphs ) {
+					out.edge_glyph[ out.num_edges ] = remap[ s->edge_glyph[e] ];
+					out.edge_node[ out.num_edges ] = node_map[ s->edge_node[e] ];
+					out.num_edges++;
+				}
+			}
+			range_len[ old->first_edge ] = out.num_edges - range_first[ old->first_edge ];
+		}
+		
+		node->first_edge = range_first[ old->first_edge ];
+		node->num_edges = range_len[ old->first_edge ];
+	}
+	
+	free( node_map );
+	free( s->nodes );
+	
+	if ( changed || out.num_ligatures ) {
+		*s = out;
+	} else {
+		free( out.nodes );
+		memset( s, 0, sizeof( *s ) );
+	}
+	
+	return 1;
+}
+
+GlyphIndex substitute_glyph( Font font[1], GlyphIndex glyph, uint32_t const next[], size_t num_next, int end_of_text, size_t *num_used )
+{
+	GlyphSubst const *s = &font->subst;
+	SubstNode const *node = s->nodes + glyph;
+	GlyphIndex result = node->output;
+	size_t k = 0;
+	
+	*num_used = 1;
+	
+	/* The longest ligature wins */
+	while( node->num_edges )
+	{
+		uint32_t lo = node->first_edge, hi = lo + node->num_edges;
+		GlyphIndex g;
+		
+		if ( k == num_next ) {
+			if ( !end_of_text )
+				*num_used = 0;
+			break;
+		}
+		
+		if ( next[k] == '\n' )
+			break;
+		
+		g = s->nodes[ get_cmap_entry( font, next[k] ) ].output;
+		while( lo < hi ) {
+			uint32_t mid = lo + ( hi - lo ) / 2;
+			if ( s->edge_glyph[mid] < g )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		
+		if ( lo == node->first_edge + node->num_edges || s->edge_glyph[lo] != g )
+			break;
+		
+		node = s->nodes + s->edge_node[lo];
+		k++;
+		
+		if ( node->output ) {
+			result = node->output;
+			*num_used = k + 1;
+		}
+	}
+	
+	return result;
+}
@@ -0,0 +1,31 @@
+#ifndef _SUBSTITUTION_H
+#define _SUBSTITUTION_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "gpufont_data.h"
+
+/* Glyph substitution from the 'GSUB' table (used by ttf_file.c and the layout code) */
+
+/* Ligatures of more glyphs than this are ignored */
+#define MAX_LIGATURE_LEN 8
+
+/* Compiles the single (type 1) and ligature (type 4) substitutions of the features 'ccmp', 'liga' and 'clig' into font->subst
+If vertical is nonzero, the vertical forms of 'vert' and 'vrt2' are used too. gsub_pos is 0 if the font has no GSUB table
+Reading stops at the first malformed subtable. Returns 0 only if out of memory */
+int read_substitutions( FILE *fp, Font font[1], uint32_t gsub_pos, uint32_t gsub_len, int vertical );
+
+/* Marks the glyphs that the substitutions can produce from the marked glyphs: single substitutes and ligatures of marked glyphs (used by ttf_file.c for subsetting)
+keep[] has font->num_glyphs elements. Returns 1 if any new glyphs were marked. Call again until it returns 0, since new glyphs can complete more ligatures */
+int add_substituted_glyphs( Font const font[1], uint8_t keep[] );
+
+/* Drops the states and edges of glyphs that aren't kept and renumbers the rest. remap[g] is the new index of glyph g, or new_num_glyphs or more if g is dropped
+The new indices must be in the same order as the old ones. Returns 0 only if out of memory */
+int subset_substitutions( GlyphSubst *s, size_t num_glyphs, GlyphIndex const remap[], size_t new_num_glyphs );
+
+/* Substitutes the glyph of a code point that starts a ligature (font->subst.nodes[glyph].num_edges != 0). next[] are the code points that follow it
+*num_used is set to the number of code points that the returned glyph stands for, or to 0 if that can't be known before the code points after next[] are seen (only if end_of_text is 0)
+Glyphs of start states without edges need no call: their substitute is font->subst.nodes[glyph].output */
+GlyphIndex substitute_glyph( Font font[1], GlyphIndex glyph, uint32_t const next[], size_t num_next, int end_of_text, size_t *num_used );
+
+#endif
@@ -0,0 +1,173 @@
+#include "utf_decode.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Returns the length of the UTF-8 sequence that begins with byte c, or 0 if c can't begin a sequence (stray continuation byte, 0xC0/0xC1 which are always overlong, or 0xF5..0xFF)
+Also gives the allowed range of the second byte. The range rules out overlong forms, surrogates and code points above U+10FFFF */
+static size_t utf8_lead( uint32_t c, uint8_t *lo, uint8_t *hi )
+{
+	*lo = 0x80;
+	*hi = 0xBF;
+	if ( c >= 0xC2 && c < 0xE0 )
+		return 2;
+	if ( c >= 0xE0 && c < 0xF0 ) {
+		if ( c == 0xE0 ) *lo = 0xA0;
+		if ( c == 0xED ) *hi = 0x9F;
+		return 3;
+	}
+	if ( c >= 0xF0 && c < 0xF5 ) {
+		if ( c == 0xF0 ) *lo = 0x90;
+		if ( c == 0xF4 ) *hi = 0x8F;
+		return 4;
+	}
+	return 0;
+}
+
+/* Decodes one UTF-8 sequence that starts with a non-ASCII byte. Returns the number of bytes consumed (at least 1) */
+static size_t decode_utf8_seq( uint8_t const in[], size_t in_len, uint32_t out[1], size_t *num_errors )
+{
+	static const uint8_t lead_mask[5] = { 0, 0, 0x1F, 0x0F, 0x07 };
+	uint32_t c = in[0];
+	uint8_t lo, hi;
+	size_t len, n;
+	
+	len = utf8_lead( c, &lo, &hi );
+	if ( !len ) {
+		len = 1;
+		goto malformed;
+	}
+	c &= lead_mask[len];
+	
+	for( n=1; n<len; n++ )
+	{
+		if ( n >= in_len || in[n] < lo || in[n] > hi ) {
+			/* The bytes so far are replaced by one U+FFFD. The offending byte starts the next sequence */
+			len = n;
+			goto malformed;
+		}
+		c = c << 6 | ( in[n] & 0x3F );
+		lo = 0x80;
+		hi = 0xBF;
+	}
+	
+	*out = c;
+	return len;
+	
+malformed:;
+	*out = UTF_REPLACEMENT_CHAR;
+	*num_errors += 1;
+	return len;
+}
+
+size_t utf8_incomplete_tail( uint8_t const in[], size_t in_len )
+{
+	size_t k;
+	for( k=1; k<=3 && k<=in_len; k++ )
+	{
+		uint8_t const *seq = in + in_len - k;
+		uint8_t lo, hi;
+		size_t len, n;
+		
+		if ( ( seq[0] & 0xC0 ) == 0x80 )
+			continue; /* continuation byte. Look further back for the lead byte */
+		
+		len = utf8_lead( seq[0], &lo, &hi );
+		if ( len <= k )
+			return 0;
+		for( n=1; n<k; n++ ) {
+			if ( seq[n] < lo || seq[n] > hi )
+				return 0;
+			lo = 0x80;
+			hi = 0xBF;
+		}
+		return k;
+	}
+	return 0;
+}
+
+size_t decode_utf8( uint32_t out[], size_t max_out, uint8_t const in[], size_t in_len, size_t *in_used, size_t *num_errors )
+{
+	size_t i = 0, o = 0;
+	
+	while( i < in_len && o < max_out )
+	{
+		#ifdef __SSE2__
+		/* 16 ASCII bytes at a time */
+		while( i + 16 <= in_len && o + 16 <= max_out )
+		{
+			__m128i zero = _mm_setzero_si128();
+			__m128i b = _mm_loadu_si128( (__m128i const*)( in + i ) );
+			__m128i w;
+			
+			if ( _mm_movemask_epi8( b ) )
+				break;
+			
+			w = _mm_unpacklo_epi8( b, zero );
+			_mm_storeu_si128( (__m128i*)( out + o ), _mm_unpacklo_epi16( w, zero ) );
+			_mm_storeu_si128( (__m128i*)( out + o + 4 ), _mm_unpackhi_epi16( w, zero ) );
+			w = _mm_unpackhi_epi8( b, zero );
+			_mm_storeu_si128( (__m128i*)( out + o + 8 ), _mm_unpacklo_epi16( w, zero ) );
+			_mm_storeu_si128( (__m128i*)( out + o + 12 ), _mm_unpackhi_epi16( w, zero ) );
+			i += 16;
+			o += 16;
+		}
+		if ( i >= in_len || o >= max_out )
+			break;
+		#endif
+		
+		if ( in[i] < 0x80 )
+			out[o++] = in[i++];
+		else
+			i += decode_utf8_seq( in + i, in_len - i, out + o++, num_errors );
+	}
+	
+	*in_used = i;
+	return o;
+}
+
+size_t decode_utf16( uint32_t out[], size_t max_out, uint16_t const in[], size_t in_len, size_t *in_used, size_t *num_errors )
+{
+	size_t i = 0, o = 0;
+	
+	while( i < in_len && o < max_out )
+	{
+		uint32_t c;
+		
+		#ifdef __SSE2__
+		/* 8 non-surrogate units at a time */
+		while( i + 8 <= in_len && o + 8 <= max_out )
+		{
+			__m128i zero = _mm_setzero_si128();
+			__m128i w = _mm_loadu_si128( (__m128i const*)( in + i ) );
+			__m128i sur = _mm_cmpeq_epi16( _mm_and_si128( w, _mm_set1_epi16( (short) 0xF800 ) ), _mm_set1_epi16( (short) 0xD800 ) );
+			
+			if ( _mm_movemask_epi8( sur ) )
+				break;
+			
+			_mm_storeu_si128( (__m128i*)( out + o ), _mm_unpacklo_epi16( w, zero ) );
+			_mm_storeu_si128( (__m128i*)( out + o + 4 ), _mm_unpackhi_epi16( w, zero ) );
+			i += 8;
+			o += 8;
+		}
+		if ( i >= in_len || o >= max_out )
+			break;
+		#endif
+		
+		c = in[i++];
+		if ( c >= 0xD800 && c <= 0xDFFF )
+		{
+			if ( c <= 0xDBFF && i < in_len && in[i] >= 0xDC00 && in[i] <= 0xDFFF ) {
+				c = 0x10000 + ( ( c - 0xD800 ) << 10 ) + ( in[i++] - 0xDC00 );
+			} else {
+				c = UTF_REPLACEMENT_CHAR;
+				*num_errors += 1;
+			}
+		}
+		out[o++] = c;
+	}
+	
+	*in_used = i;
+	return o;
+}
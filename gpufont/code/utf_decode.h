@@ -0,0 +1,24 @@
+#ifndef _UTF_DECODE_H
+#define _UTF_DECODE_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* UTF-8 and UTF-16 decoders used by the layout code. Runs of ASCII (or BMP characters in UTF-16) are converted 16 (8) at a time with SSE2 if available */
+
+/* Code point that replaces malformed sequences */
+#define UTF_REPLACEMENT_CHAR 0xFFFD
+
+/* Decodes at most max_out code points. Only whole sequences are consumed
+Malformed input (overlong forms, surrogates, code points above U+10FFFF, stray or missing continuation bytes) is replaced the way Unicode recommends:
+each maximal invalid subpart becomes one UTF_REPLACEMENT_CHAR and increments *num_errors
+Sets *in_used to the number of bytes consumed and returns the number of code points written */
+size_t decode_utf8( uint32_t out[], size_t max_out, uint8_t const in[], size_t in_len, size_t *in_used, size_t *num_errors );
+
+/* Returns how many bytes at the end of the buffer are the beginning of a valid UTF-8 sequence that continues past the end (0..3)
+Used to hold back a sequence that is split between two chunks of a stream */
+size_t utf8_incomplete_tail( uint8_t const in[], size_t in_len );
+
+/* Same as decode_utf8 but for UTF-16 in native byte order. Unpaired surrogates are errors */
+size_t decode_utf16( uint32_t out[], size_t max_out, uint16_t const in[], size_t in_len, size_t *in_used, size_t *num_errors );
+
+#endif
@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gpufont_data.h"
+#include "vcache.h"
+
+/* Returns the number of cache misses when drawing the given triangles with a FIFO cache of cache_size vertices
+'cache' must have room for cache_size entries */
+static size_t simulate_fifo( PointIndex const indices[], size_t num_indices, PointIndex cache[], unsigned cache_size )
+{
+	size_t n, misses = 0;
+	unsigned filled = 0, head = 0;
+	
+	for( n=0; n<num_indices; n++ )
+	{
+		PointIndex v = indices[n];
+		unsigned k;
+		
+		for( k=0; k<filled; k++ ) {
+			if ( cache[k] == v )
+				break;
+		}
+		
+		if ( k == filled )
+		{
+			/* miss. push to the FIFO */
+			misses++;
+			if ( filled < cache_size ) {
+				cache[ filled++ ] = v;
+			} else {
+				cache[ head ] = v;
+				head = ( head + 1 ) % cache_size;
+			}
+		}
+	}
+	
+	return misses;
+}
+
+/* Counts distinct vertices referenced by the indices */
+static size_t count_used_vertices( PointIndex const indices[], size_t num_indices, unsigned char used[], size_t num_points )
+{
+	size_t n, count = 0;
+	memset( used, 0, num_points );
+	for( n=0; n<num_indices; n++ ) {
+		if ( !used[ indices[n] ] ) {
+			used[ indices[n] ] = 1;
+			count++;
+		}
+	}
+	return count;
+}
+
+void simulate_vertex_cache( struct Font const *font, unsigned cache_size, double *acmr, double *atvr )
+{
+	PointIndex cache[256];
+	unsigned char used[1<<16];
+	size_t n, misses = 0, tris = 0, verts = 0;
+	
+	if ( cache_size > sizeof( cache ) / sizeof( cache[0] ) )
+		cache_size = sizeof( cache ) / sizeof( cache[0] );
+	if ( cache_size < 1 )
+		cache_size = 1;
+	
+	for( n=0; n<font->num_glyphs; n++ )
+	{
+		GlyphDesc const *d = font->glyph_desc + n;
+		PointIndex const *ind = font->all_indices + d->first_index;
+		
+		if ( !IS_SIMPLE_GLYPH( d ) || !d->num_points )
+			continue;
+		
+		/* Curve and solid triangles are separate draw calls. The cache doesn't carry over between them */
+		misses += simulate_fifo( ind, d->num_indices_curve, cache, cache_size );
+		misses += simulate_fifo( ind + d->num_indices_curve, d->num_indices_solid, cache, cache_size );
+		verts += count_used_vertices( ind, d->num_indices_curve, used, d->num_points );
+		verts += count_used_vertices( ind + d->num_indices_curve, d->num_indices_solid, used, d->num_points );
+		tris += ( d->num_indices_curve + d->num_indices_solid ) / 3;
+	}
+	
+	*acmr = tris ? (double) misses / tris : 0;
+	*atvr = verts ? (double) misses / verts : 0;
+}
+
+/* Tipsify needs to know which triangles use each vertex */
+typedef struct {
+	size_t *offset; /* num_points+1 elements. Triangles of vertex v are tris[offset[v]] ... tris[offset[v+1]-1] */
+	size_t *tris;
+	int *live; /* number of unemitted triangles that use the vertex */
+	int *stamp; /* time when the vertex entered the cache */
+	PointIndex *dead_end; /* stack of recently used vertices */
+	unsigned char *emitted;
+} Adjacency;
+
+static int build_adjacency( Adjacency adj[1], PointIndex const ind[], size_t num_indices, size_t num_points )
+{
+	size_t n, num_tris = num_indices / 3;
+	
+	adj->offset = calloc( num_points + 1, sizeof( size_t ) );
+	adj->tris = malloc( sizeof( size_t ) * num_indices );
+	adj->live = calloc( num_points, sizeof( int ) );
+	adj->stamp = calloc( num_points, sizeof( int ) );
+	adj->dead_end = malloc( sizeof( PointIndex ) * num_indices );
+	adj->emitted = calloc( num_tris, 1 );
+	
+	if ( !adj->offset || !adj->tris || !adj->live || !adj->stamp || !adj->dead_end || !adj->emitted )
+		return 0;
+	
+	for( n=0; n<num_indices; n++ )
+		adj->live[ ind[n] ]++;
+	
+	for( n=0; n<num_points; n++ )
+		adj->offset[n+1] = adj->offset[n] + adj->live[n];
+	
+	for( n=0; n<num_indices; n++ ) {
+		/* offset[v] is used as a cursor and restored afterwards */
+		adj->tris[ adj->offset[ ind[n] ]++ ] = n / 3;
+	}
+	for( n=num_points; n>0; n-- )
+		adj->offset[n] = adj->offset[n-1];
+	adj->offset[0] = 0;
+	
+	return 1;
+}
+
+static void free_adjacency( Adjacency adj[1] )
+{
+	free( adj->offset );
+	free( adj->tris );
+	free( adj->live );
+	free( adj->stamp );
+	free( adj->dead_end );
+	free( adj->emitted );
+}
+
+/* Writes the triangles of ind[] in Tipsify order to out[] */
+static int tipsify( PointIndex out[], PointIndex const ind[], size_t num_indices, size_t num_points )
+{
+	const int k = VCACHE_OPT_SIZE;
+	Adjacency adj;
+	size_t num_out = 0, dead_end_len = 0, cursor = 0;
+	int time = k + 1;
+	long fan = ind[0];
+	
+	if ( !build_adjacency( &adj, ind, num_indices, num_points ) ) {
+		free_adjacency( &adj );
+		return 0;
+	}
+	
+	while( fan >= 0 )
+	{
+		size_t a, end = adj.offset[ fan + 1 ];
+		long best = -1;
+		int best_priority = -1;
+		
+		/* Emit all remaining triangles around the fanning vertex */
+		for( a=adj.offset[fan]; a<end; a++ )
+		{
+			size_t t = adj.tris[a];
+			int c;
+			
+			if ( adj.emitted[t] )
+				continue;
+			
+			adj.emitted[t] = 1;
+			for( c=0; c<3; c++ )
+			{
+				PointIndex v = ind[ 3 * t + c ];
+				out[ num_out++ ] = v;
+				adj.dead_end[ dead_end_len++ ] = v;
+				adj.live[v]--;
+				if ( time - adj.stamp[v] > k ) {
+					/* vertex was not in the cache */
+					adj.stamp[v] = time++;
+				}
+			}
+		}
+		
+		/* Pick the next fanning vertex among the 1-ring: the oldest vertex that will still be in the cache after emitting its triangles */
+		for( a=adj.offset[fan]; a<end; a++ )
+		{
+			size_t t = adj.tris[a];
+			int c;
+			for( c=0; c<3; c++ )
+			{
+				PointIndex v = ind[ 3 * t + c ];
+				if ( adj.live[v] > 0 )
+				{
+					int priority = 0;
+					if ( time - adj.stamp[v] + 2 * adj.live[v] <= k )
+						priority = time - adj.stamp[v];
+					if ( priority > best_priority ) {
+						best_priority = priority;
+						best = v;
+					}
+				}
+			}
+		}
+		
+		if ( best < 0 )
+		{
+			/* Dead end. Try recently used vertices first */
+			while( dead_end_len > 0 ) {
+				PointIndex v = adj.dead_end[ --dead_end_len ];
+				if ( adj.live[v] > 0 ) {
+					best = v;
+					break;
+				}
+			}
+		}
+		
+		if ( best < 0 )
+		{
+			/* Continue from any vertex that still has triangles left */
+			while( cursor < num_points && adj.live[ cursor ] <= 0 )
+				cursor++;
+			if ( cursor < num_points )
+				best = cursor;
+		}
+		
+		fan = best;
+	}
+	
+	free_adjacency( &adj );
+	return num_out == num_indices;
+}
+
+int optimize_vertex_cache( struct GlyphTriangles *gt, int renumber )
+{
+	size_t num_points = gt->num_points_total;
+	PointIndex *solid = gt->indices + gt->num_indices_curve;
+	size_t num_solid = gt->num_indices_solid;
+	PointIndex *temp = NULL, *remap = NULL;
+	PointCoord *points = NULL;
+	PointFlag *flags = NULL;
+	int ok = 1;
+	
+	/* Everything is allocated before the glyph is changed, so running out of memory leaves it as it was */
+	if ( num_solid >= 6 )
+		ok = ( temp = malloc( sizeof( PointIndex ) * num_solid ) ) != NULL;
+	if ( renumber && num_points > 0 ) {
+		remap = malloc( sizeof( PointIndex ) * num_points );
+		points = malloc( sizeof( PointCoord ) * 2 * num_points );
+		flags = malloc( sizeof( PointFlag ) * num_points );
+		ok = ok && remap && points && flags;
+	}
+	if ( !ok )
+		goto done;
+	
+	/* If tipsify runs out of memory the triangles just keep their order */
+	if ( temp && tipsify( temp, solid, num_solid, num_points ) )
+		memcpy( solid, temp, sizeof( PointIndex ) * num_solid );
+	
+	if ( remap )
+	{
+		size_t n, num_indices = gt->num_indices_total, next = 0;
+		
+		/* New index = order of first use. Unreferenced points go last */
+		for( n=0; n<num_points; n++ )
+			remap[n] = 0xFFFF;
+		for( n=0; n<num_indices; n++ ) {
+			if ( remap[ gt->indices[n] ] == 0xFFFF )
+				remap[ gt->indices[n] ] = next++;
+		}
+		for( n=0; n<num_points; n++ ) {
+			if ( remap[n] == 0xFFFF )
+				remap[n] = next++;
+		}
+		
+		for( n=0; n<num_points; n++ ) {
+			points[ 2 * remap[n] ] = gt->points[ 2 * n ];
+			points[ 2 * remap[n] + 1 ] = gt->points[ 2 * n + 1 ];
+			flags[ remap[n] ] = gt->flags[n];
+		}
+		for( n=0; n<num_indices; n++ )
+			gt->indices[n] = remap[ gt->indices[n] ];
+		
+		memcpy( gt->points, points, sizeof( PointCoord ) * 2 * num_points );
+		memcpy( gt->flags, flags, sizeof( PointFlag ) * num_points );
+	}
+	
+done:;
+	free( temp );
+	free( remap );
+	free( points );
+	free( flags );
+	return ok;
+}
@@ -0,0 +1,18 @@
+#ifndef _VCACHE_H
+#define _VCACHE_H
+#include <stddef.h>
+
+/* Post-transform vertex cache optimization of glyph triangles (used by ttf_file.c) */
+
+/* Cache size assumed by the optimizer. Real GPUs have somewhere between 8 and 32+ entries */
+#define VCACHE_OPT_SIZE 16
+
+struct GlyphTriangles;
+
+/* Reorders the solid triangles of the glyph using Tipsify (Sander, Nehab & Barczak 2007)
+If renumber is nonzero, also renumbers the glyph's points in the order the index buffer first references them
+The order of the vertices within each triangle is preserved (curve triangles depend on it)
+Returns 0 if out of memory (the glyph is left unchanged) */
+int optimize_vertex_cache( struct GlyphTriangles *gt, int renumber );
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _FONT_COVERAGE_H
+#define _FONT_COVERAGE_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Questions about which characters a font has, answered from the coverage bitmaps in Font.coverage
+Strings are checked 4 code points (16 UTF-8 bytes) at a time with SSE2 if available
+Newlines are never drawn, so they count as covered
+*/
+
+struct Font;
+
+/* Nonzero if the cmap maps the code point to a glyph */
+int font_has_char( struct Font const *font, uint32_t code );
+
+/* Returns the index of the first code point that the font has no glyph for, or text_len if it has all of them */
+size_t find_uncovered_char( struct Font const *font, uint32_t const text[], size_t text_len );
+
+/* Same for UTF-8. Returns the byte offset of the sequence. Malformed sequences count as uncovered */
+size_t find_uncovered_char_utf8( struct Font const *font, char const *text, size_t num_bytes );
+
+/* Nonzero if the font has a glyph for every character of the string */
+int font_covers_text( struct Font const *font, uint32_t const text[], size_t text_len );
+int font_covers_text_utf8( struct Font const *font, char const *text, size_t num_bytes );
+
+/* Sets *codes to the code points that the cmap maps to the glyph (in ascending order) and returns how many there are */
+size_t get_glyph_code_points( struct Font const *font, uint32_t glyph, uint32_t const **codes );
+
+#endif
@@ -16,6 +16,31 @@ typedef uint32_t PointFlag;
 typedef float PointCoord; /* for contour point coordinates */
 typedef float GlyphCoord; /* for glyph instance positions */
 
+/* Compact vertex format used by the merged vertex array and the GL vertex buffer (6 bytes per vertex)
+Coordinates are fixed point numbers in 1/(2^Font.coord_shift) EM units. A shift of 1 (half units) keeps
+the midpoints generated by the triangulator exact. Only fonts with huge coordinates need a shift of 0 */
+typedef int16_t PackedCoord;
+#define MAX_COORD_SHIFT 1 /* largest shift that packed vertices use */
+typedef struct PackedVertex {
+	PackedCoord pos[2];
+	uint8_t flag; /* the 3 lowest bits of PointFlag */
+	uint8_t pad;
+} PackedVertex;
+
+/* Full precision interleaved vertex (12 bytes per vertex). Coordinates are in EM units */
+typedef struct FloatVertex {
+	PointCoord pos[2];
+	PointFlag flag;
+} FloatVertex;
+
+/* Vertex formats of Font.all_vertices */
+typedef enum {
+	VERTEX_PACKED=0, /* PackedVertex (the default) */
+	VERTEX_FLOAT=1 /* FloatVertex */
+} VertexLayout;
+
+#define VERTEX_SIZE(layout) (( (layout) == VERTEX_FLOAT ? sizeof( FloatVertex ) : sizeof( PackedVertex ) ))
+
 /* Glyph outline converted to triangles */
 typedef struct GlyphTriangles {
 	PointCoord *points; /* 2 floats per point */
@@ -30,11 +55,25 @@ typedef struct GlyphTriangles {
 	uint16_t num_contours; /* only used internally */
 } GlyphTriangles;
 
+/* Only used while loading. merge_glyph_data converts these into GlyphDescs */
 typedef struct SimpleGlyph {
 	size_t num_parts; /* if nonzero, then this struct is actually a CompositeGlyph and has no 'tris' field */
 	GlyphTriangles tris;
 } SimpleGlyph;
 
+/* Tells where the geometry of a glyph is in the merged arrays (and in the VBOs)
+Indices are relative to first_vertex. First come the curve triangles, then the solid triangles
+Glyphs with identical outlines share the same geometry. The outline is then moved by 'offset' when drawn */
+typedef struct GlyphDesc {
+	uint32_t first_vertex; /* base vertex */
+	uint32_t first_index; /* offset into all_indices. For composite glyphs this is a byte offset into all_glyphs instead */
+	uint16_t num_points; /* zero if the glyph has no outline */
+	uint16_t num_indices_curve;
+	uint16_t num_indices_solid;
+	uint16_t num_parts; /* nonzero if this is a composite glyph */
+	int16_t offset[2]; /* translation in EM units. Nonzero only if the geometry belongs to another glyph */
+} GlyphDesc;
+
 /* This is variable-sized and thus can't have an actual type defined.
 struct CompositeGlyph {
 	size_t num_parts;
@@ -54,35 +93,99 @@ struct CompositeGlyph {
 /* Composite glyph support can be globally disabled with this macro */
 #define ENABLE_COMPOSITE_GLYPHS 0
 
-/* Evaluates to true if given SimpleGlyph is really a simple glyph */
+/* Evaluates to true if given SimpleGlyph or GlyphDesc is really a simple glyph */
 #define IS_SIMPLE_GLYPH(glyph) ((glyph)->num_parts == 0)
 
+/* Gets the composite glyph record of a composite GlyphDesc */
+#define GET_COMPOSITE_GLYPH(font,desc) ((void*)( (char*)(font)->all_glyphs + (desc)->first_index ))
+
 typedef struct {
 	/* Directly from TTF file. They're given in EM units */
 	uint16_t adv_width;
 	int16_t lsb;
 } LongHorzMetrics;
 
+/* Per-glyph metrics as a structure of arrays. Each array has one entry per glyph and all values are in EM units.
+The bounding box comes straight from the glyph header in the 'glyf' table. Glyphs without an outline have an all-zero box */
+typedef struct GlyphMetrics {
+	uint16_t *adv_width;
+	int16_t *lsb;
+	int16_t *xmin, *ymin;
+	int16_t *xmax, *ymax;
+} GlyphMetrics;
+
+/* Horizontal pair kerning as sorted arrays per left glyph. The pairs of left glyph g are right[ first[g] .. first[g+1]-1 ], sorted by right glyph
+Left glyphs without pairs have an empty range, so most characters are rejected with one comparison. All arrays share one block of memory */
+typedef struct KernPairs {
+	uint32_t *first; /* num_glyphs + 1 elements. NULL if the font has no kerning */
+	uint16_t *right;
+	int16_t *value; /* in EM units, added to the advance of the left glyph */
+	size_t num_pairs;
+} KernPairs;
+
+/* Glyph substitutions (GSUB single and ligature substitutions) compiled into a trie over glyph indices
+The first num_glyphs nodes are the start states: node g is the state after the glyph that the cmap gave
+Edges are keyed by glyphs after single substitution and the edges of each node are sorted by glyph. Node n has edges first_edge .. first_edge+num_edges-1 */
+typedef struct SubstNode {
+	GlyphIndex output; /* replaces the glyphs matched so far. For a start state it is the glyph after single substitution, for the others a ligature or 0 if none ends here */
+	uint32_t first_edge;
+	uint32_t num_edges;
+} SubstNode;
+
+typedef struct GlyphSubst {
+	SubstNode *nodes; /* NULL if the font substitutes nothing. All arrays share one block of memory */
+	GlyphIndex *edge_glyph;
+	uint32_t *edge_node;
+	size_t num_nodes;
+	size_t num_edges;
+	size_t num_ligatures;
+} GlyphSubst;
+
+/* Unicode has 17 planes of 2^16 code points */
+#define NUM_UNICODE_PLANES 17
+#define PLANE_WORDS ( 65536 / 32 )
+
+/* Which code points the cmap maps to a glyph, as a bitmap of each Unicode plane, and the reverse of the cmap
+Bit c & 0xFFFF of plane[c >> 16] is set if the cmap maps c to a glyph other than 0 (and less than num_glyphs)
+The code points of glyph g are glyph_code[ glyph_first[g] .. glyph_first[g+1]-1 ] in ascending order */
+typedef struct CmapCoverage {
+	uint32_t *plane[NUM_UNICODE_PLANES]; /* PLANE_WORDS words each. NULL for planes that have no code points */
+	uint32_t *bits; /* the block of memory that the bitmaps are in */
+	uint32_t full_run[2][2]; /* first and last code point of two ranges that the font covers completely (the one with 'a' and the longest other one). Empty if first > last */
+	uint32_t *glyph_first; /* num_glyphs + 1 elements. NULL if the font has no cmap */
+	uint32_t *glyph_code; /* num_codes elements in the same block as glyph_first */
+	size_t num_codes; /* how many code points the cmap maps */
+} CmapCoverage;
+
 typedef struct Font {
 	size_t num_glyphs; /* how many glyphs the font has */
 	unsigned units_per_em; /* used to convert integer coordinates to floats */
 	
-	SimpleGlyph **glyphs; /* Array of pointers to glyphs. Each glyp can be either a SimpleGlyph or a composite glyph */
-	void *all_glyphs; /* one huge array that contains all SimpleGlyphs and composite glyphs */
-	PointCoord *all_points; /* a huge array that contains all the points of all simple glyphs */
-	PointFlag *all_flags; /* all point flags of all simple glyphs */
+	SimpleGlyph **glyphs; /* Only used while loading. Array of pointers to glyphs. Each glyp can be either a SimpleGlyph or a composite glyph. NULL after merge_glyph_data */
+	GlyphIndex *glyph_alias; /* Only used while loading. If glyph_alias[n] != n then glyph n has the same outline as glyph glyph_alias[n] (possibly translated) and font->glyphs[n] is NULL */
+	GlyphDesc *glyph_desc; /* one descriptor per glyph, indexed by GlyphIndex */
+	void *all_glyphs; /* all composite glyphs */
+	void *all_vertices; /* a huge array that contains all the points (and their flags) of all simple glyphs. Either PackedVertex or FloatVertex */
 	PointIndex *all_indices; /* all triangle indices of all simple glyphs */
-	size_t total_points; /* length of all_points and all_flags */
+	size_t total_points; /* length of all_vertices */
 	size_t total_indices; /* length of all_indices */
+	VertexLayout vertex_layout; /* set before merge_glyph_data */
+	unsigned coord_shift; /* vertex coordinates are in units of 1/(2^coord_shift) EM units. Always 0 for VERTEX_FLOAT */
 	
 	/* Only used by gpufont_draw.c */
-	uint32_t gl_buffers[4]; /* VAO, point coordinate VBO, IBO, point flag VBO */
+	uint32_t gl_buffers[3]; /* VAO, vertex VBO, IBO */
 	
 	/* Maps character codes to glyph indices */
 	NibTree cmap; /* Encoding could be anything. But its unicode for now */
+	CmapCoverage coverage; /* built from the cmap when the font is loaded */
 	
 	/* Horizontal metrics in EM units */
 	LongHorzMetrics *hmetrics; /* has one entry for each glyph (unlike TTF file) */
+	GlyphMetrics metrics; /* advance, lsb and bounding box of each glyph. All arrays share one block of memory */
+	KernPairs kerning; /* from GPOS if the font has a 'kern' feature there, otherwise from the 'kern' table */
+	int use_kerning; /* layout applies kerning if nonzero. Set to 1 when the font is loaded */
+	GlyphSubst subst; /* from the GSUB lookups of the features that were selected when loading */
+	int use_subst; /* layout applies glyph substitution if nonzero. Set to 1 when the font is loaded */
 	int horz_ascender;
 	int horz_descender;
 	int horz_linegap;
@@ -90,7 +193,22 @@ typedef struct Font {
 
 void destroy_font( Font *font );
 
+/* Allocates font->metrics for font->num_glyphs glyphs and zeroes it. Returns 0 if failure, 1 if success */
+int init_glyph_metrics( Font *font );
+
+/* Converts float points and flags into interleaved vertices of the given layout. Returns the number of bytes written
+coord_shift is only used by VERTEX_PACKED */
+size_t pack_vertices( void *out, VertexLayout layout, PointCoord const points[], PointFlag const flags[], size_t num_points, unsigned coord_shift );
+
+/* Simulates a FIFO post-transform vertex cache with cache_size entries over the triangles of every glyph
+Each draw call (curve and solid triangles of a glyph) starts with an empty cache
+acmr = average cache misses per triangle, atvr = average cache misses per referenced vertex (1.0 is optimal) */
+void simulate_vertex_cache( Font const *font, unsigned cache_size, double *acmr, double *atvr );
+
 /* Merges all vertex & index arrays together so that every glyph can be put into the same VBO
+Vertices are written in the format given by font->vertex_layout
+Glyphs listed in font->glyph_alias get the geometry of the glyph they alias
+Fills font->glyph_desc and frees font->glyphs and font->glyph_alias
 Returns 0 if failure, 1 if success */
 int merge_glyph_data( Font *font );
 
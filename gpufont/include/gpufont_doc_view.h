@@ -0,0 +1,49 @@
+#ifndef _FONT_DOC_VIEW_H
+#define _FONT_DOC_VIEW_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Viewport layout for documents that are much taller than the screen
+The document is indexed once: where each line (text between two newlines) begins and how many rows it takes after wrapping
+Only the lines in view and a margin around them are laid out. They are laid out again only when the view moves past the margin
+Their positions go into one VBO that is reused as the view scrolls, so drawing costs the same no matter how long the document is
+Coordinates are the same as do_simple_layout would give for the whole document: row n is at y = n * line height
+*/
+
+struct Font;
+
+struct DocView;
+typedef struct DocView DocView;
+
+typedef struct {
+	size_t relayouts; /* times the view moved past the margin */
+	size_t lines_laid_out;
+	size_t glyphs_uploaded;
+	size_t buffer_reallocs; /* the position VBO was grown */
+} DocViewStats;
+
+/* The text isn't copied and must stay alive as long as the view. If max_line_len < 0 then lines are not wrapped
+margin_rows rows above and below the view are laid out too. Malformed UTF-8 is drawn as U+FFFD
+Both return NULL if out of memory. Need no GL context until set_doc_view_range */
+DocView *create_doc_view( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, size_t margin_rows );
+DocView *create_doc_view_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, size_t margin_rows );
+void delete_doc_view( DocView *v );
+
+size_t doc_view_num_lines( DocView const *v );
+size_t doc_view_num_rows( DocView const *v ); /* the height of the document in rows */
+
+/* First row of a line, and the line that a row belongs to (the last line if the row is past the end) */
+size_t doc_view_line_row( DocView const *v, size_t line );
+size_t doc_view_row_line( DocView const *v, size_t row );
+
+/* Makes sure that every row between y0 and y1 (font units) is laid out and uploaded. Returns 0 if out of memory */
+int set_doc_view_range( DocView *v, int32_t y0, int32_t y1 );
+
+/* Draws the lines that have been laid out. Call begin_text first */
+void draw_doc_view( DocView *v, float global_transform[16], int draw_flags );
+
+/* Counters since the view was created */
+void get_doc_view_stats( DocView const *v, DocViewStats *stats );
+
+#endif
@@ -34,4 +34,17 @@ void set_text_color( float color[4] );
 void bind_glyph_positions( GLuint_ vbo, size_t first ); /* The vbo should have as many PointCoord 2D vectors as the num_instances passed to draw_glyphs. 'first' is interpreted as an index to the first vec2 */
 void draw_glyphs( struct Font *font, float global_transform[16], size_t glyph_index, size_t num_instances, int flags );
 
+/* Per-instance color and transform, so that instances of a glyph with different colors and transforms are drawn with one call
+Between begin_instance_styles and end_instance_styles, draw_glyphs takes the color of each instance from the style VBO instead of set_text_color
+and transforms it by matrices[style.transform] * global_transform. F_DEBUG_COLORS has no effect there */
+#define MAX_INSTANCE_TRANSFORMS 16 /* must match the size of instance_matrices in bezv.glsl */
+typedef struct {
+	float color[4];
+	float transform; /* index to the matrices passed to set_instance_transforms */
+} InstanceStyle;
+void begin_instance_styles( void ); /* call after begin_text */
+void end_instance_styles( void );
+void set_instance_transforms( float matrices[][16], size_t count ); /* count <= MAX_INSTANCE_TRANSFORMS */
+void bind_instance_styles( GLuint_ vbo, size_t offset, size_t first ); /* The InstanceStyle array begins at byte 'offset' of the vbo. 'first' is an index to it, as in bind_glyph_positions */
+
 #endif
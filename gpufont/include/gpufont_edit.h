@@ -0,0 +1,41 @@
+#ifndef _FONT_EDIT_H
+#define _FONT_EDIT_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Editable text that is laid out incrementally
+Every line (text between two newlines) keeps its own batches and its own region of one shared position VBO
+An edit lays out only the lines it touches and uploads only their positions. Lines below are moved by drawing them with a different y offset
+*/
+
+struct Font;
+
+struct TextEdit;
+typedef struct TextEdit TextEdit;
+
+typedef struct {
+	size_t lines_laid_out;
+	size_t glyphs_uploaded;
+	size_t buffer_reallocs; /* the position VBO was grown or compacted */
+} TextEditStats;
+
+/* if max_line_len < 0 then lines are not wrapped. Returns NULL if out of memory. Needs a GL context */
+TextEdit *create_text_edit( struct Font *font, int max_line_len, float line_height_scale );
+void delete_text_edit( TextEdit *te );
+
+/* Line and column are counted in code points. The inserted text may contain newlines
+Deleting past the end of a line joins the following line to it (the newline counts as one code point)
+Both return 0 if the position is out of range or if out of memory. A failed insert leaves the text unchanged */
+int text_edit_insert( TextEdit *te, size_t line, size_t column, uint32_t const *text, size_t text_len );
+int text_edit_delete( TextEdit *te, size_t line, size_t column, size_t count );
+
+size_t text_edit_num_lines( TextEdit const *te );
+size_t text_edit_line_len( TextEdit const *te, size_t line );
+
+void draw_text_edit( TextEdit *te, float global_transform[16], int draw_flags );
+
+/* Counters since the TextEdit was created */
+void get_text_edit_stats( TextEdit const *te, TextEditStats *stats );
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _FONT_CACHE_H
+#define _FONT_CACHE_H
+#include "gpufont_ttf_file.h"
+
+/*
+Font cache files: a loaded font (typically a subset from load_ttf_subset) saved after triangulation and merging
+Loading a cache file only reads the merged arrays back, so it skips parsing and triangulating the outlines
+The file is in the native byte order and structure sizes of the machine that wrote it. Other machines refuse it with F_FAIL_UNSUP_VER
+Glyph indices and offsets are checked while loading, so a damaged file fails with F_FAIL_CORRUPT instead of reading or drawing outside the arrays
+*/
+
+struct Font;
+
+/* The font must have been merged (load_ttf_file_ex does that). The GL objects aren't saved */
+FontStatus save_font_cache( struct Font const *font, const char filename[] );
+
+/* Same as load_ttf_file_ex for a cache file. Call prepare_font afterwards as usual */
+FontStatus load_font_cache( struct Font *font, const char filename[] );
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _FONT_STACK_H
+#define _FONT_STACK_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Fallback chains of fonts (e.g. a latin UI font followed by a CJK font)
+Each character is drawn with the first font of the stack that has a glyph for it. Characters that no font has get glyph 0 of the first font
+The first font is the primary font: its line height is used and positions are computed in its units. Glyphs of the other fonts are scaled to the same EM size
+The stack keeps a copy of the BMP coverage bitmaps of its fonts, interleaved so that the bits of all fonts for the same characters are next to each other
+*/
+
+struct Font;
+struct GlyphBuffer;
+
+struct FontStack;
+typedef struct FontStack FontStack;
+
+/* A stack can have at most this many fonts */
+#define MAX_STACK_FONTS 16
+
+/* The fonts must stay alive as long as the stack. Returns NULL if out of memory or if num_fonts is 0 or too large. Needs no GL context */
+FontStack *create_font_stack( struct Font *const fonts[], size_t num_fonts );
+void delete_font_stack( FontStack *s );
+
+/* Returns the index of the font that draws the code point and sets *glyph to its glyph index in that font */
+size_t font_stack_lookup( FontStack const *s, uint32_t code, uint32_t *glyph );
+
+/* Same as do_simple_layout(_utf8) but with fallback fonts. Kerning and ligatures only apply between characters of the same font
+Batches are sorted by font and then by glyph so drawing binds each font once. Draw the buffer with draw_font_stack_buffer, not draw_glyph_buffer */
+struct GlyphBuffer *do_font_stack_layout( FontStack *s, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale );
+struct GlyphBuffer *do_font_stack_layout_utf8( FontStack *s, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, size_t *num_errors );
+
+/* Calls begin_text for each font that has glyphs in the buffer and draws its batches. Call end_text afterwards. Free the buffer with delete_glyph_buffer */
+void draw_font_stack_buffer( FontStack *s, struct GlyphBuffer *buffer, float global_transform[16], int draw_flags );
+
+/* Fonts of the stack in the order they were given */
+size_t font_stack_size( FontStack const *s );
+struct Font *font_stack_font( FontStack const *s, size_t n );
+
+#endif
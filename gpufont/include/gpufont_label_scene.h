@@ -0,0 +1,47 @@
+#ifndef _FONT_LABEL_SCENE_H
+#define _FONT_LABEL_SCENE_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Batches many short labels (map names, unit tags...) that are drawn together
+Labels are added every frame. Drawing sorts the glyphs of all labels by glyph, uploads their positions, colors and transform indices into one VBO
+and draws each distinct glyph once (once per group of MAX_INSTANCE_TRANSFORMS transforms, see gpufont_draw.h, if there are more), instead of once per label
+Where labels overlap, the label that was added last isn't necessarily drawn on top. F_DEBUG_COLORS has no effect
+*/
+
+struct Font;
+
+struct LabelScene;
+typedef struct LabelScene LabelScene;
+
+typedef struct {
+	/* The last frame that was drawn */
+	size_t labels;
+	size_t glyphs;
+	size_t transforms; /* largest transform index + 1 */
+	size_t draw_calls;
+	/* Since the scene was created */
+	size_t frames;
+	size_t buffer_reallocs; /* the position VBO was grown */
+} LabelSceneStats;
+
+/* Labels are not wrapped. Returns NULL if out of memory */
+LabelScene *create_label_scene( struct Font *font, float line_height_scale );
+void delete_label_scene( LabelScene *s );
+
+/* Removes all labels. Call at the beginning of each frame */
+void clear_label_scene( LabelScene *s );
+
+/* Adds a label with its first line at (x,y) font units. The text is laid out right away and isn't kept
+transform is an index to the array of matrices given to draw_label_scene. Returns 0 if out of memory
+Malformed UTF-8 is drawn as U+FFFD */
+int add_label( LabelScene *s, uint32_t const *text, size_t text_len, float x, float y, float const color[4], size_t transform );
+int add_label_utf8( LabelScene *s, char const *text, size_t num_bytes, float x, float y, float const color[4], size_t transform );
+
+/* Draws every label. Call begin_text first. Drawing again without changing the labels uploads nothing */
+void draw_label_scene( LabelScene *s, float transforms[][16], int draw_flags );
+
+void get_label_scene_stats( LabelScene const *s, LabelSceneStats *stats );
+
+#endif
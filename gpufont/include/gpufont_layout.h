@@ -22,7 +22,135 @@ void delete_glyph_buffer( GlyphBuffer *b );
 /* if max_line_len < 0 then text is not wrapped at all */
 GlyphBuffer *do_simple_layout( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale );
 
-/* Suitable for drawing short strings that are updated in real time. Will truncate string if its too long to fit in stack-allocated buffers */
+/* Suitable for drawing strings that are updated in real time
+Positions are streamed into one persistent VBO shared by all calls, so drawing doesn't create or delete GL objects
+Short strings are laid out in stack buffers. Longer strings use scratch memory that is kept for the next call. Strings are never truncated */
 void draw_text_live( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags );
 
+/* Same as above but the text is UTF-8 (length in bytes) or UTF-16 in native byte order (length in 16-bit units)
+Malformed sequences are drawn as U+FFFD and counted in *num_errors (if num_errors is not NULL. It is not reset) */
+GlyphBuffer *do_simple_layout_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, size_t *num_errors );
+GlyphBuffer *do_simple_layout_utf16( struct Font *font, uint16_t const *text, size_t num_units, int max_line_len, float line_height_scale, size_t *num_errors );
+void draw_text_live_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags, size_t *num_errors );
+void draw_text_live_utf16( struct Font *font, uint16_t const *text, size_t num_units, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags, size_t *num_errors );
+
+/* Frees the VBO and scratch memory used by draw_text_live. Call before destroying the GL context. They are recreated when needed */
+void release_live_text_buffers( void );
+
+/* Same as do_simple_layout(_utf8) but wraps lines that would be wider than max_line_width font units instead of counting characters
+Lines are broken after a space when possible. Words that don't fit on a line of their own (and CJK text) are broken between any two characters */
+GlyphBuffer *do_wrapped_layout( struct Font *font, uint32_t const *text, size_t text_len, int32_t max_line_width, float line_height_scale );
+GlyphBuffer *do_wrapped_layout_utf8( struct Font *font, char const *text, size_t num_bytes, int32_t max_line_width, float line_height_scale, size_t *num_errors );
+
+/* Same as do_simple_layout(_utf8) but also groups the glyphs into square tiles of tile_size font units (8 EMs if tile_size <= 0)
+draw_glyph_buffer then tests the bounding box of each tile against the view of global_transform and skips the glyphs of tiles that are outside it
+Worth it when much of the text is off screen, such as a long text placed in a 3D world. Batches are drawn in up to one call per visible run of tiles */
+GlyphBuffer *do_tiled_layout( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, int32_t tile_size );
+GlyphBuffer *do_tiled_layout_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, int32_t tile_size, size_t *num_errors );
+
+/* Counters of the draws of a tiled buffer since it was laid out */
+typedef struct {
+	size_t draws;
+	size_t tiles_tested; /* tiles that have something to draw. Summed over all draws like the rest */
+	size_t tiles_culled;
+	size_t instances_drawn;
+	size_t instances_culled;
+	size_t draw_calls;
+} TileCullStats;
+
+/* Returns 0 and zeroes *stats if the buffer isn't tiled */
+int get_tile_cull_stats( GlyphBuffer const *b, TileCullStats *stats );
+
+/* Same as do_simple_layout(_utf8) but also keeps an index for hit testing: which characters each glyph was made from, where its instance is and where it is on its row
+If tiled is nonzero the buffer is also tiled like do_tiled_layout, with the same tile_size. Queries take O(log n) time and need no GL */
+GlyphBuffer *do_indexed_layout( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, int tiled, int32_t tile_size );
+GlyphBuffer *do_indexed_layout_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, int tiled, int32_t tile_size, size_t *num_errors );
+
+/* A glyph of an indexed layout. Coordinates are font units in the same space as the glyph positions */
+typedef struct {
+	size_t text_begin, text_end; /* the code units (bytes for UTF-8) that the glyph was made from. A ligature is made from several characters */
+	size_t batch, instance; /* its position is instance 'instance' of batch 'batch' of the buffer */
+	int32_t line; /* the row after wrapping */
+	int32_t x0, x1; /* pen position before and after the glyph */
+	int32_t y0, y1; /* baseline + descender and baseline + ascender of the row */
+} GlyphHit;
+
+/* Finds the glyph at a point. A point left or right of a row hits the first or last glyph of the row, a point above or below the text hits the first or last row
+Returns 0 if the buffer has no index or the row has no glyphs */
+int hit_test_point( GlyphBuffer const *b, float x, float y, GlyphHit *hit );
+
+/* Text offset (in code units) of the caret position closest to a point: before or after the glyph at the point, or the beginning of an empty row */
+size_t caret_at_point( GlyphBuffer const *b, float x, float y );
+
+/* Finds the glyph that was made from the character at code unit text_pos. Returns 0 for newlines, offsets past the end and buffers without an index */
+int hit_test_char( GlyphBuffer const *b, size_t text_pos, GlyphHit *hit );
+
+/* Same as do_simple_layout(_utf8) but uses num_threads threads (all processors if num_threads <= 0)
+The text is split at newlines into spans that are laid out independently. The result is identical to the single-threaded layout
+Short texts are laid out on the calling thread */
+GlyphBuffer *do_simple_layout_parallel( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, int num_threads );
+GlyphBuffer *do_simple_layout_parallel_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, int num_threads, size_t *num_errors );
+
+/* Extents of a string as do_simple_layout would lay it out. In font units, in the same coordinate system as the glyph positions (line n is at y = n * line height)
+Measuring needs no GL context and doesn't allocate memory */
+typedef struct {
+	size_t num_lines; /* 1 + newlines + wraps */
+	int32_t max_width; /* advance width of the widest line */
+	int32_t xmin, ymin, xmax, ymax; /* union of the bounding boxes of all visible glyphs. All zero if there are none */
+} TextExtents;
+
+/* If line_widths is not NULL, the advance width of each of the first max_lines lines is written to it */
+void measure_text( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, TextExtents *ext, int32_t line_widths[], size_t max_lines );
+void measure_text_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, TextExtents *ext, int32_t line_widths[], size_t max_lines, size_t *num_errors );
+
+/* Measures many strings at once (in parallel if there are enough of them). ext[n] gets the extents of texts[n] */
+void measure_texts( struct Font *font, uint32_t const *const texts[], size_t const text_lens[], size_t num_texts, int max_line_len, float line_height_scale, TextExtents ext[] );
+void measure_texts_utf8( struct Font *font, char const *const texts[], size_t const text_lens[], size_t num_texts, int max_line_len, float line_height_scale, TextExtents ext[] );
+
+/* Two-phase layout into memory owned by the caller. Neither phase allocates memory or calls GL
+First get_layout_size tells how big the arrays must be. Then layout_into fills them with the same data that a GlyphBuffer holds:
+batch b draws batch_len[b] instances of glyph glyph_indices[b] and the batches' positions come one after another
+Upload the positions anywhere and draw each batch with bind_glyph_positions + draw_glyphs */
+typedef struct {
+	size_t num_glyphs; /* positions must have room for 2 * num_glyphs floats */
+	size_t num_batches; /* glyph_indices and batch_len must have room for num_batches elements */
+	size_t scratch_bytes; /* temporary memory used by layout_into */
+	uint32_t min_glyph, max_glyph; /* range of used glyph indices */
+} LayoutSize;
+
+typedef struct {
+	uint32_t *glyph_indices; /* GlyphIndex of each batch */
+	size_t *batch_len;
+	float *positions; /* GlyphCoord x,y pairs */
+	void *scratch; /* at least scratch_bytes. Must be aligned for size_t */
+} LayoutOutput;
+
+/* The size doesn't depend on wrapping or line height */
+void get_layout_size( struct Font *font, uint32_t const *text, size_t text_len, LayoutSize *size );
+void get_layout_size_utf8( struct Font *font, char const *text, size_t num_bytes, LayoutSize *size );
+
+/* The text must be the same that was passed to get_layout_size. Returns 0 if the text doesn't match the size */
+int layout_into( struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, LayoutSize const *size, LayoutOutput *out );
+int layout_into_utf8( struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, LayoutSize const *size, LayoutOutput *out, size_t *num_errors );
+
+/* Streaming layout for documents that are too large to be laid out at once
+Text is fed in chunks of any size (UTF-8 sequences may be split between chunks). Line and column state carries over from one chunk to the next
+Glyphs are emitted in pages of at most page_size glyphs. All pages share the same coordinate system
+page_func is called for each finished page and takes ownership of it: draw it with draw_glyph_buffer and free it with delete_glyph_buffer
+Memory usage is proportional to page_size, not to the size of the document */
+struct LayoutStream;
+typedef struct LayoutStream LayoutStream;
+typedef void (*LayoutPageFunc)( GlyphBuffer *page, void *user_data );
+
+/* Returns NULL if out of memory */
+LayoutStream *begin_layout_stream( struct Font *font, int max_line_len, float line_height_scale, size_t page_size, LayoutPageFunc page_func, void *user_data );
+
+/* Return 0 if out of memory. After a failure the stream ignores further input */
+int feed_layout_stream_utf32( LayoutStream *s, uint32_t const *text, size_t text_len );
+int feed_layout_stream_utf8( LayoutStream *s, char const *text, size_t num_bytes );
+
+/* Emits the last page and frees the stream. Adds the number of malformed UTF-8 sequences to *num_errors (if not NULL)
+Returns 0 if some part of the text couldn't be laid out */
+int end_layout_stream( LayoutStream *s, size_t *num_errors );
+
 #endif
@@ -0,0 +1,38 @@
+#ifndef _FONT_RUN_CACHE_H
+#define _FONT_RUN_CACHE_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Cache of laid out strings for text that is drawn again and again (HUDs, labels)
+A run is keyed by the font (and whether its kerning and substitution are on), the text and the layout parameters. A repeated string costs a hash lookup and the draw calls
+The least recently drawn runs are evicted when the cache would use more than its memory budget
+*/
+
+struct Font;
+struct RunCache;
+typedef struct RunCache RunCache;
+
+typedef struct {
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t num_runs; /* runs currently in the cache */
+	size_t bytes_used; /* CPU and GPU memory used by those runs */
+} RunCacheStats;
+
+/* memory_budget is in bytes. Returns NULL if out of memory */
+RunCache *create_run_cache( size_t memory_budget );
+
+/* Both free GL buffers. Call clear_run_cache before freeing a font that has been drawn through the cache */
+void delete_run_cache( RunCache *c );
+void clear_run_cache( RunCache *c );
+
+/* Same as draw_text_live(_utf8). A string larger than the whole budget is drawn but not cached */
+void draw_text_cached( RunCache *c, struct Font *font, uint32_t const *text, size_t text_len, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags );
+void draw_text_cached_utf8( RunCache *c, struct Font *font, char const *text, size_t num_bytes, int max_line_len, float line_height_scale, float global_transform[16], int draw_flags, size_t *num_errors );
+
+/* Counters since the cache was created */
+void get_run_cache_stats( RunCache const *c, RunCacheStats *stats );
+
+#endif
@@ -1,5 +1,7 @@
 #ifndef _FONT_FILE_H
 #define _FONT_FILE_H
+#include <stddef.h>
+#include <stdint.h>
 
 /*
 Microsoft's OpenType specification:
@@ -25,12 +27,31 @@ typedef enum {
 	F_FAIL_IMPOSSIBLE, /* should never happen */
 	F_FAIL_TRIANGULATE, /* failed to triangulate geometry */
 	F_FAIL_BUFFER_LIMIT, /* some statically allocated buffer is too small */
+	F_FAIL_WRITE, /* failed to write file */
 	NUM_FONT_STATUS_CODES
 } FontStatus;
 
+/* Flags for load_ttf_file_ex */
+enum {
+	LOAD_FLOAT_VERTICES=1, /* Store vertices as FloatVertex instead of the compact PackedVertex */
+	LOAD_OPTIMIZE_INDICES=2, /* Reorder solid triangles for better post-transform vertex cache hit rate */
+	LOAD_RENUMBER_VERTICES=4, /* Renumber each glyph's vertices in the order they are first used (only with LOAD_OPTIMIZE_INDICES) */
+	LOAD_NO_DEDUP=8, /* Don't share geometry between glyphs that have identical outlines */
+	LOAD_VERTICAL_FORMS=16 /* Also substitute the vertical forms of the GSUB features 'vert' and 'vrt2' (for text that is drawn top to bottom) */
+};
+
 struct Font;
 
 /* Returns 0 if success and nonzero if failure */
 FontStatus load_ttf_file( struct Font *font, const char filename[] );
+FontStatus load_ttf_file_ex( struct Font *font, const char filename[], int flags );
+
+/* Loads only the glyphs that the code points need: their cmap glyphs, the parts of composite glyphs, the glyphs that substitutions and ligatures turn them into, and glyph 0
+Glyphs are renumbered densely in their original order, so glyph indices differ from the file. The cmap, metrics, kerning and substitutions only cover the loaded glyphs
+Outlines of the other glyphs are never read, triangulated or uploaded */
+FontStatus load_ttf_subset( struct Font *font, const char filename[], int flags, uint32_t const code_points[], size_t num_code_points );
+
+/* Same but the code points are the characters of a UTF-8 sample text (e.g. every string the application can show) */
+FontStatus load_ttf_subset_utf8( struct Font *font, const char filename[], int flags, char const *sample_text, size_t num_bytes );
 
 #endif
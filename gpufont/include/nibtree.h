@@ -22,4 +22,8 @@ int nibtree_set( NibTree b[1], NibValue key, NibValue value );
 /* Retrieves value for given key. Returns 0 if key wasn't found */
 NibValue nibtree_get( NibTree b[1], NibValue key );
 
+/* Calls func for every key that has a nonzero value, in ascending key order */
+typedef void (*NibWalkFunc)( void *user_data, NibValue key, NibValue value );
+void nibtree_walk( NibTree b[1], NibWalkFunc func, void *user_data );
+
 #endif